@@ -2,6 +2,8 @@ F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V base.vert
 F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V base.frag
 F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred.vert -o deferred.vert.spv
 F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred.frag -o deferred.frag.spv
+F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred.frag -DVIRTUAL_TEXTURE -o deferred_vt.frag.spv
+F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred.frag -DTEXTURE_ARRAY -o deferred_array.frag.spv
 F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred_composition.vert -o deferred_composition.vert.spv
 F:/VulkanSDK/1.3.231.1/Bin/glslangValidator.exe -V deferred_composition.frag -o deferred_composition.frag.spv
 pause
\ No newline at end of file
@@ -1,6 +1,38 @@
 #version 450
 
+#ifdef TEXTURE_ARRAY
+// every material of the model, picked per draw
+layout(binding = 4) uniform sampler2DArray TexArrays[4];
+
+layout(push_constant) uniform TextureArrayDraw
+{
+	uint textureArray;
+	uint textureLayer;
+}draw;
+#else
 layout(binding = 4) uniform sampler2D TexSampler;
+#endif
+
+#ifdef VIRTUAL_TEXTURE
+// one bit per virtual page, set for the pages this frame wants
+layout(binding = 5) buffer Feedback
+{
+	uint bits[];
+}feedback;
+layout(binding = 6) uniform sampler2D PageTable;
+layout(binding = 7) uniform sampler2D PageAtlas;
+
+layout(push_constant) uniform VirtualTextureParams
+{
+	vec2 virtualSize;
+	vec2 pageCount;
+	float atlasPages;
+	float maxLevel;
+	float pageBorder;
+	float pagePayload;
+	uint feedbackOffset;
+}vt;
+#endif
 
 layout(location = 0) in vec3 inColor;
 layout(location = 1) in vec2 inTexCoord;
@@ -10,9 +42,49 @@ layout(location = 0) out vec4 outPosition;
 layout(location = 1) out vec4 outNormal;
 layout(location = 2) out vec4 outAlbedo;
 
+#ifdef VIRTUAL_TEXTURE
+vec4 SampleVirtual(vec2 uv)
+{
+	vec2 texel = uv * vt.virtualSize;
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy)))), 0.0, vt.maxLevel);
+	uv = fract(uv);
+
+	// a quarter of the pixels in each direction is plenty to find the pages on screen
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	if ((pixel.x & 3) == 0 && (pixel.y & 3) == 0)
+	{
+		uint mip = uint(level);
+		uvec2 pages = uvec2(vt.pageCount) >> mip;
+		uint page = 0;
+		for (uint i = 0; i < mip; i++)
+		{
+			page += (uint(vt.pageCount.x) >> i) * (uint(vt.pageCount.y) >> i);
+		}
+		uvec2 xy = min(uvec2(uv * vec2(pages)), pages - 1);
+		page += xy.y * pages.x + xy.x;
+		atomicOr(feedback.bits[vt.feedbackOffset + page / 32], 1u << (page % 32));
+	}
+
+	// atlas x, atlas y and level of the page that resolves this one, itself or a resident parent
+	vec3 entry = floor(textureLod(PageTable, uv, level).rgb * 255.0 + 0.5);
+	vec2 entryPages = max(floor(vt.pageCount / exp2(entry.b)), vec2(1.0));
+	vec2 inPage = fract(uv * entryPages);
+	vec2 atlasUv = (entry.rg + vt.pageBorder + inPage * vt.pagePayload) / vt.atlasPages;
+	return textureLod(PageAtlas, atlasUv, 0.0);
+}
+#endif
+
 void main()
 {
 	outPosition = vec4(inWorldPos, 1.0);
 	outNormal = vec4(inColor, 1.0);
+#ifdef VIRTUAL_TEXTURE
+	outAlbedo = SampleVirtual(inTexCoord);
+#elif defined(TEXTURE_ARRAY)
+	outAlbedo = texture(TexArrays[draw.textureArray], vec3(inTexCoord, float(draw.textureLayer)));
+#else
 	outAlbedo = texture(TexSampler, inTexCoord);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,707 @@
+#include "BlockCompression.h"
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <cstdint>
+#include <cstdlib>
+
+namespace
+{
+	const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	int Clamp(int v, int lo, int hi)
+	{
+		return v < lo ? lo : (v > hi ? hi : v);
+	}
+
+	void LoadBlock(const unsigned char* pRGBA, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bx, uint32_t by,
+		unsigned char texels[16][4])
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			uint32_t sy = by * 4 + y < height ? by * 4 + y : height - 1;
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+				memcpy(texels[y * 4 + x], pRGBA + (size_t)sy * pitch + sx * 4, 4);
+			}
+		}
+	}
+
+	void StoreBlock(const unsigned char texels[16][4], uint32_t width, uint32_t height, uint32_t pitch, uint32_t bx, uint32_t by,
+		unsigned char* pRGBA)
+	{
+		for (uint32_t y = 0; y < 4 && by * 4 + y < height; y++)
+		{
+			for (uint32_t x = 0; x < 4 && bx * 4 + x < width; x++)
+			{
+				memcpy(pRGBA + (size_t)(by * 4 + y) * pitch + (bx * 4 + x) * 4, texels[y * 4 + x], 4);
+			}
+		}
+	}
+
+	// Mean and dominant direction of the block in the first channels components (power iteration on the covariance)
+	void PrincipalAxis(const unsigned char texels[16][4], int channels, float mean[4], float axis[4])
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			mean[c] = 0.f;
+			axis[c] = 0.f;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				mean[c] += texels[i][c] / 16.f;
+			}
+		}
+
+		float cov[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float d[4];
+			for (int c = 0; c < channels; c++)
+			{
+				d[c] = texels[i][c] - mean[c];
+			}
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+				{
+					cov[a][b] += d[a] * d[b];
+				}
+			}
+		}
+
+		// start from the row of the widest channel, it can't be orthogonal to the dominant axis
+		int widest = 0;
+		for (int c = 1; c < channels; c++)
+		{
+			if (cov[c][c] > cov[widest][widest])
+			{
+				widest = c;
+			}
+		}
+		float v[4];
+		for (int c = 0; c < channels; c++)
+		{
+			v[c] = cov[widest][c];
+		}
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float largest = 0.f;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+				{
+					next[a] += cov[a][b] * v[b];
+				}
+				largest = std::fmax(largest, std::fabs(next[a]));
+			}
+			if (largest < 1e-6f)
+			{
+				return;// flat block, axis stays zero
+			}
+			for (int c = 0; c < channels; c++)
+			{
+				v[c] = next[c] / largest;
+			}
+		}
+
+		float length = 0.f;
+		for (int c = 0; c < channels; c++)
+		{
+			length += v[c] * v[c];
+		}
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++)
+		{
+			axis[c] = v[c] / length;
+		}
+	}
+
+	// Projects the block on its principal axis, endpoints at the two extremes
+	void AxisEndpoints(const unsigned char texels[16][4], int channels, float e0[4], float e1[4])
+	{
+		float mean[4], axis[4];
+		PrincipalAxis(texels, channels, mean, axis);
+		float minT = FLT_MAX;
+		float maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.f;
+			for (int c = 0; c < channels; c++)
+			{
+				t += (texels[i][c] - mean[c]) * axis[c];
+			}
+			minT = std::fmin(minT, t);
+			maxT = std::fmax(maxT, t);
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = std::fmin(255.f, std::fmax(0.f, mean[c] + axis[c] * maxT));
+			e1[c] = std::fmin(255.f, std::fmax(0.f, mean[c] + axis[c] * minT));
+		}
+	}
+
+	uint16_t PackRGB565(const float c[3])
+	{
+		int r = Clamp((int)(c[0] * 31.f / 255.f + 0.5f), 0, 31);
+		int g = Clamp((int)(c[1] * 63.f / 255.f + 0.5f), 0, 63);
+		int b = Clamp((int)(c[2] * 31.f / 255.f + 0.5f), 0, 31);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void UnpackRGB565(uint16_t v, int c[3])
+	{
+		int r = (v >> 11) & 31;
+		int g = (v >> 5) & 63;
+		int b = v & 31;
+		c[0] = (r << 3) | (r >> 2);
+		c[1] = (g << 2) | (g >> 4);
+		c[2] = (b << 3) | (b >> 2);
+	}
+
+	void ColorPalette(uint16_t c0, uint16_t c1, bool fourColors, int palette[4][4])
+	{
+		UnpackRGB565(c0, palette[0]);
+		UnpackRGB565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			if (fourColors)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		palette[0][3] = palette[1][3] = palette[2][3] = 255;
+		palette[3][3] = fourColors ? 255 : 0;
+	}
+
+	// Picks the nearest of the four colors per texel, returns the summed squared error
+	int FitColorIndices(const unsigned char texels[16][4], uint16_t c0, uint16_t c1, uint32_t& indices)
+	{
+		int palette[4][4];
+		ColorPalette(c0, c1, true, palette);
+		indices = 0;
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = INT32_MAX;
+			for (int k = 0; k < 4; k++)
+			{
+				int e = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = texels[i][c] - palette[k][c];
+					e += d * d;
+				}
+				if (e < bestError)
+				{
+					bestError = e;
+					best = k;
+				}
+			}
+			indices |= (uint32_t)best << (2 * i);
+			error += bestError;
+		}
+		return error;
+	}
+
+	// Least squares endpoints for fixed indices
+	bool RefineColorEndpoints(const unsigned char texels[16][4], uint32_t indices, uint16_t& c0, uint16_t& c1)
+	{
+		const float weights[4] = { 1.f, 0.f, 2.f / 3.f, 1.f / 3.f };
+		float aa = 0.f, ab = 0.f, bb = 0.f;
+		float ax[3] = {}, bx[3] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float a = weights[(indices >> (2 * i)) & 3];
+			float b = 1.f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < 3; c++)
+			{
+				ax[c] += a * texels[i][c];
+				bx[c] += b * texels[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+		{
+			return false;
+		}
+		float e0[3], e1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			e0[c] = std::fmin(255.f, std::fmax(0.f, (bb * ax[c] - ab * bx[c]) / det));
+			e1[c] = std::fmin(255.f, std::fmax(0.f, (aa * bx[c] - ab * ax[c]) / det));
+		}
+		c0 = PackRGB565(e0);
+		c1 = PackRGB565(e1);
+		return true;
+	}
+
+	void EncodeColorBlock(const unsigned char texels[16][4], unsigned char* pOut)
+	{
+		float e0[4], e1[4];
+		AxisEndpoints(texels, 3, e0, e1);
+		uint16_t c0 = PackRGB565(e0);
+		uint16_t c1 = PackRGB565(e1);
+		uint32_t indices = 0;
+		int error = FitColorIndices(texels, c0, c1, indices);
+
+		uint16_t r0 = c0, r1 = c1;
+		uint32_t refinedIndices = 0;
+		if (RefineColorEndpoints(texels, indices, r0, r1) && FitColorIndices(texels, r0, r1, refinedIndices) < error)
+		{
+			c0 = r0;
+			c1 = r1;
+			indices = refinedIndices;
+		}
+
+		// c0 > c1 selects the four color mode, swapping the endpoints swaps indices 0/1 and 2/3
+		if (c0 < c1)
+		{
+			uint16_t t = c0;
+			c0 = c1;
+			c1 = t;
+			indices ^= 0x55555555;
+		}
+		else if (c0 == c1)
+		{
+			indices = 0;
+		}
+		pOut[0] = (unsigned char)(c0 & 0xFF);
+		pOut[1] = (unsigned char)(c0 >> 8);
+		pOut[2] = (unsigned char)(c1 & 0xFF);
+		pOut[3] = (unsigned char)(c1 >> 8);
+		for (int k = 0; k < 4; k++)
+		{
+			pOut[4 + k] = (unsigned char)(indices >> (8 * k));
+		}
+	}
+
+	void DecodeColorBlock(const unsigned char* pIn, bool allowThreeColors, unsigned char texels[16][4])
+	{
+		uint16_t c0 = (uint16_t)(pIn[0] | (pIn[1] << 8));
+		uint16_t c1 = (uint16_t)(pIn[2] | (pIn[3] << 8));
+		uint32_t indices = pIn[4] | (pIn[5] << 8) | (pIn[6] << 16) | ((uint32_t)pIn[7] << 24);
+		int palette[4][4];
+		ColorPalette(c0, c1, !allowThreeColors || c0 > c1, palette);
+		for (int i = 0; i < 16; i++)
+		{
+			const int* p = palette[(indices >> (2 * i)) & 3];
+			for (int c = 0; c < 4; c++)
+			{
+				texels[i][c] = (unsigned char)p[c];
+			}
+		}
+	}
+
+	// BC4 style block of one channel, always in the eight value mode
+	void EncodeChannelBlock(const unsigned char texels[16][4], int channel, unsigned char* pOut)
+	{
+		int minV = 255;
+		int maxV = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			minV = texels[i][channel] < minV ? texels[i][channel] : minV;
+			maxV = texels[i][channel] > maxV ? texels[i][channel] : maxV;
+		}
+		pOut[0] = (unsigned char)maxV;
+		pOut[1] = (unsigned char)minV;
+
+		uint64_t bits = 0;
+		if (maxV > minV)
+		{
+			int palette[8];
+			palette[0] = maxV;
+			palette[1] = minV;
+			for (int k = 2; k < 8; k++)
+			{
+				palette[k] = ((8 - k) * maxV + (k - 1) * minV) / 7;
+			}
+			for (int i = 0; i < 16; i++)
+			{
+				int best = 0;
+				int bestError = INT32_MAX;
+				for (int k = 0; k < 8; k++)
+				{
+					int e = std::abs(texels[i][channel] - palette[k]);
+					if (e < bestError)
+					{
+						bestError = e;
+						best = k;
+					}
+				}
+				bits |= (uint64_t)best << (3 * i);
+			}
+		}
+		for (int k = 0; k < 6; k++)
+		{
+			pOut[2 + k] = (unsigned char)(bits >> (8 * k));
+		}
+	}
+
+	void DecodeChannelBlock(const unsigned char* pIn, int channel, unsigned char texels[16][4])
+	{
+		int palette[8];
+		palette[0] = pIn[0];
+		palette[1] = pIn[1];
+		if (palette[0] > palette[1])
+		{
+			for (int k = 2; k < 8; k++)
+			{
+				palette[k] = ((8 - k) * palette[0] + (k - 1) * palette[1]) / 7;
+			}
+		}
+		else
+		{
+			for (int k = 2; k < 6; k++)
+			{
+				palette[k] = ((6 - k) * palette[0] + (k - 1) * palette[1]) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+		uint64_t bits = 0;
+		for (int k = 0; k < 6; k++)
+		{
+			bits |= (uint64_t)pIn[2 + k] << (8 * k);
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			texels[i][channel] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+		}
+	}
+
+	struct BitWriter
+	{
+		unsigned char* pOut;
+		uint32_t position;
+
+		void Write(uint32_t value, uint32_t count)
+		{
+			for (uint32_t b = 0; b < count; b++, position++)
+			{
+				pOut[position >> 3] |= (unsigned char)(((value >> b) & 1) << (position & 7));
+			}
+		}
+	};
+
+	struct BitReader
+	{
+		const unsigned char* pIn;
+		uint32_t position;
+
+		uint32_t Read(uint32_t count)
+		{
+			uint32_t value = 0;
+			for (uint32_t b = 0; b < count; b++, position++)
+			{
+				value |= (uint32_t)((pIn[position >> 3] >> (position & 7)) & 1) << b;
+			}
+			return value;
+		}
+	};
+
+	int FitBC7Indices(const unsigned char texels[16][4], const int v0[4], const int v1[4], int indices[16])
+	{
+		int palette[16][4];
+		for (int k = 0; k < 16; k++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				palette[k][c] = (v0[c] * (64 - BC7_WEIGHTS4[k]) + v1[c] * BC7_WEIGHTS4[k] + 32) >> 6;
+			}
+		}
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0;
+			int bestError = INT32_MAX;
+			for (int k = 0; k < 16; k++)
+			{
+				int e = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					int d = texels[i][c] - palette[k][c];
+					e += d * d;
+				}
+				if (e < bestError)
+				{
+					bestError = e;
+					best = k;
+				}
+			}
+			indices[i] = best;
+			error += bestError;
+		}
+		return error;
+	}
+
+	// Mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4 bit indices
+	void EncodeBC7Mode6(const unsigned char texels[16][4], unsigned char* pOut)
+	{
+		float e0[4], e1[4];
+		AxisEndpoints(texels, 4, e1, e0);
+
+		int bestError = INT32_MAX;
+		int q0[4] = {}, q1[4] = {}, indices[16] = {};
+		int p0 = 0, p1 = 0;
+		for (int pBits = 0; pBits < 4; pBits++)
+		{
+			int t0 = pBits & 1;
+			int t1 = pBits >> 1;
+			int tq0[4], tq1[4], v0[4], v1[4], tIndices[16];
+			for (int c = 0; c < 4; c++)
+			{
+				tq0[c] = Clamp((int)std::floor((e0[c] - t0) / 2.f + 0.5f), 0, 127);
+				tq1[c] = Clamp((int)std::floor((e1[c] - t1) / 2.f + 0.5f), 0, 127);
+				v0[c] = (tq0[c] << 1) | t0;
+				v1[c] = (tq1[c] << 1) | t1;
+			}
+			int error = FitBC7Indices(texels, v0, v1, tIndices);
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(q0, tq0, sizeof(q0));
+				memcpy(q1, tq1, sizeof(q1));
+				memcpy(indices, tIndices, sizeof(indices));
+				p0 = t0;
+				p1 = t1;
+			}
+		}
+
+		// the anchor index is stored without its top bit, so texel 0 has to sit in the lower half
+		if (indices[0] & 8)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				int t = q0[c];
+				q0[c] = q1[c];
+				q1[c] = t;
+			}
+			int t = p0;
+			p0 = p1;
+			p1 = t;
+			for (int i = 0; i < 16; i++)
+			{
+				indices[i] = 15 - indices[i];
+			}
+		}
+
+		memset(pOut, 0, 16);
+		BitWriter writer = { pOut, 0 };
+		writer.Write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.Write(q0[c], 7);
+			writer.Write(q1[c], 7);
+		}
+		writer.Write(p0, 1);
+		writer.Write(p1, 1);
+		writer.Write(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+		{
+			writer.Write(indices[i], 4);
+		}
+	}
+
+	bool DecodeBC7Block(const unsigned char* pIn, unsigned char texels[16][4])
+	{
+		if ((pIn[0] & 0x7F) != (1 << 6))
+		{
+			return false;// only mode 6 is decoded
+		}
+		BitReader reader = { pIn, 7 };
+		int v0[4], v1[4];
+		for (int c = 0; c < 4; c++)
+		{
+			v0[c] = reader.Read(7) << 1;
+			v1[c] = reader.Read(7) << 1;
+		}
+		int p0 = reader.Read(1);
+		int p1 = reader.Read(1);
+		for (int c = 0; c < 4; c++)
+		{
+			v0[c] |= p0;
+			v1[c] |= p1;
+		}
+		for (int i = 0; i < 16; i++)
+		{
+			int index = reader.Read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+			{
+				texels[i][c] = (unsigned char)((v0[c] * (64 - BC7_WEIGHTS4[index]) + v1[c] * BC7_WEIGHTS4[index] + 32) >> 6);
+			}
+		}
+		return true;
+	}
+}
+
+VkFormat GetBlockVkFormat(BlockFormat format, bool srgb)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case BlockFormat::BC3: return srgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+	case BlockFormat::BC5: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case BlockFormat::BC7: return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+	case BlockFormat::BC1A: return srgb ? VK_FORMAT_BC1_RGBA_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	}
+	return VK_FORMAT_UNDEFINED;
+}
+
+bool GetBlockFormat(VkFormat vkFormat, BlockFormat& format, bool& srgb)
+{
+	srgb = false;
+	switch (vkFormat)
+	{
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		srgb = true;
+		// fall through
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		format = BlockFormat::BC1;
+		return true;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		srgb = true;
+		// fall through
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		format = BlockFormat::BC1A;
+		return true;
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		srgb = true;
+		// fall through
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		format = BlockFormat::BC3;
+		return true;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		format = BlockFormat::BC5;
+		return true;
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		srgb = true;
+		// fall through
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		format = BlockFormat::BC7;
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t GetBlockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 || format == BlockFormat::BC1A ? 8 : 16;
+}
+
+VkDeviceSize ComputeBlockChainLayout(BlockFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<MipLevelLayout>& levels)
+{
+	levels.resize(mipLevels);
+	VkDeviceSize offset = 0;
+	for (uint32_t i = 0; i < mipLevels; i++)
+	{
+		levels[i].offset = offset;
+		levels[i].width = width;
+		levels[i].height = height;
+		// whole blocks keep every level aligned to the block size, as vkCmdCopyBufferToImage requires
+		offset += (VkDeviceSize)((width + 3) / 4) * ((height + 3) / 4) * GetBlockBytes(format);
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return offset;
+}
+
+void EncodeBlocks(BlockFormat format, const unsigned char* pRGBA, uint32_t width, uint32_t height, uint32_t pitch, unsigned char* pBlocks)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	unsigned char texels[16][4];
+	unsigned char block[16];
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			LoadBlock(pRGBA, width, height, pitch, bx, by, texels);
+			switch (format)
+			{
+			case BlockFormat::BC1:
+			case BlockFormat::BC1A:
+				EncodeColorBlock(texels, block);
+				break;
+			case BlockFormat::BC3:
+				EncodeChannelBlock(texels, 3, block);
+				EncodeColorBlock(texels, block + 8);
+				break;
+			case BlockFormat::BC5:
+				EncodeChannelBlock(texels, 0, block);
+				EncodeChannelBlock(texels, 1, block + 8);
+				break;
+			case BlockFormat::BC7:
+				EncodeBC7Mode6(texels, block);
+				break;
+			}
+			// one store per block, staging memory may be write combined
+			memcpy(pBlocks, block, GetBlockBytes(format));
+			pBlocks += GetBlockBytes(format);
+		}
+	}
+}
+
+bool DecodeBlocks(BlockFormat format, const unsigned char* pBlocks, uint32_t width, uint32_t height, unsigned char* pRGBA, uint32_t pitch)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	unsigned char texels[16][4];
+	for (uint32_t by = 0; by < blocksY; by++)
+	{
+		for (uint32_t bx = 0; bx < blocksX; bx++)
+		{
+			switch (format)
+			{
+			case BlockFormat::BC1:
+				DecodeColorBlock(pBlocks, true, texels);
+				// the three color mode's fourth index is opaque black in the RGB formats
+				for (int i = 0; i < 16; i++)
+				{
+					texels[i][3] = 255;
+				}
+				break;
+			case BlockFormat::BC1A:
+				DecodeColorBlock(pBlocks, true, texels);
+				break;
+			case BlockFormat::BC3:
+				DecodeColorBlock(pBlocks + 8, false, texels);
+				DecodeChannelBlock(pBlocks, 3, texels);
+				break;
+			case BlockFormat::BC5:
+				for (int i = 0; i < 16; i++)
+				{
+					texels[i][2] = 0;
+					texels[i][3] = 255;
+				}
+				DecodeChannelBlock(pBlocks, 0, texels);
+				DecodeChannelBlock(pBlocks + 8, 1, texels);
+				break;
+			case BlockFormat::BC7:
+				if (!DecodeBC7Block(pBlocks, texels))
+				{
+					return false;
+				}
+				break;
+			}
+			StoreBlock(texels, width, height, pitch, bx, by, pRGBA);
+			pBlocks += GetBlockBytes(format);
+		}
+	}
+	return true;
+}
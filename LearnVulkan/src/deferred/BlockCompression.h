@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "MipChain.h"
+
+// 4x4 block compressed formats the importer can produce
+enum class BlockFormat : uint32_t
+{
+	BC1 = 0,// RGB, 8 bytes per block
+	BC3,// RGBA, BC1 color + interpolated alpha, 16 bytes
+	BC5,// two channels (normal map XY), 16 bytes
+	BC7,// RGBA, 16 bytes, encoded as mode 6 only
+	BC1A// BC1 with one bit alpha: the three color mode's fourth index is transparent black
+};
+
+VkFormat GetBlockVkFormat(BlockFormat format, bool srgb);
+// false for formats that aren't one of the above
+bool GetBlockFormat(VkFormat vkFormat, BlockFormat& format, bool& srgb);
+uint32_t GetBlockBytes(BlockFormat format);
+
+// Same as ComputeMipChainLayout, with each level rounded up to whole blocks
+VkDeviceSize ComputeBlockChainLayout(BlockFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<MipLevelLayout>& levels);
+
+// pRGBA is an RGBA8 image, pitch bytes per row. Blocks are written in row order and never read back,
+// so pBlocks can be mapped staging memory. Partial blocks at the right and bottom edge repeat the edge texels.
+void EncodeBlocks(BlockFormat format, const unsigned char* pRGBA, uint32_t width, uint32_t height, uint32_t pitch, unsigned char* pBlocks);
+
+// The fallback for devices without textureCompressionBC. BC5 decodes to (x, y, 0, 255).
+// Returns false on BC7 blocks in any mode other than 6, which is all EncodeBlocks writes.
+bool DecodeBlocks(BlockFormat format, const unsigned char* pBlocks, uint32_t width, uint32_t height, unsigned char* pRGBA, uint32_t pitch);
@@ -0,0 +1,211 @@
+#include "CodecBenchmarks.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "MappedFile.h"
+#include "MipChain.h"
+
+namespace
+{
+	const unsigned char PNG_SIGNATURE[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+	// Average of repeats runs of body(i), in ms
+	template <typename Body>
+	float AverageMs(int repeats, Body&& body)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < repeats; i++)
+		{
+			body(i);
+		}
+		return std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count() / repeats;
+	}
+
+	// RGBA decode of the whole file, the pixels are kept when pPixels is given
+	bool Decode(const MappedFile& source, int& width, int& height, std::vector<unsigned char>* pPixels = nullptr)
+	{
+		int comp = 0;
+		unsigned char* pDecoded = stbi_load_from_memory(source.GetData(), (int)source.GetSize(), &width, &height, &comp, STBI_rgb_alpha);
+		if (pDecoded && pPixels)
+		{
+			pPixels->assign(pDecoded, pDecoded + (size_t)width * height * 4);
+		}
+		stbi_image_free(pDecoded);
+		return pDecoded != nullptr;
+	}
+
+	bool IsJpeg(const MappedFile& source)
+	{
+		return source.GetSize() >= 2 && source.GetData()[0] == 0xFF && source.GetData()[1] == 0xD8;
+	}
+
+	bool IsPng(const MappedFile& source)
+	{
+		return source.GetSize() >= sizeof(PNG_SIGNATURE) && memcmp(source.GetData(), PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) == 0;
+	}
+
+	// The SSE2 kernels against the AVX2 ones, and whether both outputs match
+	void BenchmarkJpegKernels(const std::string& path, const MappedFile& source)
+	{
+		const int repeats = 10;
+		float times[2] = {};
+		std::vector<unsigned char> pixels[2];
+		bool avx2 = false;
+		int width = 0, height = 0;
+		for (int kernels = 0; kernels < 2; kernels++)
+		{
+			avx2 = stbi_set_jpeg_avx2(kernels) != 0;
+			times[kernels] = AverageMs(repeats, [&](int i) { Decode(source, width, height, i == 0 ? &pixels[kernels] : nullptr); });
+		}
+		stbi_set_jpeg_avx2(1);
+		std::cout << "Jpeg decode " << path << " (" << width << "x" << height << "): sse2 " << times[0] << " ms, "
+			<< (avx2 ? "avx2 " : "avx2 unavailable, sse2 again ") << times[1] << " ms, outputs "
+			<< (pixels[0] == pixels[1] ? "identical" : "differ") << std::endl;
+	}
+
+	// stb_image's parallel for on at most threadCount threads of the pool
+	struct LimitedPool
+	{
+		ThreadPool* pPool;
+		uint32_t threadCount;
+	};
+
+	void LimitedParallelFor(void* pUser, void(*task)(void*, int), void* pTaskData, int count)
+	{
+		const LimitedPool* pLimited = (const LimitedPool*)pUser;
+		pLimited->pPool->ParallelFor(count, pLimited->threadCount, [&](int i) { task(pTaskData, i); });
+	}
+
+	// Serial and then 1, 2, 4... threads up to the pool's workers plus the calling thread; files without
+	// restart markers take the serial path whatever the thread count
+	void BenchmarkJpegParallel(const std::string& path, const MappedFile& source, ThreadPool& pool)
+	{
+		const int repeats = 5;
+		int width = 0, height = 0;
+		auto decode = [&](int) { Decode(source, width, height); };
+		stbi_set_jpeg_parallel(nullptr, nullptr);
+		float serialTime = AverageMs(repeats, decode);
+		std::cout << "Jpeg parallel decode " << path << " (" << width << "x" << height << "): serial " << serialTime << " ms";
+		for (uint32_t threads = 1; threads <= pool.GetThreadCount() + 1; threads *= 2)
+		{
+			LimitedPool limited = { &pool, threads };
+			stbi_set_jpeg_parallel(LimitedParallelFor, &limited);
+			float time = AverageMs(repeats, decode);
+			std::cout << ", " << threads << " threads " << time << " ms (x" << serialTime / time << ")";
+		}
+		std::cout << std::endl;
+		stbi_set_jpeg_parallel(nullptr, nullptr);
+	}
+
+	// Per scale: full decode plus a box filtered chain down to that level, against stbi_load_scaled's reduced IDCT.
+	// Scaled sizes round up where mips round down, the difference is only reported when both sizes agree.
+	void BenchmarkScaledJpeg(const std::string& path, const MappedFile& source)
+	{
+		const int repeats = 5;
+		for (int scale = 1; scale <= 3; scale++)
+		{
+			std::vector<MipLevelLayout> levels;
+			std::vector<unsigned char> chain;
+			MipBuildOptions options;
+			options.filter = MipFilter::Box;
+			options.threadCount = 1;
+			float mipTime = AverageMs(repeats, [&](int)
+			{
+				int width = 0, height = 0, comp = 0;
+				unsigned char* pPixels = stbi_load_from_memory(source.GetData(), (int)source.GetSize(), &width, &height, &comp, STBI_rgb_alpha);
+				if (pPixels)
+				{
+					chain.resize((size_t)ComputeMipChainLayout(width, height, scale + 1, levels));
+					BuildMipChainRGBA8(pPixels, width * 4, chain.data(), levels, options);
+					stbi_image_free(pPixels);
+				}
+			});
+			if (levels.empty())
+			{
+				return;
+			}
+
+			int scaledWidth = 0, scaledHeight = 0;
+			std::vector<unsigned char> scaled;
+			float scaledTime = AverageMs(repeats, [&](int i)
+			{
+				int comp = 0;
+				unsigned char* pPixels = stbi_load_scaled_from_memory(source.GetData(), (int)source.GetSize(), &scaledWidth, &scaledHeight, &comp,
+					STBI_rgb_alpha, scale);
+				if (pPixels && i == 0)
+				{
+					scaled.assign(pPixels, pPixels + (size_t)scaledWidth * scaledHeight * 4);
+				}
+				stbi_image_free(pPixels);
+			});
+
+			const MipLevelLayout& level = levels[scale];
+			std::cout << "Jpeg 1/" << (1 << scale) << " " << path << ": decode + mips " << mipTime << " ms (" << level.width << "x" << level.height
+				<< "), scaled decode " << scaledTime << " ms (" << scaledWidth << "x" << scaledHeight << ")";
+			if (level.width == (uint32_t)scaledWidth && level.height == (uint32_t)scaledHeight && !scaled.empty())
+			{
+				const unsigned char* pMip = chain.data() + level.offset;
+				uint64_t difference = 0;
+				for (size_t i = 0; i < scaled.size(); i++)
+				{
+					difference += (uint64_t)std::abs((int)scaled[i] - (int)pMip[i]);
+				}
+				std::cout << ", mean difference " << (float)difference / scaled.size();
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	// stb_image's reference inflate and unfilter against the fast ones, as output MB/s, and whether both outputs match
+	void BenchmarkPng(const std::string& path, const MappedFile& source)
+	{
+		const int repeats = 10;
+		float rates[2] = {};
+		std::vector<unsigned char> pixels[2];
+		int width = 0, height = 0;
+		for (int fast = 0; fast < 2; fast++)
+		{
+			stbi_set_png_fast_decode(fast);
+			float time = AverageMs(repeats, [&](int i) { Decode(source, width, height, i == 0 ? &pixels[fast] : nullptr); });
+			rates[fast] = (float)width * height * 4 / (1024.f * 1024.f) / (time / 1000.f);
+		}
+		stbi_set_png_fast_decode(1);
+		std::cout << "Png decode " << path << " (" << width << "x" << height << "): reference " << rates[0] << " MB/s, fast "
+			<< rates[1] << " MB/s, outputs " << (pixels[0] == pixels[1] ? "identical" : "differ") << std::endl;
+	}
+}
+
+void RunCodecBenchmarks(const std::vector<std::string>& paths, ThreadPool& pool)
+{
+	for (const auto& path : paths)
+	{
+		MappedFile source;
+		if (!source.Open(path.c_str()))
+		{
+			continue;
+		}
+		if (IsJpeg(source))
+		{
+			BenchmarkJpegKernels(path, source);
+			BenchmarkJpegParallel(path, source, pool);
+			BenchmarkScaledJpeg(path, source);
+		}
+		else if (IsPng(source))
+		{
+			BenchmarkPng(path, source);
+		}
+		else
+		{
+			std::cout << "Codec benchmarks " << path << ": neither jpeg nor png, skipped" << std::endl;
+			continue;
+		}
+
+		int width = 0, height = 0;
+		std::vector<unsigned char> pixels;
+		if (Decode(source, width, height, &pixels))
+		{
+			BenchmarkMipFilters(pixels.data(), width, height, width * 4, true);
+		}
+	}
+}
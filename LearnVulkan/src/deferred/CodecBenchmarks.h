@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "../stb_image.h"
+#include "ThreadPool.h"
+
+// Startup benchmarks of the image decoders and the cpu mip filters, printed to stdout. Every jpeg is decoded
+// with the SSE2 and AVX2 kernels, serially and on 1, 2, 4... threads, and at 1/2, 1/4 and 1/8 scale against
+// a full decode plus mips; every png with the reference and the fast inflate and unfilter; every decodable
+// file then runs through each mip filter. Files of other types are skipped. Parallel decodes run on pool.
+// Leaves stb_image with the AVX2 kernels and the fast png path on and jpeg parallel decoding off.
+void RunCodecBenchmarks(const std::vector<std::string>& paths, ThreadPool& pool);
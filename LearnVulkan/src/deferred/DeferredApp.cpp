@@ -5,6 +5,10 @@
 #include <cassert>
 #include <glm/gtc/matrix_transform.hpp>
 #include <chrono>
+#include "MipChain.h"
+#include "BlockCompression.h"
+#include "Ktx2File.h"
+#include "CodecBenchmarks.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../stb_image.h"
 
@@ -57,6 +61,48 @@ const static std::vector<VertexData> g_Vertices =
 	{{-0.5f,   0.5f, -0.5f}, {1.f, 1.f, 0.f}, {0.f, 1.f} },
 };
 
+// true: texture mips are filtered on the cpu in linear space (the blit path averages sRGB encoded values)
+const static bool g_CpuMipChain = true;
+const static MipFilter g_TextureMipFilter = MipFilter::Kaiser;
+// true: textures are BC compressed at import when the device samples BC formats, RGBA8 otherwise
+const static bool g_CompressTextures = true;
+// jpegs larger than this on either side are decoded at 1/2, 1/4 or 1/8 size with stb_image's reduced IDCT
+const static uint32_t g_MaxTextureSize = 2048;
+// true: decoded textures are cooked once into cache/textures and memory mapped from there on later runs
+const static bool g_UseTextureCache = true;
+// true: ignore cooked files but still write them, to compare a cold start against a warm one
+const static bool g_ColdTextureCache = false;
+// true: textures are read, decoded and mipped on mThreadPool, only the uploads are recorded on the main thread
+const static bool g_ParallelTextureLoads = true;
+// true: cook a batch of textures serially and then in parallel at startup, cache off, and print both
+const static bool g_TextureLoadBenchmark = false;
+// true: the startup uploads are recorded into one transfer submit, flushed once; false: each resource's uploads are
+// submitted and waited for on their own, the way every copy used to go. The setup time is printed for either.
+const static bool g_BatchUploads = true;
+// true: jpegs with restart markers are decoded interval by interval on the calling thread and idle mThreadPool workers
+const static bool g_ParallelJpegDecode = true;
+// true: run the decoder and mip filter benchmarks of CodecBenchmarks.h on the textures at startup
+const static bool g_CodecBenchmarks = false;
+// true: the model texture skips the cooker, each band of rows goes to the transfer queue as soon as stb_image has
+// decoded it and the mips are blitted on the gpu (RGBA8, no cache or compression). Takes over from streaming.
+const static bool g_DecodeWhileUploading = false;
+const static uint32_t g_DecodeBandBytes = 4 * 1024 * 1024;// rows are gathered up to this much per flush
+// true: only the small mip levels are uploaded at startup, the rest streams in by on screen size
+const static bool g_StreamTextures = true;
+const static VkDeviceSize g_TextureStreamingBudget = 64ull * 1024 * 1024;
+// true: the model samples a virtual texture through a page table, pages load on demand from shader feedback.
+// Needs shader/deferred_vt.frag.spv (compile.bat) and fragmentStoresAndAtomics, off otherwise.
+const static bool g_VirtualTexture = true;
+const static char* g_VirtualTexturePath = "texture/pic.jpeg";
+// true: g_TexturePaths are packed into texture arrays at import and every face of the model is one draw that only
+// pushes its array and layer, all materials share one descriptor set. Takes over from streaming and virtual texturing.
+// Needs shader/deferred_array.frag.spv (compile.bat) and shaderSampledImageArrayDynamicIndexing, off otherwise.
+const static bool g_TextureArrays = false;
+const static std::vector<std::string> g_TexturePaths =
+{
+	"texture/huaji.jpg"
+};
+
 const static std::vector<uint16_t> g_Indices =
 {
 	0, 1, 2, 2, 3, 0,
@@ -67,29 +113,45 @@ const static std::vector<uint16_t> g_Indices =
 	20, 21, 22, 22, 23, 20
 };
 
-static std::vector<char> ReadFile(std::string_view fileName)
+// Mapped rather than read, so the bytes are the page cache's and never copied. SPIR-V needs 4 byte alignment,
+// which both the mapping and MappedFile's read fallback have.
+static MappedFile ReadFile(std::string_view fileName)
 {
-	std::vector<char> data;
-
-	std::ifstream in(fileName.data(), std::ios::ate | std::ios::binary);
-	if (!in.is_open())
+	MappedFile file;
+	if (!file.Open(fileName.data()))
 	{
 		std::cerr << "Failed open file : " << fileName.data() << std::endl;
-		return data;
 	}
+	return file;
+}
 
-	size_t size = (size_t)in.tellg();
-	data.resize(size);
-	in.seekg(0);
-	in.read(data.data(), size);
-
-	in.close();
+// stb_image's parallel for: the calling thread and the idle workers of the ThreadPool pUser points at pull
+// task indices, so decodes already spread over the pool by parallel texture loads don't start more threads.
+static void JpegParallelFor(void* pUser, void(*task)(void*, int), void* pTaskData, int count)
+{
+	static_cast<ThreadPool*>(pUser)->ParallelFor(count, 0, [&](int i) { task(pTaskData, i); });
+}
 
-	return data;
+// One copy per level, offsets relative to the staging region
+static std::vector<VkBufferImageCopy> GetLevelCopies(const std::vector<MipLevelLayout>& levels)
+{
+	std::vector<VkBufferImageCopy> regions(levels.size());
+	for (uint32_t i = 0; i < (uint32_t)levels.size(); i++)
+	{
+		regions[i] = {};
+		regions[i].bufferOffset = levels[i].offset;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = i;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = 1;
+		regions[i].imageExtent = { levels[i].width, levels[i].height, 1 };
+	}
+	return regions;
 }
 
 VulkanDeferredApp::VulkanDeferredApp(const std::string_view title, int width, int height)
-	: mWinWidth(width), mWinHeight(height), mCurrFrame(0), mFramebufferResized(false)
+	: mWinWidth(width), mWinHeight(height), mCurrFrame(0), mFramebufferResized(false),
+	mOffscreenUboOffset(0), m_pOffscreenCmdBuffer(VK_NULL_HANDLE), mUploadSubmitCount(0)
 {
 	InitWindow(title, width, height);
 }
@@ -130,6 +192,8 @@ void VulkanDeferredApp::InitVulkan()
 	CreateSurface();
 	PickPhysicalDevice();
 	CreateLogicDevice();
+	mMemoryAllocator.Init(m_pPhysicalDevice, m_pDevice);
+	mSamplerCache.Init(m_pPhysicalDevice, m_pDevice);
 	CreateSwapChain();
 	CreateSwapChainImageView();
 	CreateCommandPool();
@@ -138,11 +202,55 @@ void VulkanDeferredApp::InitVulkan()
 	CreateRenderPass();
 	CreateFrameBuffer();
 	CreateSemaphores();
+	QueueFamilyIndex queueFamilies = FindQueueFamilies(m_pPhysicalDevice);
+	mTransferUploader.Init(m_pDevice, queueFamilies.transferFamily, m_pTransferQueue, queueFamilies.graphicsFamily,
+		(uint32_t)mInFlightFences.size(), &mMemoryAllocator);
+	mUploadScheduler.Init(&mTransferUploader);
+	mTextureStreamer.Init(m_pDevice, &mMemoryAllocator, &mTransferUploader, &mUploadScheduler, (uint32_t)mInFlightFences.size(), g_TextureStreamingBudget);
+	mTextureArrays.Init(m_pDevice, &mMemoryAllocator, &mTransferUploader);
+
+	mThreadPool.Init();
+	if (g_CodecBenchmarks)
+	{
+		RunCodecBenchmarks({ "texture/huaji.jpg", "texture/pic.jpeg" }, mThreadPool);
+	}
 
+	auto uploadStartTime = std::chrono::high_resolution_clock::now();
+	// called after each resource: batched uploads are only submitted by the last call, unbatched ones every time and waited for
+	uint64_t flushedValue = 0;
+	auto flushUploads = [&](bool last)
+	{
+		if (g_BatchUploads && !last)
+		{
+			return;
+		}
+		uint64_t value = mTransferUploader.Flush();
+		if (value != flushedValue)
+		{
+			flushedValue = value;
+			mUploadSubmitCount++;
+		}
+		if (!g_BatchUploads)
+		{
+			mTransferUploader.Wait(value);
+		}
+	};
 	CreateVertexBuffer();
+	flushUploads(false);
 	CreateIndexBuffer();
+	flushUploads(false);
 
+	mTextureCache.Init("cache/textures");
+	if (g_ParallelJpegDecode)
+	{
+		stbi_set_jpeg_parallel(JpegParallelFor, &mThreadPool);
+	}
 	CreateTextureImage();
+	flushUploads(false);
+	CreateVirtualTexture();
+
+	// the gpu works through the uploads while the pipelines below are created
+	flushUploads(true);
 	CreateTextureImageView();
 	CreateTextureSampler();
 
@@ -154,6 +262,26 @@ void VulkanDeferredApp::InitVulkan()
 	CreateDescriptorSets();
 	BuildCommandBuffers();
 	BuildDeferredCommandBuffer();
+
+	mTransferUploader.WaitIdle();
+	float uploadTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - uploadStartTime).count();
+	std::cout << "Resource upload and setup (" << (g_BatchUploads ? "batched" : "one submit per resource") << "): " << uploadTime << " ms, "
+		<< mUploadSubmitCount << " submits" << std::endl;
+	mTextureCache.PrintStats();
+	mTextureStreamer.PrintStats();
+	if (mVirtualTexturing)
+	{
+		mVirtualTexture.PrintStats();
+	}
+	if (mTextureArraying)
+	{
+		mTextureArrays.PrintStats();
+		std::cout << "Offscreen pass: " << g_Indices.size() / 6 << " draws over " << mTextureSlots.size()
+			<< " materials, 1 descriptor set bind" << std::endl;
+	}
+
+	mMemoryAllocator.PrintStats();
+	mSamplerCache.PrintStats();
 }
 
 void VulkanDeferredApp::MainLoop()
@@ -169,12 +297,30 @@ void VulkanDeferredApp::MainLoop()
 
 void VulkanDeferredApp::Close()
 {
-
+	mThreadPool.Destroy();
+	mTextureStreamer.Destroy();
+	mVirtualTexture.Destroy();
+	mTextureArrays.Destroy();
+	mTransferUploader.Destroy();
+	mSamplerCache.Destroy();
+	mMemoryAllocator.Destroy();
 }
 
 void VulkanDeferredApp::DrawFrame()
 {
 	vkWaitForFences(m_pDevice, 1, &mInFlightFences[mCurrFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	// everything this frame index wrote last time has been consumed, recycle its transient memory
+	mFrameAllocator.BeginFrame(mCurrFrame);
+	mTransferUploader.BeginFrame(mCurrFrame);
+	if (mTextureStreamer.BeginFrame())
+	{
+		UpdateTextureDescriptor();
+	}
+	if (mVirtualTexturing)
+	{
+		// the feedback this frame index wrote last time is complete
+		mVirtualTexture.BeginFrame(mCurrFrame);
+	}
 
 	uint32_t imageIndex = 0;
 	VkResult result = vkAcquireNextImageKHR(m_pDevice, m_pSwapChain, std::numeric_limits<uint64_t>::max(), mImageAvailableSemaphores[mCurrFrame], nullptr, &imageIndex);
@@ -195,6 +341,8 @@ void VulkanDeferredApp::DrawFrame()
 
 	//UpdateUniformBuffer(imageIndex);
 	UpdateOffscreenUniformBuffer();
+	// the ubo lives at a new offset every frame
+	BuildDeferredCommandBuffer();
 
 	//ύָ
 	VkSubmitInfo info = {};
@@ -207,6 +355,32 @@ void VulkanDeferredApp::DrawFrame()
 	info.pWaitSemaphores = &mImageAvailableSemaphores[mCurrFrame];
 	info.pWaitDstStageMask = stageFlags;
 
+	// uploads flushed on the transfer queue since the last frame: wait on the timeline and acquire ownership first
+	VkCommandBuffer pAcquireCmdBuffer = VK_NULL_HANDLE;
+	uint64_t transferWaitValue = 0;
+	VkPipelineStageFlags transferWaitStage = 0;
+	mTransferUploader.TakeAcquire(pAcquireCmdBuffer, transferWaitValue, transferWaitStage);
+	VkCommandBuffer offscreenCmdBuffers[] = { pAcquireCmdBuffer, m_pOffscreenCmdBuffer };
+	VkSemaphore offscreenWaitSemaphores[] = { mImageAvailableSemaphores[mCurrFrame], mTransferUploader.GetTimelineSemaphore() };
+	VkPipelineStageFlags offscreenWaitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, transferWaitStage };
+	uint64_t offscreenWaitValues[] = { 0, transferWaitValue };// the binary semaphore value is ignored
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = 2;
+	timelineInfo.pWaitSemaphoreValues = offscreenWaitValues;
+	if (transferWaitValue > 0)
+	{
+		info.pNext = &timelineInfo;
+		info.waitSemaphoreCount = 2;
+		info.pWaitSemaphores = offscreenWaitSemaphores;
+		info.pWaitDstStageMask = offscreenWaitStages;
+		if (pAcquireCmdBuffer)
+		{
+			info.commandBufferCount = 2;
+			info.pCommandBuffers = offscreenCmdBuffers;
+		}
+	}
+
 	info.signalSemaphoreCount = 1;
 	info.pSignalSemaphores = &m_pOffscreenSemaphore[mCurrFrame];
 
@@ -218,6 +392,9 @@ void VulkanDeferredApp::DrawFrame()
 	}
 	vkWaitForFences(m_pDevice, 1, &mInFlightFences[mCurrFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
 	//scene
+	info.pNext = nullptr;
+	info.waitSemaphoreCount = 1;
+	info.pWaitDstStageMask = stageFlags;
 	info.pWaitSemaphores = &m_pOffscreenSemaphore[mCurrFrame];
 	info.pSignalSemaphores = &mImageFinishedSemaphores[mCurrFrame];
 
@@ -250,6 +427,16 @@ void VulkanDeferredApp::DrawFrame()
 		assert(0);
 	}
 	//vkQueueWaitIdle(m_pGraphicQueue);
+
+	// runtime uploads go out after this frame's submits, the next frame acquires them,
+	// so the copies overlap rendering instead of delaying it. The streamer and the virtual texture
+	// queue theirs, the scheduler drains them within its per frame budget.
+	mTextureStreamer.Update();
+	if (mVirtualTexturing)
+	{
+		mVirtualTexture.Update();
+	}
+	mUploadScheduler.Update();
 	mCurrFrame = (mCurrFrame + 1) % 2;
 }
 
@@ -373,6 +560,8 @@ void VulkanDeferredApp::PickPhysicalDevice()
 		std::cerr << "Failed to find suitable GPU" << std::endl;
 		return;
 	}
+
+	vkGetPhysicalDeviceProperties(m_pPhysicalDevice, &mPhysicalDeviceProperties);
 }
 
 void VulkanDeferredApp::CreateLogicDevice()
@@ -380,7 +569,7 @@ void VulkanDeferredApp::CreateLogicDevice()
 	QueueFamilyIndex index = FindQueueFamilies(m_pPhysicalDevice);
 
 	std::vector<VkDeviceQueueCreateInfo> QueueCreateInfos;
-	std::set<int32_t> UniqueQueueFamilise = { index.graphicsFamily, index.presentFamily };
+	std::set<int32_t> UniqueQueueFamilise = { index.graphicsFamily, index.presentFamily, index.transferFamily };
 
 	float priority = 1.f;
 	for (int32_t index : UniqueQueueFamilise)
@@ -393,11 +582,26 @@ void VulkanDeferredApp::CreateLogicDevice()
 		QueueCreateInfos.emplace_back(createInfo);
 	}
 
+	VkPhysicalDeviceFeatures featuresSupport;
+	vkGetPhysicalDeviceFeatures(m_pPhysicalDevice, &featuresSupport);
 	VkPhysicalDeviceFeatures features = {};
 	features.samplerAnisotropy = VK_TRUE;
+	// optional, textures stay uncompressed without it
+	features.textureCompressionBC = featuresSupport.textureCompressionBC;
+	mTextureCompressionBC = featuresSupport.textureCompressionBC == VK_TRUE;
+	features.fragmentStoresAndAtomics = featuresSupport.fragmentStoresAndAtomics;
+	mFragmentStoresAndAtomics = featuresSupport.fragmentStoresAndAtomics == VK_TRUE;
+	features.shaderSampledImageArrayDynamicIndexing = featuresSupport.shaderSampledImageArrayDynamicIndexing;
+	mSampledImageArrayDynamicIndexing = featuresSupport.shaderSampledImageArrayDynamicIndexing == VK_TRUE;
+
+	// the transfer uploader signals a timeline semaphore that DrawFrame waits on
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
 
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCreateInfo.pNext = &timelineFeatures;
 	deviceCreateInfo.pQueueCreateInfos = QueueCreateInfos.data();
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(QueueCreateInfos.size());
 	deviceCreateInfo.pEnabledFeatures = &features;
@@ -413,6 +617,7 @@ void VulkanDeferredApp::CreateLogicDevice()
 
 	vkGetDeviceQueue(m_pDevice, index.graphicsFamily, 0, &m_pGraphicQueue);
 	vkGetDeviceQueue(m_pDevice, index.presentFamily, 0, &m_pPresentQueue);
+	vkGetDeviceQueue(m_pDevice, index.transferFamily, 0, &m_pTransferQueue);
 }
 
 void VulkanDeferredApp::CreateSwapChain()
@@ -516,10 +721,8 @@ void VulkanDeferredApp::CreateDepthResource()
 	VkFormat depthFormat = FindDepthFormat();
 	CreateImage(mSwapChainImageExtent.width, mSwapChainImageExtent.height, 1, 1, VK_IMAGE_TYPE_2D,
 		depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_pDepthImage, m_pDepthImageMemory);
+		m_pDepthImage, mDepthImageMemory);
 	CreateImageView(m_pDepthImage, m_pDepthImageView, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-
-	//TransitionImageLayout(m_pDepthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
 }
 
 void VulkanDeferredApp::CreateRenderPass()
@@ -642,89 +845,571 @@ void VulkanDeferredApp::CreateSemaphores()
 void VulkanDeferredApp::CreateVertexBuffer()
 {
 	VkDeviceSize size = sizeof(g_Vertices[0]) * g_Vertices.size();
-	VkBuffer pTempBuffer;
-	VkDeviceMemory pTempMemory;
-	CreateBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, pTempBuffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, pTempMemory);
+	CreateBufferWithData(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, g_Vertices.data(), size, m_pVertexBuffer, mVertexBufferMemory, "vertex buffer");
+}
 
-	void* pData;
-	vkMapMemory(m_pDevice, pTempMemory, 0, size, 0, &pData);
-	memcpy(pData, g_Vertices.data(), size);
-	vkUnmapMemory(m_pDevice, pTempMemory);
+void VulkanDeferredApp::CreateIndexBuffer()
+{
+	VkDeviceSize size = sizeof(g_Indices[0]) * g_Indices.size();
+	CreateBufferWithData(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, g_Indices.data(), size, m_pIndexBuffer, mIndexBufferMemory, "index buffer");
+}
 
-	CreateBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, m_pVertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_pVertexBufferMemory);
+void VulkanDeferredApp::CreateTextureImage()
+{
+	// a pre-baked chain loads as a plain copy, the jpeg is only decoded when there is none.
+	// Texture arrays are packed from cooked textures, so they always go through the cooker.
+	mTextureArraying = CanUseTextureArrays();
+	if (!mTextureArraying && CreateTextureImageKtx2("texture/huaji.ktx2"))
+	{
+		return;
+	}
+	if (!mTextureArraying && g_DecodeWhileUploading && CreateTextureImageWhileDecoding(g_TexturePaths[0].c_str()))
+	{
+		return;
+	}
 
-	CopyBuffer(pTempBuffer, m_pVertexBuffer, size);
+	if (g_TextureLoadBenchmark)
+	{
+		std::vector<std::string> paths;
+		for (int i = 0; i < 8; i++)
+		{
+			paths.push_back("texture/huaji.jpg");
+			paths.push_back("texture/pic.jpeg");
+		}
+		std::vector<LoadedTexture> textures;
+		LoadTextures(paths, false, false, false, false, textures);
+		LoadTextures(paths, true, false, false, false, textures);
+	}
 
-	vkDestroyBuffer(m_pDevice, pTempBuffer, nullptr);
-	vkFreeMemory(m_pDevice, pTempMemory, nullptr);
+	// streaming and arrays keep the cooked chain on the cpu, otherwise the model texture is only ever staged
+	std::vector<LoadedTexture> textures;
+	LoadTextures(g_TexturePaths, g_ParallelTextureLoads, g_UseTextureCache && !g_ColdTextureCache, g_UseTextureCache,
+		!mTextureArraying && !g_StreamTextures, textures);
+	if (!textures[0].loaded)
+	{
+		assert(0);
+	}
+	if (mTextureArraying)
+	{
+		std::vector<TextureArraySlot> slots;
+		mTextureArrays.Pack(textures, slots);
+		mMipLevels = 1;
+		for (uint32_t i = 0; i < mTextureArrays.GetArrayCount(); i++)
+		{
+			mMipLevels = std::max(mMipLevels, mTextureArrays.GetMipLevels(i));
+		}
+		for (const auto& slot : slots)
+		{
+			if (slot.array != ~0u)
+			{
+				mTextureSlots.push_back(slot);
+			}
+		}
+		if (!mTextureSlots.empty())
+		{
+			m_pTextureImage = VK_NULL_HANDLE;
+			return;
+		}
+		std::cerr << "Texture arrays off: no texture could be packed" << std::endl;
+		mTextureArraying = false;
+	}
+	mMipLevels = textures[0].mipLevels;
+	mTextureFormat = textures[0].format;
+	if (g_StreamTextures)
+	{
+		m_pTextureImage = VK_NULL_HANDLE;
+		mStreamedTexture = mTextureStreamer.Add(std::move(textures[0]));
+	}
+	else
+	{
+		UploadTexture(textures[0], m_pTextureImage, mTextureImageMemory);
+	}
 }
 
-void VulkanDeferredApp::CreateIndexBuffer()
+void VulkanDeferredApp::LoadTextures(const std::vector<std::string>& paths, bool parallel, bool loadCache, bool storeCache, bool stageFirst,
+	std::vector<LoadedTexture>& textures)
 {
-	VkDeviceSize size = sizeof(g_Indices[0]) * g_Indices.size();
-	VkBuffer pTempBuffer;
-	VkDeviceMemory pTempMemory;
-	CreateBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, pTempBuffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, pTempMemory);
+	auto loadStartTime = std::chrono::high_resolution_clock::now();
+	textures.clear();
+	textures.resize(paths.size());
+	if (parallel)
+	{
+		// one task per texture, the pool threads left over go to the mip filters of each task. Workers don't own
+		// the staging ring, so a staged first texture is cooked here while they run.
+		uint32_t filterThreads = std::max(1u, mThreadPool.GetThreadCount() / (uint32_t)paths.size());
+		std::vector<std::future<void>> tasks;
+		for (size_t i = stageFirst ? 1 : 0; i < paths.size(); i++)
+		{
+			tasks.push_back(mThreadPool.Submit([this, &paths, &textures, i, filterThreads, loadCache, storeCache]()
+			{
+				textures[i].loaded = CookTexture(paths[i], filterThreads, loadCache, storeCache, false, textures[i]);
+			}));
+		}
+		if (stageFirst)
+		{
+			textures[0].loaded = CookTexture(paths[0], filterThreads, loadCache, storeCache, true, textures[0]);
+		}
+		for (auto& task : tasks)
+		{
+			task.get();
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			textures[i].loaded = CookTexture(paths[i], 0, loadCache, storeCache, stageFirst && i == 0, textures[i]);
+		}
+	}
+	float wallTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - loadStartTime).count();
+
+	float cookTime = 0.f;
+	for (const auto& texture : textures)
+	{
+		std::cout << "Texture " << texture.path << ": " << texture.width << "x" << texture.height << ", format " << texture.format << ", "
+			<< texture.mipLevels << " mip levels" << (texture.generateMips ? " (blitted on the gpu)" : "") << ", " << texture.size << " bytes, "
+			<< (texture.cacheHit ? "loaded from the texture cache" : texture.staging.pData ? "cooked into staging memory" : "cooked")
+			<< " in " << texture.cookTime << " ms" << std::endl;
+		cookTime += texture.cookTime;
+	}
+	std::cout << "Texture loads: " << textures.size() << " textures";
+	if (parallel)
+	{
+		std::cout << " on " << mThreadPool.GetThreadCount() << " threads";
+	}
+	else
+	{
+		std::cout << " serial";
+	}
+	std::cout << ", wall " << wallTime << " ms, sum of texture times " << cookTime << " ms" << std::endl;
+}
+
+bool VulkanDeferredApp::CookTexture(const std::string& path, uint32_t filterThreads, bool loadCache, bool storeCache, bool toStaging,
+	LoadedTexture& texture)
+{
+	auto cookStartTime = std::chrono::high_resolution_clock::now();
+	texture.path = path;
+
+	MappedFile source;
+	int width, height, comp = 0;
+	if (!source.Open(path.c_str()) || !stbi_info_from_memory(source.GetData(), (int)source.GetSize(), &width, &height, &comp))
+	{
+		std::cerr << "Texture " << path << " can't be read" << std::endl;
+		return false;
+	}
+
+	// the levels above the cap are never decoded, a reduced IDCT writes the smaller level directly.
+	// Other formats load at full size.
+	int scaleShift = 0;
+	bool jpeg = source.GetSize() >= 2 && source.GetData()[0] == 0xFF && source.GetData()[1] == 0xD8;
+	while (jpeg && scaleShift < 3 && ((uint32_t)std::max(width, height) >> scaleShift) > g_MaxTextureSize)
+	{
+		scaleShift++;
+	}
+	// stb_image rounds scaled sizes up
+	width = (width + (1 << scaleShift) - 1) >> scaleShift;
+	height = (height + (1 << scaleShift) - 1) >> scaleShift;
+
+	uint32_t mipLevels = ComputeMipLevels(width, height);
+
+	// opaque images go to BC1 (8:1 against RGBA8), images with alpha to BC7 (4:1)
+	BlockFormat blockFormat = comp == 4 || comp == 2 ? BlockFormat::BC7 : BlockFormat::BC1;
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_pPhysicalDevice, GetBlockVkFormat(blockFormat, false), &formatProperties);
+	bool compress = g_CompressTextures && mTextureCompressionBC &&
+		(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+	VkFormat format = compress ? GetBlockVkFormat(blockFormat, false) : VK_FORMAT_R8G8B8A8_UNORM;
+
+	// blits need linear filtering and blit support on the optimal tiling format, otherwise the chain is built on the cpu.
+	// Compressed images can't be blitted into at all.
+	vkGetPhysicalDeviceFormatProperties(m_pPhysicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	bool gpuMips = !compress && !g_CpuMipChain && (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
 
-	void* pData;
-	vkMapMemory(m_pDevice, pTempMemory, 0, size, 0, &pData);
-	memcpy(pData, g_Indices.data(), size);
-	vkUnmapMemory(m_pDevice, pTempMemory);
+	std::vector<MipLevelLayout> levels;
+	VkDeviceSize rgbaSize = ComputeMipChainLayout(width, height, gpuMips ? 1 : mipLevels, levels);
+	std::vector<MipLevelLayout> blockLevels;
+	VkDeviceSize imageSize = compress ? ComputeBlockChainLayout(blockFormat, width, height, mipLevels, blockLevels) : rgbaSize;
+	int rowPitch = width * 4;
 
-	CreateBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, m_pIndexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_pIndexBufferMemory);
+	// everything that shapes the cooked texels is part of the key
+	const uint32_t cookOptions[] = { (uint32_t)format, (uint32_t)levels.size(), (uint32_t)g_TextureMipFilter, (uint32_t)scaleShift };
+	TextureCacheKey key;
+	key.sourceHash = HashBytes(source.GetData(), source.GetSize());
+	key.optionsHash = HashBytes(cookOptions, sizeof(cookOptions));
 
-	CopyBuffer(pTempBuffer, m_pIndexBuffer, size);
+	texture.cacheHit = loadCache && mTextureCache.Load(key, texture.cooked) && texture.cooked.header.dataSize == imageSize;
+	if (!loadCache && storeCache)
+	{
+		mTextureCache.CountMiss();
+	}
+	if (!texture.cacheHit)
+	{
+		// workers don't own the staging ring, their texels are cooked on the heap and staged by UploadTexture.
+		// The decoder, the mip chain and the encoder only write their output; storing the cache file is the one read.
+		unsigned char* pOut = nullptr;
+		if (toStaging)
+		{
+			texture.staging = mTransferUploader.AllocateStaging(imageSize);
+			pOut = static_cast<unsigned char*>(texture.staging.pData);
+		}
+		else
+		{
+			texture.texels.resize((size_t)imageSize);
+			pOut = texture.texels.data();
+		}
+		auto releaseStaging = [&]()
+		{
+			if (toStaging)
+			{
+				mTransferUploader.ReleaseStaging(texture.staging);
+				texture.staging = StagingRegion();
+			}
+		};
+		if (gpuMips && scaleShift == 0)
+		{
+			if (!stbi_load_into_from_memory(source.GetData(), (int)source.GetSize(), pOut, (size_t)rowPitch * height, rowPitch,
+				&width, &height, &comp, STBI_rgb_alpha))
+			{
+				std::cerr << "Texture " << path << " can't be decoded" << std::endl;
+				releaseStaging();
+				return false;
+			}
+		}
+		else
+		{
+			int decodedWidth = 0, decodedHeight = 0;
+			unsigned char* pPixels = stbi_load_scaled_from_memory(source.GetData(), (int)source.GetSize(), &decodedWidth, &decodedHeight, &comp,
+				STBI_rgb_alpha, scaleShift);
+			if (!pPixels || decodedWidth != width || decodedHeight != height)
+			{
+				stbi_image_free(pPixels);
+				std::cerr << "Texture " << path << " can't be decoded" << std::endl;
+				releaseStaging();
+				return false;
+			}
+			if (gpuMips)
+			{
+				// only level 0 is staged, the rest is blitted on the gpu
+				memcpy(pOut, pPixels, (size_t)rowPitch * height);
+			}
+			else
+			{
+				MipBuildOptions options;
+				options.filter = g_TextureMipFilter;
+				options.threadCount = filterThreads;
+				if (compress)
+				{
+					// the encoder reads the chain back, so it is built apart from the output
+					std::vector<unsigned char> chain((size_t)rgbaSize);
+					BuildMipChainRGBA8(pPixels, rowPitch, chain.data(), levels, options);
+					for (uint32_t i = 0; i < mipLevels; i++)
+					{
+						EncodeBlocks(blockFormat, chain.data() + levels[i].offset, levels[i].width, levels[i].height, levels[i].width * 4,
+							pOut + blockLevels[i].offset);
+					}
+				}
+				else
+				{
+					BuildMipChainRGBA8(pPixels, rowPitch, pOut, levels, options);
+				}
+			}
+			stbi_image_free(pPixels);
+		}
 
-	vkDestroyBuffer(m_pDevice, pTempBuffer, nullptr);
-	vkFreeMemory(m_pDevice, pTempMemory, nullptr);
+		if (storeCache)
+		{
+			mTextureCache.Store(key, format, width, height, (uint32_t)levels.size(), pOut, imageSize);
+		}
+	}
+	if (compress)
+	{
+		levels.swap(blockLevels);
+	}
+
+	texture.format = format;
+	texture.width = width;
+	texture.height = height;
+	texture.mipLevels = mipLevels;
+	texture.generateMips = gpuMips;
+	texture.levels.swap(levels);
+	texture.size = imageSize;
+	texture.cookTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - cookStartTime).count();
+	return true;
 }
 
-void VulkanDeferredApp::CreateTextureImage()
+void VulkanDeferredApp::UploadTexture(const LoadedTexture& texture, VkImage& pImage, MemoryAllocation& memory)
+{
+	StagingRegion staging = texture.staging;
+	if (!staging.pData)
+	{
+		staging = mTransferUploader.AllocateStaging(texture.size);
+		memcpy(staging.pData, texture.GetTexels(), (size_t)texture.size);
+	}
+
+	CreateImage(texture.width, texture.height, 1, texture.mipLevels, VK_IMAGE_TYPE_2D, texture.format, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		pImage, memory);
+
+	// copied on the transfer queue, the first frame that samples it waits on the timeline semaphore
+	if (texture.generateMips)
+	{
+		mTransferUploader.UploadImageGenerateMips(pImage, staging, texture.width, texture.height, 0, texture.mipLevels,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	else
+	{
+		// every level in one batched copy
+		std::vector<VkBufferImageCopy> regions = GetLevelCopies(texture.levels);
+		mTransferUploader.UploadImageLevels(pImage, staging, regions.data(), (uint32_t)regions.size(), VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+}
+
+void VulkanDeferredApp::CreateVirtualTexture()
 {
+	if (!g_VirtualTexture)
+	{
+		return;
+	}
+	if (mTextureArraying)
+	{
+		std::cerr << "Virtual texturing off: the model samples texture arrays" << std::endl;
+		return;
+	}
+	if (!mFragmentStoresAndAtomics)
+	{
+		std::cerr << "Virtual texturing off: fragmentStoresAndAtomics is not supported" << std::endl;
+		return;
+	}
+	if (!std::ifstream("shader/deferred_vt.frag.spv").good())
+	{
+		std::cerr << "Virtual texturing off: shader/deferred_vt.frag.spv is missing, run compile.bat" << std::endl;
+		return;
+	}
+
+	MappedFile source;
 	int width, height, comp = 0;
-	unsigned char* data = stbi_load("texture/huaji.jpg", &width, &height, &comp, STBI_rgb_alpha);
-	VkDeviceSize imageSize = width * height * 4;
-	if (!data)
+	unsigned char* pPixels = nullptr;
+	if (source.Open(g_VirtualTexturePath))
 	{
-		assert(0);
+		pPixels = stbi_load_from_memory(source.GetData(), (int)source.GetSize(), &width, &height, &comp, STBI_rgb_alpha);
+	}
+	if (!pPixels)
+	{
+		std::cerr << "Virtual texture " << g_VirtualTexturePath << " can't be loaded" << std::endl;
+		return;
+	}
+	// its first pages are recorded on the transfer uploader here, InitVulkan flushes them with the other uploads
+	mVirtualTexturing = mVirtualTexture.Init(m_pDevice, &mMemoryAllocator, &mTransferUploader, &mUploadScheduler, &mSamplerCache,
+		(uint32_t)mInFlightFences.size(), pPixels, width, height, width * 4);
+	stbi_image_free(pPixels);
+	if (!mVirtualTexturing)
+	{
+		mVirtualTexture.Destroy();
+	}
+}
+
+bool VulkanDeferredApp::CanUseTextureArrays() const
+{
+	if (!g_TextureArrays)
+	{
+		return false;
+	}
+	if (!mSampledImageArrayDynamicIndexing)
+	{
+		std::cerr << "Texture arrays off: shaderSampledImageArrayDynamicIndexing is not supported" << std::endl;
+		return false;
+	}
+	if (!std::ifstream("shader/deferred_array.frag.spv").good())
+	{
+		std::cerr << "Texture arrays off: shader/deferred_array.frag.spv is missing, run compile.bat" << std::endl;
+		return false;
 	}
+	return true;
+}
 
-	mMipLevels = 1;
+bool VulkanDeferredApp::CreateTextureImageKtx2(const char* pPath)
+{
+	Ktx2File file;
+	if (!file.Open(pPath))
+	{
+		return false;
+	}
+	auto loadStartTime = std::chrono::high_resolution_clock::now();
+	const Ktx2Header& header = file.GetHeader();
 
-	VkBuffer pTempBuffer;
-	VkDeviceMemory pTempMemory;
-	CreateBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, imageSize, pTempBuffer, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, pTempMemory);
-	void* pData;
-	vkMapMemory(m_pDevice, pTempMemory, 0, imageSize, 0, &pData);
-	memcpy(pData, data, imageSize);
-	vkUnmapMemory(m_pDevice, pTempMemory);
+	// block compressed files are decoded to RGBA8 on devices that can't sample them
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_pPhysicalDevice, header.format, &formatProperties);
+	bool sampled = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+	BlockFormat blockFormat = BlockFormat::BC1;
+	bool srgb = false;
+	bool decode = !sampled && GetBlockFormat(header.format, blockFormat, srgb);
+	if (!sampled && !decode)
+	{
+		std::cerr << "KTX2 " << pPath << ": format " << header.format << " can't be sampled" << std::endl;
+		return false;
+	}
+	if (decode && blockFormat == BlockFormat::BC7)
+	{
+		// DecodeBlocks only reads mode 6, the one mode EncodeBlocks writes; other encoders use all eight,
+		// so a file would fail part way through its levels
+		std::cerr << "KTX2 " << pPath << ": BC7 can't be sampled on this device, and BC7 files are not decoded on the cpu" << std::endl;
+		return false;
+	}
+	mTextureFormat = decode ? (srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM) : header.format;
 
-	stbi_image_free(data);
+	std::vector<MipLevelLayout> levels;
+	VkDeviceSize imageSize = decode ? ComputeMipChainLayout(header.width, header.height, file.GetLevelCount(), levels)
+		: file.ComputeLevelLayout(levels);
+	StagingRegion staging = mTransferUploader.AllocateStaging(imageSize);
+	unsigned char* pStaging = static_cast<unsigned char*>(staging.pData);
+	std::vector<unsigned char> blocks;
+	for (uint32_t i = 0; i < file.GetLevelCount(); i++)
+	{
+		if (!decode)
+		{
+			// straight from the file into staging memory, Open() has checked every level covers its extent
+			if (!file.ReadLevel(i, pStaging + levels[i].offset))
+			{
+				mTransferUploader.ReleaseStaging(staging);
+				return false;
+			}
+			continue;
+		}
+
+		VkDeviceSize blockBytes = (VkDeviceSize)((levels[i].width + 3) / 4) * ((levels[i].height + 3) / 4) * GetBlockBytes(blockFormat);
+		blocks.resize((size_t)file.GetLevelSize(i));
+		if (file.GetLevelSize(i) < blockBytes || !file.ReadLevel(i, blocks.data())
+			|| !DecodeBlocks(blockFormat, blocks.data(), levels[i].width, levels[i].height, pStaging + levels[i].offset, levels[i].width * 4))
+		{
+			std::cerr << "KTX2 " << pPath << ": level " << i << " can't be decoded" << std::endl;
+			mTransferUploader.ReleaseStaging(staging);
+			return false;
+		}
+	}
 
-	CreateImage(width, height, 1, mMipLevels, VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_pTextureImage, m_pTextureImageMemory);
+	// levelCount 0 asks for the chain to be generated at load
+	vkGetPhysicalDeviceFormatProperties(m_pPhysicalDevice, mTextureFormat, &formatProperties);
+	const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	bool generateMips = header.levelCount == 0 && (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+	mMipLevels = generateMips ? ComputeMipLevels(header.width, header.height) : file.GetLevelCount();
 
-	//任
-	/*
-		ǴͼʹVK_IMAGE_LAYOUT_UNDEFINED֣תͼ񲼾ʱӦýVK_IMAGE_LAYOUT_UNDEFINEDָΪɲ.
-		Ҫע֮ΪǲҪȡƲ֮ǰͼݡ
-	*/
-	TransitionImageLayout(m_pTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mMipLevels);
-	CopyBufferToImage(pTempBuffer, m_pTextureImage, width, height);
-	//ΪܹɫвͼݣǻҪ1ͼ񲼾ֱ任
-	TransitionImageLayout(m_pTextureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mMipLevels);
+	CreateImage(header.width, header.height, 1, mMipLevels, VK_IMAGE_TYPE_2D, mTextureFormat, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_pTextureImage, mTextureImageMemory);
+	if (generateMips)
+	{
+		mTransferUploader.UploadImageGenerateMips(m_pTextureImage, staging, header.width, header.height, 0, mMipLevels,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	else
+	{
+		std::vector<VkBufferImageCopy> regions = GetLevelCopies(levels);
+		mTransferUploader.UploadImageLevels(m_pTextureImage, staging, regions.data(), mMipLevels, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
 
-	vkDestroyBuffer(m_pDevice, pTempBuffer, nullptr);
-	vkFreeMemory(m_pDevice, pTempMemory, nullptr);
+	float loadTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - loadStartTime).count();
+	std::cout << "Upload texture image " << pPath << " (ktx2, " << imageSize << " bytes staged, " << mMipLevels << " mip levels"
+		<< (decode ? ", decoded to RGBA8" : "") << "): " << loadTime << " ms" << std::endl;
+	return true;
+}
+
+struct DecodeBands
+{
+	VulkanTransferUploader* pUploader;
+	VkImage pImage;
+	const unsigned char* pPixels;
+	size_t rowPitch;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t bandRows;
+	uint32_t firstRow;// of the rows decoded but not uploaded yet
+	uint32_t flushes;
+};
+
+// stb_image callback: uploads what has gathered once it reaches a band, or the image is complete
+static void UploadDecodedRows(void* pUser, int firstRow, int rowCount)
+{
+	DecodeBands* pBands = (DecodeBands*)pUser;
+	uint32_t endRow = (uint32_t)(firstRow + rowCount);
+	if (endRow - pBands->firstRow < pBands->bandRows && endRow < pBands->height)
+	{
+		return;
+	}
+	pBands->pUploader->UploadImageRows(pBands->pImage, pBands->pPixels + pBands->rowPitch * pBands->firstRow, pBands->rowPitch,
+		pBands->width, pBands->height, pBands->firstRow, endRow - pBands->firstRow, pBands->mipLevels, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	pBands->pUploader->Flush();
+	pBands->firstRow = endRow;
+	pBands->flushes++;
+}
+
+bool VulkanDeferredApp::CreateTextureImageWhileDecoding(const char* pPath)
+{
+	auto loadStartTime = std::chrono::high_resolution_clock::now();
+	MappedFile source;
+	int width, height, comp = 0;
+	if (!source.Open(pPath) || !stbi_info_from_memory(source.GetData(), (int)source.GetSize(), &width, &height, &comp))
+	{
+		std::cerr << "Texture " << pPath << " can't be read" << std::endl;
+		return false;
+	}
+
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_pPhysicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	mTextureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	mMipLevels = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures ? ComputeMipLevels(width, height) : 1;
+	CreateImage(width, height, 1, mMipLevels, VK_IMAGE_TYPE_2D, mTextureFormat, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_pTextureImage, mTextureImageMemory);
+
+	// decoded in place, so the rows stb_image reports are final and can be staged right away
+	size_t rowPitch = (size_t)width * 4;
+	std::vector<unsigned char> pixels(rowPitch * height);
+	DecodeBands bands = { &mTransferUploader, m_pTextureImage, pixels.data(), rowPitch, (uint32_t)width, (uint32_t)height, mMipLevels,
+		std::max(1u, g_DecodeBandBytes / (uint32_t)rowPitch), 0, 0 };
+	if (!stbi_load_into_rows_from_memory(source.GetData(), (int)source.GetSize(), pixels.data(), pixels.size(), (int)rowPitch,
+		&width, &height, &comp, STBI_rgb_alpha, UploadDecodedRows, &bands))
+	{
+		std::cerr << "Texture " << pPath << " can't be decoded" << std::endl;
+		// bands may already be on the transfer queue, and their acquire and mip blits queued for the next frame
+		mTransferUploader.WaitIdle();
+		mTransferUploader.ForgetImage(m_pTextureImage);
+		vkDestroyImage(m_pDevice, m_pTextureImage, nullptr);
+		mMemoryAllocator.Free(mTextureImageMemory);
+		m_pTextureImage = VK_NULL_HANDLE;
+		return false;
+	}
+
+	float loadTime = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - loadStartTime).count();
+	std::cout << "Upload texture image " << pPath << " (decoded while uploading, " << bands.flushes << " bands, " << mMipLevels
+		<< " mip levels): " << loadTime << " ms" << std::endl;
+	return true;
 }
 
 void VulkanDeferredApp::CreateTextureImageView()
 {
+	if (mStreamedTexture != ~0u)
+	{
+		// owned by the streamer, replaced whenever the resident levels change
+		m_pTextureImageView = mTextureStreamer.GetImageView(mStreamedTexture);
+		return;
+	}
+	if (mTextureArraying)
+	{
+		// owned by mTextureArrays, binding 4 holds all of its arrays
+		m_pTextureImageView = mTextureArrays.GetImageView(0);
+		return;
+	}
 	CreateImageView(
 		m_pTextureImage, 
 		m_pTextureImageView, 
-		VK_FORMAT_R8G8B8A8_UNORM, 
+		mTextureFormat, 
 		VK_IMAGE_ASPECT_COLOR_BIT, 
 		mMipLevels);
 }
@@ -745,11 +1430,13 @@ void VulkanDeferredApp::CreateTextureSampler()
 	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	info.mipLodBias = 0.f;
 	info.minLod = 0.f;
-	info.maxLod = 0.f;
+	// no clamp, the view limits the levels, so textures with any mip count share this sampler
+	info.maxLod = VK_LOD_CLAMP_NONE;
 	info.compareEnable = VK_FALSE;
 	info.compareOp = VK_COMPARE_OP_ALWAYS;
 
-	if (vkCreateSampler(m_pDevice, &info, nullptr, &m_pTextureSampler) != VK_SUCCESS)
+	m_pTextureSampler = mSamplerCache.GetSampler(info);
+	if (!m_pTextureSampler)
 	{
 		assert(0);
 	}
@@ -869,7 +1556,7 @@ void VulkanDeferredApp::PrepareOffscreenFrameBuffer()
 		CreateImage(mOffscreenFrameBuffer.width, mOffscreenFrameBuffer.height, 1, 1,
 			VK_IMAGE_TYPE_2D, format, VK_IMAGE_TILING_OPTIMAL,
 			usage | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			mOffscreenFrameBuffer.attachments[i].pImage, mOffscreenFrameBuffer.attachments[i].pMemory);
+			mOffscreenFrameBuffer.attachments[i].pImage, mOffscreenFrameBuffer.attachments[i].memory);
 		CreateImageView(mOffscreenFrameBuffer.attachments[i].pImage, mOffscreenFrameBuffer.attachments[i].pImageView,
 			format, flags, 1);
 	}
@@ -910,7 +1597,8 @@ void VulkanDeferredApp::PrepareOffscreenFrameBuffer()
 	info.minLod = 0.f;
 	info.maxLod = 1.f;
 
-	if (vkCreateSampler(m_pDevice, &info, nullptr, &pColorSampler) != VK_SUCCESS)
+	pColorSampler = mSamplerCache.GetSampler(info);
+	if (!pColorSampler)
 	{
 		assert(0);
 	}
@@ -918,11 +1606,16 @@ void VulkanDeferredApp::PrepareOffscreenFrameBuffer()
 
 void VulkanDeferredApp::OffscreenUniformBuffer()
 {
-	//offscreen ubo
-	VkDeviceSize size = sizeof(UniformBufferObj);
-	CreateBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, size, mOffscreenUbo.pBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mOffscreenUbo.pMem);
+	//offscreen ubo, sub-allocated from the transient buffer every frame
+	const VkDeviceSize frameSize = 1024 * 1024;
+	const uint32_t frameCount = (uint32_t)mInFlightFences.size();
+	CreateBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		frameSize * frameCount, m_pTransientBuffer, MemoryUsage::CpuToGpu, mTransientBufferMemory);
+	mFrameAllocator.Init(m_pTransientBuffer, mTransientBufferMemory.pMapped, frameSize, frameCount);
+
 	// Deferred ubo
-	CreateBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, size, mCompositionUbo.pBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mCompositionUbo.pMem);
+	VkDeviceSize size = sizeof(UniformBufferObj);
+	CreateBuffer(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, size, mCompositionUbo.pBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mCompositionUbo.mem);
 
 	UpdateOffscreenUniformBuffer();
 }
@@ -939,10 +1632,22 @@ void VulkanDeferredApp::UpdateOffscreenUniformBuffer()
 	ubo.proj = glm::perspective(glm::radians(45.f), (float)mSwapChainImageExtent.width / mSwapChainImageExtent.height, 0.1f, 1000.f);
 	//ubo.proj[1][1] *= -1;
 
-	void* pData;
-	vkMapMemory(m_pDevice, mOffscreenUbo.pMem, 0, sizeof(ubo), 0, &pData);
-	memcpy(pData, &ubo, sizeof(ubo));
-	vkUnmapMemory(m_pDevice, mOffscreenUbo.pMem);
+	FrameAllocation allocation;
+	if (!mFrameAllocator.Allocate(sizeof(ubo), mPhysicalDeviceProperties.limits.minUniformBufferOffsetAlignment, allocation))
+	{
+		assert(0);
+	}
+	memcpy(allocation.pData, &ubo, sizeof(ubo));
+	mOffscreenUboOffset = (uint32_t)allocation.offset;
+
+	if (mStreamedTexture != ~0u)
+	{
+		// every face maps the whole texture onto a unit square, its projected height in pixels picks the mip level
+		glm::vec4 center = ubo.view * ubo.model * glm::vec4(0.f, 0.f, 0.f, 1.f);
+		float distance = std::max(-center.z, 0.1f);
+		float screenSize = ubo.proj[1][1] / distance * 0.5f * mSwapChainImageExtent.height;
+		mTextureStreamer.RequestLevel(mStreamedTexture, screenSize);
+	}
 }
 
 void VulkanDeferredApp::CreateDescriptorSetLayout()
@@ -951,32 +1656,56 @@ void VulkanDeferredApp::CreateDescriptorSetLayout()
 	std::vector<VkDescriptorSetLayoutBinding> deferredBinding(5);
 	//vertex shader uniform buffer
 	deferredBinding[0].binding = 0;
-	deferredBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	deferredBinding[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	deferredBinding[0].descriptorCount = 1;
 	deferredBinding[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	//samplers are baked in as immutable samplers, they never change after the layout is created
 	//position texture target
 	deferredBinding[1].binding = 1;
 	deferredBinding[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	deferredBinding[1].descriptorCount = 1;
 	deferredBinding[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	deferredBinding[1].pImmutableSamplers = &pColorSampler;
 	//normal texture target
 	deferredBinding[2].binding = 2;
 	deferredBinding[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	deferredBinding[2].descriptorCount = 1;
 	deferredBinding[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	deferredBinding[2].pImmutableSamplers = &pColorSampler;
 	//albedo texture target
 	deferredBinding[3].binding = 3;
 	deferredBinding[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	deferredBinding[3].descriptorCount = 1;
 	deferredBinding[3].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	//texture sampler
+	deferredBinding[3].pImmutableSamplers = &pColorSampler;
+	//texture sampler, or one per texture array
 	deferredBinding[4].binding = 4;
 	deferredBinding[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	deferredBinding[4].descriptorCount = 1;
+	deferredBinding[4].descriptorCount = mTextureArraying ? VulkanTextureArrays::MaxArrays : 1;
 	deferredBinding[4].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	deferredBinding[4].pImmutableSamplers = mSamplerCache.GetImmutableSamplers(m_pTextureSampler, deferredBinding[4].descriptorCount);
+	//virtual texture feedback, page table and page atlas, only written when virtual texturing is on
+	deferredBinding.resize(8);
+	deferredBinding[5].binding = 5;
+	deferredBinding[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	deferredBinding[5].descriptorCount = 1;
+	deferredBinding[5].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	deferredBinding[6].binding = 6;
+	deferredBinding[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	deferredBinding[6].descriptorCount = 1;
+	deferredBinding[6].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	deferredBinding[7].binding = 7;
+	deferredBinding[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	deferredBinding[7].descriptorCount = 1;
+	deferredBinding[7].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	if (mVirtualTexturing)
+	{
+		deferredBinding[6].pImmutableSamplers = mSamplerCache.GetImmutableSamplers(mVirtualTexture.GetPageTableSampler(), 1);
+		deferredBinding[7].pImmutableSamplers = mSamplerCache.GetImmutableSamplers(mVirtualTexture.GetAtlasSampler(), 1);
+	}
 	VkDescriptorSetLayoutCreateInfo deferredLayoutInfo = {};
 	deferredLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	deferredLayoutInfo.bindingCount = 5;
+	deferredLayoutInfo.bindingCount = (uint32_t)deferredBinding.size();
 	deferredLayoutInfo.pBindings = deferredBinding.data();
 
 	if (vkCreateDescriptorSetLayout(m_pDevice, &deferredLayoutInfo, nullptr, &m_pDescriptorSetLayout) != VK_SUCCESS)
@@ -987,8 +1716,8 @@ void VulkanDeferredApp::CreateDescriptorSetLayout()
 
 void VulkanDeferredApp::CreateDeferrdPipeline()
 {
-	std::vector<char> vertexShaderCode = ReadFile("shader/deferred_composition.vert.spv");
-	std::vector<char> fragmentShaderCode = ReadFile("shader/deferred_composition.frag.spv");
+	MappedFile vertexShaderCode = ReadFile("shader/deferred_composition.vert.spv");
+	MappedFile fragmentShaderCode = ReadFile("shader/deferred_composition.frag.spv");
 	VkShaderModule pVertexShaderModule = CreateShaderModule(vertexShaderCode);
 	VkShaderModule pFragmentShaderModule = CreateShaderModule(fragmentShaderCode);
 
@@ -1086,8 +1815,13 @@ void VulkanDeferredApp::CreateDeferrdPipeline()
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = 1;
 	pipelineLayoutCreateInfo.pSetLayouts = &m_pDescriptorSetLayout;
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+	// VirtualTextureParams for the virtual texturing fragment shader, TextureArrayDraw for the texture array one
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = (uint32_t)std::max(sizeof(VirtualTextureParams), sizeof(TextureArrayDraw));
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
 	if (vkCreatePipelineLayout(m_pDevice, &pipelineLayoutCreateInfo, nullptr, &m_pPipelineLayout) != VK_SUCCESS)
 	{
@@ -1137,7 +1871,8 @@ void VulkanDeferredApp::CreateDeferrdPipeline()
 	graphicsPipelineCreateInfo.renderPass = mOffscreenFrameBuffer.pRenderPass;
 
 	vertexShaderCode = ReadFile("shader/deferred.vert.spv");
-	fragmentShaderCode = ReadFile("shader/deferred.frag.spv");
+	fragmentShaderCode = ReadFile(mVirtualTexturing ? "shader/deferred_vt.frag.spv"
+		: mTextureArraying ? "shader/deferred_array.frag.spv" : "shader/deferred.frag.spv");
 	pVertexShaderModule = CreateShaderModule(vertexShaderCode);
 	pFragmentShaderModule = CreateShaderModule(fragmentShaderCode);
 
@@ -1176,15 +1911,20 @@ void VulkanDeferredApp::CreateDeferrdPipeline()
 
 void VulkanDeferredApp::CreateDescriptorPool()
 {
-	VkDescriptorPoolSize poolSize[2];
+	// every set of the shared layout takes up to 9 image samplers (binding 4 is an array of MaxArrays) and a storage buffer
+	VkDescriptorPoolSize poolSize[4];
 	poolSize[0].descriptorCount = (uint32_t)mSwapChainImages.size() + 8;
 	poolSize[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize[1].descriptorCount = (uint32_t)mSwapChainImages.size() + 8;
+	poolSize[1].descriptorCount = (uint32_t)mSwapChainImages.size() * (5 + VulkanTextureArrays::MaxArrays) + 8;
 	poolSize[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSize[2].descriptorCount = (uint32_t)mSwapChainImages.size() + 8;
+	poolSize[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize[3].descriptorCount = (uint32_t)mSwapChainImages.size() + 8;
+	poolSize[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 
 	VkDescriptorPoolCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	info.poolSizeCount = 2;
+	info.poolSizeCount = 4;
 	info.pPoolSizes = poolSize;
 	info.maxSets = (uint32_t)mSwapChainImages.size();
 
@@ -1261,7 +2001,7 @@ void VulkanDeferredApp::CreateDescriptorSets()
 	}
 
 	VkDescriptorBufferInfo modelBufferinfo = {};
-	modelBufferinfo.buffer = mOffscreenUbo.pBuffer;
+	modelBufferinfo.buffer = mFrameAllocator.GetBuffer();
 	modelBufferinfo.offset = 0;
 	modelBufferinfo.range = sizeof(UniformBufferObj);
 	VkWriteDescriptorSet writeSet = {};
@@ -1269,10 +2009,68 @@ void VulkanDeferredApp::CreateDescriptorSets()
 	writeSet.dstSet = m_pModelSet;
 	writeSet.dstBinding = 0;
 	writeSet.dstArrayElement = 0;
-	writeSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	writeSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	writeSet.descriptorCount = 1;
 	writeSet.pBufferInfo = &modelBufferinfo;
 
+	// with texture arrays every element gets a view, the ones past the packed arrays repeat the first
+	VkDescriptorImageInfo imageInfos[VulkanTextureArrays::MaxArrays] = {};
+	uint32_t imageCount = mTextureArraying ? VulkanTextureArrays::MaxArrays : 1;
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[i].imageView = mTextureArraying && i < mTextureArrays.GetArrayCount() ? mTextureArrays.GetImageView(i) : m_pTextureImageView;
+		imageInfos[i].sampler = m_pTextureSampler;
+	}
+	VkWriteDescriptorSet imageWriteSet = {};
+	imageWriteSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	imageWriteSet.dstSet = m_pModelSet;
+	imageWriteSet.dstBinding = 4;
+	imageWriteSet.dstArrayElement = 0;
+	imageWriteSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	imageWriteSet.descriptorCount = imageCount;
+	imageWriteSet.pImageInfo = imageInfos;
+
+	VkWriteDescriptorSet writes[] = { writeSet, imageWriteSet };
+	vkUpdateDescriptorSets(m_pDevice, 2, writes, 0, nullptr);
+
+	if (mVirtualTexturing)
+	{
+		VkDescriptorBufferInfo feedbackInfo = {};
+		feedbackInfo.buffer = mVirtualTexture.GetFeedbackBuffer();
+		feedbackInfo.offset = 0;
+		feedbackInfo.range = mVirtualTexture.GetFeedbackSize();
+		VkDescriptorImageInfo pageTableInfo = {};
+		pageTableInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		pageTableInfo.imageView = mVirtualTexture.GetPageTableView();
+		pageTableInfo.sampler = mVirtualTexture.GetPageTableSampler();
+		VkDescriptorImageInfo atlasInfo = {};
+		atlasInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		atlasInfo.imageView = mVirtualTexture.GetAtlasView();
+		atlasInfo.sampler = mVirtualTexture.GetAtlasSampler();
+
+		VkWriteDescriptorSet virtualWrites[3] = {};
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			virtualWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			virtualWrites[i].dstSet = m_pModelSet;
+			virtualWrites[i].dstBinding = 5 + i;
+			virtualWrites[i].dstArrayElement = 0;
+			virtualWrites[i].descriptorCount = 1;
+			virtualWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		}
+		virtualWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		virtualWrites[0].pBufferInfo = &feedbackInfo;
+		virtualWrites[1].pImageInfo = &pageTableInfo;
+		virtualWrites[2].pImageInfo = &atlasInfo;
+		vkUpdateDescriptorSets(m_pDevice, 3, virtualWrites, 0, nullptr);
+	}
+}
+
+void VulkanDeferredApp::UpdateTextureDescriptor()
+{
+	// m_pModelSet is only read by the offscreen pass, which DrawFrame waits for, so it is idle here
+	CreateTextureImageView();
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	imageInfo.imageView = m_pTextureImageView;
@@ -1285,9 +2083,7 @@ void VulkanDeferredApp::CreateDescriptorSets()
 	imageWriteSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	imageWriteSet.descriptorCount = 1;
 	imageWriteSet.pImageInfo = &imageInfo;
-
-	VkWriteDescriptorSet writes[] = { writeSet, imageWriteSet };
-	vkUpdateDescriptorSets(m_pDevice, 2, writes, 0, nullptr);
+	vkUpdateDescriptorSets(m_pDevice, 1, &imageWriteSet, 0, nullptr);
 }
 
 void VulkanDeferredApp::BuildCommandBuffers()
@@ -1338,7 +2134,9 @@ void VulkanDeferredApp::BuildCommandBuffers()
 		scissor.extent = mSwapChainImageExtent;
 		vkCmdSetScissor(mCommandBuffers[i], 0, 1, &scissor);
 
-		vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pPipelineLayout, 0, 1, &m_pDeferredSet, 0, nullptr);
+		// binding 0 is dynamic in the shared layout, the composition pass does not read it
+		uint32_t dynamicOffset = 0;
+		vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pPipelineLayout, 0, 1, &m_pDeferredSet, 1, &dynamicOffset);
 
 		vkCmdDraw(mCommandBuffers[i], 3, 1, 0, 0);
 
@@ -1410,6 +2208,11 @@ void VulkanDeferredApp::BuildDeferredCommandBuffer()
 		return;
 	}
 
+	if (mVirtualTexturing)
+	{
+		mVirtualTexture.RecordFeedbackClear(m_pOffscreenCmdBuffer, mCurrFrame);
+	}
+
 	vkCmdBeginRenderPass(m_pOffscreenCmdBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	VkViewport viewport{};
@@ -1427,14 +2230,37 @@ void VulkanDeferredApp::BuildDeferredCommandBuffer()
 	vkCmdSetScissor(m_pOffscreenCmdBuffer, 0, 1, &scissor);
 
 	vkCmdBindPipeline(m_pOffscreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pOffscerrnPipeline);
+	if (mVirtualTexturing)
+	{
+		VirtualTextureParams params = mVirtualTexture.GetParams(mCurrFrame);
+		vkCmdPushConstants(m_pOffscreenCmdBuffer, m_pPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(params), &params);
+	}
 
 	VkDeviceSize offset = 0;
 	vkCmdBindVertexBuffers(m_pOffscreenCmdBuffer, 0, 1, &m_pVertexBuffer, &offset);
 	vkCmdBindIndexBuffer(m_pOffscreenCmdBuffer, m_pIndexBuffer, 0, VK_INDEX_TYPE_UINT16);
-	vkCmdBindDescriptorSets(m_pOffscreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pPipelineLayout, 0, 1, &m_pModelSet, 0, nullptr);
-	vkCmdDrawIndexed(m_pOffscreenCmdBuffer, g_Indices.size(), 1, 0, 0, 0);
+	vkCmdBindDescriptorSets(m_pOffscreenCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pPipelineLayout, 0, 1, &m_pModelSet, 1, &mOffscreenUboOffset);
+	if (mTextureArraying)
+	{
+		// a material per face, switching material is a push constant instead of a descriptor set bind
+		for (uint32_t face = 0; face < (uint32_t)g_Indices.size() / 6; face++)
+		{
+			const TextureArraySlot& slot = mTextureSlots[face % mTextureSlots.size()];
+			TextureArrayDraw draw = { slot.array, slot.layer };
+			vkCmdPushConstants(m_pOffscreenCmdBuffer, m_pPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(draw), &draw);
+			vkCmdDrawIndexed(m_pOffscreenCmdBuffer, 6, 1, face * 6, 0, 0);
+		}
+	}
+	else
+	{
+		vkCmdDrawIndexed(m_pOffscreenCmdBuffer, g_Indices.size(), 1, 0, 0, 0);
+	}
 
 	vkCmdEndRenderPass(m_pOffscreenCmdBuffer);
+	if (mVirtualTexturing)
+	{
+		mVirtualTexture.RecordFeedbackBarrier(m_pOffscreenCmdBuffer);
+	}
 
 	if (vkEndCommandBuffer(m_pOffscreenCmdBuffer) != VK_SUCCESS)
 	{
@@ -1531,6 +2357,26 @@ QueueFamilyIndex VulkanDeferredApp::FindQueueFamilies(VkPhysicalDevice pDevice)
 		i++;
 	}
 
+	// prefer a transfer only family (the DMA engines on discrete cards), then anything without graphics
+	int32_t transferOnly = -1, nonGraphics = -1;
+	for (int32_t family = 0; family < (int32_t)QueueFamilies.size(); family++)
+	{
+		VkQueueFlags flags = QueueFamilies[family].queueFlags;
+		if (QueueFamilies[family].queueCount == 0 || !(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			continue;
+		}
+		if (!(flags & VK_QUEUE_COMPUTE_BIT) && transferOnly < 0)
+		{
+			transferOnly = family;
+		}
+		if (nonGraphics < 0)
+		{
+			nonGraphics = family;
+		}
+	}
+	index.transferFamily = transferOnly >= 0 ? transferOnly : (nonGraphics >= 0 ? nonGraphics : index.graphicsFamily);
+
 	return index;
 }
 
@@ -1634,7 +2480,7 @@ VkExtent2D VulkanDeferredApp::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& c
 	}
 }
 
-void VulkanDeferredApp::CreateImage(uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, VkImageType imageType, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags propertie, VkImage& pImage, VkDeviceMemory& pMemory)
+void VulkanDeferredApp::CreateImage(uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, VkImageType imageType, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags propertie, VkImage& pImage, MemoryAllocation& memory)
 {
 	VkImageCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1659,17 +2505,14 @@ void VulkanDeferredApp::CreateImage(uint32_t width, uint32_t height, uint32_t de
 	VkMemoryRequirements memoryRequirement;
 	vkGetImageMemoryRequirements(m_pDevice, pImage, &memoryRequirement);
 
-	VkMemoryAllocateInfo allocateInfo = {};
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.allocationSize = memoryRequirement.size;
-	allocateInfo.memoryTypeIndex = FindMemoryType(memoryRequirement.memoryTypeBits, propertie);
-
-	if (vkAllocateMemory(m_pDevice, &allocateInfo, nullptr, &pMemory) != VK_SUCCESS)
+	uint32_t memoryType = FindMemoryType(memoryRequirement.memoryTypeBits, propertie);
+	AllocationType type = tiling == VK_IMAGE_TILING_OPTIMAL ? AllocationType::ImageOptimal : AllocationType::ImageLinear;
+	if (!mMemoryAllocator.Allocate(memoryRequirement, memoryType, type, memory))
 	{
 		assert(0);
 	}
 
-	vkBindImageMemory(m_pDevice, pImage, pMemory, 0);
+	vkBindImageMemory(m_pDevice, pImage, memory.pMemory, memory.offset);
 }
 
 void VulkanDeferredApp::CreateImageView(VkImage pImage, VkImageView& pImageView, VkFormat format, VkImageAspectFlags aspectMask, uint32_t mipLevels)
@@ -1694,7 +2537,7 @@ void VulkanDeferredApp::CreateImageView(VkImage pImage, VkImageView& pImageView,
 	}
 }
 
-void VulkanDeferredApp::CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, VkMemoryPropertyFlags Property, VkDeviceMemory& pMemory)
+void VulkanDeferredApp::CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, VkMemoryPropertyFlags Property, MemoryAllocation& memory)
 {
 	VkBufferCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1710,32 +2553,90 @@ void VulkanDeferredApp::CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size
 	VkMemoryRequirements memoryRequirement;
 	vkGetBufferMemoryRequirements(m_pDevice, pBuffer, &memoryRequirement);
 
-	VkMemoryAllocateInfo allocateInfo = {};
-	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocateInfo.allocationSize = memoryRequirement.size;
-	allocateInfo.memoryTypeIndex = FindMemoryType(memoryRequirement.memoryTypeBits, Property);
+	uint32_t memoryType = FindMemoryType(memoryRequirement.memoryTypeBits, Property);
+	if (!mMemoryAllocator.Allocate(memoryRequirement, memoryType, AllocationType::Buffer, memory))
+	{
+		assert(0);
+	}
 
-	if (vkAllocateMemory(m_pDevice, &allocateInfo, nullptr, &pMemory) != VK_SUCCESS)
+	vkBindBufferMemory(m_pDevice, pBuffer, memory.pMemory, memory.offset);
+}
+
+void VulkanDeferredApp::CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, MemoryUsage memoryUsage, MemoryAllocation& memory)
+{
+	VkBufferCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	info.usage = usage;
+	info.size = size;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(m_pDevice, &info, nullptr, &pBuffer) != VK_SUCCESS)
 	{
 		assert(0);
 	}
 
-	vkBindBufferMemory(m_pDevice, pBuffer, pMemory, 0);
+	VkMemoryRequirements memoryRequirement;
+	vkGetBufferMemoryRequirements(m_pDevice, pBuffer, &memoryRequirement);
+
+	uint32_t memoryType = 0;
+	if (!mMemoryAllocator.FindMemoryType(memoryRequirement.memoryTypeBits, mMemoryAllocator.GetPolicy(memoryUsage), memoryType))
+	{
+		assert(0);
+	}
+	if (!mMemoryAllocator.Allocate(memoryRequirement, memoryType, AllocationType::Buffer, memory))
+	{
+		assert(0);
+	}
+
+	vkBindBufferMemory(m_pDevice, pBuffer, memory.pMemory, memory.offset);
+}
+
+void VulkanDeferredApp::CreateBufferWithData(VkBufferUsageFlags usage, const void* pData, VkDeviceSize size, VkBuffer& pBuffer, MemoryAllocation& memory, const char* pName)
+{
+	// transfer dst stays set so the buffer can still be refilled with a copy later
+	CreateBuffer(usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, pBuffer, MemoryUsage::Upload, memory);
+
+	// the policy only lands on a host visible type when device local memory is mappable (ReBAR, UMA),
+	// then the data is written straight into vram and the staging buffer and copy submit are skipped
+	if (memory.pMapped)
+	{
+		memcpy(memory.pMapped, pData, size);
+		std::cout << "Upload " << pName << " (" << size << " bytes): direct" << std::endl;
+		return;
+	}
+
+	// staged through the transfer uploader's ring, the first frame that draws with it waits on the timeline
+	VkPipelineStageFlags dstStage = 0;
+	VkAccessFlags dstAccess = 0;
+	if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+	{
+		dstStage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		dstAccess |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+	{
+		dstStage |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		dstAccess |= VK_ACCESS_INDEX_READ_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+	{
+		dstStage |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		dstAccess |= VK_ACCESS_UNIFORM_READ_BIT;
+	}
+	mTransferUploader.UploadBuffer(pBuffer, pData, size, dstStage, dstAccess);
+	std::cout << "Upload " << pName << " (" << size << " bytes): staged" << std::endl;
 }
 
 uint32_t VulkanDeferredApp::FindMemoryType(uint32_t fliter, VkMemoryPropertyFlags properties)
 {
-	VkPhysicalDeviceMemoryProperties deviceMemoryPrpperties;
-	vkGetPhysicalDeviceMemoryProperties(m_pPhysicalDevice, &deviceMemoryPrpperties);
-	for (uint32_t i = 0; i < deviceMemoryPrpperties.memoryTypeCount; i++)
+	MemoryTypePolicy policy;
+	policy.requiredFlags = properties;
+	uint32_t memoryType = 0;
+	if (!mMemoryAllocator.FindMemoryType(fliter, policy, memoryType))
 	{
-		if ((deviceMemoryPrpperties.memoryTypes[i].propertyFlags &properties) == properties && (fliter & (1 << i)))
-		{
-			return i;
-		}
+		assert(0);
 	}
-	assert(0);
-	return 0;
+	return memoryType;
 }
 
 VkFormat VulkanDeferredApp::FindDepthFormat()
@@ -1766,113 +2667,12 @@ VkFormat VulkanDeferredApp::FindSupportFormat(const std::vector<VkFormat>& candi
 	return VK_FORMAT_UNDEFINED;
 }
 
-void VulkanDeferredApp::TransitionImageLayout(VkImage pImage, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
-{
-	VkCommandBuffer pCommandBuffer = BeginSingleTimeCommands();
-	{
-		VkImageMemoryBarrier barrier = {};
-		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		barrier.image = pImage;
-		barrier.oldLayout = oldLayout;
-		barrier.newLayout = newLayout;
-		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;//ҪȨΪVK_QUEUE_FAMILY_IGNORED
-		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;//ҪȨΪVK_QUEUE_FAMILY_IGNORED
-		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		barrier.subresourceRange.levelCount = mipLevels;
-		barrier.subresourceRange.baseMipLevel = 0;
-		barrier.subresourceRange.layerCount = 1;
-		barrier.subresourceRange.baseArrayLayer = 0;
-		if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		{
-			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-			if (HasStencilComponent(format))
-			{
-				barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
-			}
-		}
-
-		VkPipelineStageFlags srcStageMask;
-		VkPipelineStageFlags dstStageMask;
-		if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-			srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-			dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-		{
-			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-			srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
-			dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-		}
-		else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-		{
-			barrier.srcAccessMask = 0;
-			barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-			srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-			dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-		}
-		else
-		{
-			assert(0);
-		}
-
-		vkCmdPipelineBarrier(pCommandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-	}
-	EndSingleTimeCommands(pCommandBuffer);
-}
-
-bool VulkanDeferredApp::HasStencilComponent(VkFormat format)
-{
-	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
-}
-
-void VulkanDeferredApp::CopyBufferToImage(VkBuffer pBuffer, VkImage pImage, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer pCommanndBuffer = BeginSingleTimeCommands();
-	{
-		VkBufferImageCopy regions = {};
-		regions.bufferOffset = 0;
-		regions.bufferRowLength = 0;//bufferRowLengthbufferImageHeightԱָڴеĴŷʽͨԱǿԶÿͼʹöĿռж롣ԱֵΪ0ݽڴбմš
-		regions.bufferImageHeight = 0;
-		regions.imageExtent.width = width;
-		regions.imageExtent.height = height;
-		regions.imageExtent.depth = 1;
-		regions.imageOffset = { 0, 0, 0 };
-		regions.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		regions.imageSubresource.layerCount = 1;
-		regions.imageSubresource.mipLevel = 0;
-		regions.imageSubresource.baseArrayLayer = 0;
-		vkCmdCopyBufferToImage(pCommanndBuffer, pBuffer, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &regions);
-	}
-	EndSingleTimeCommands(pCommanndBuffer);
-}
-
-void VulkanDeferredApp::CopyBuffer(VkBuffer pSrcBuffer, VkBuffer pDstBuffer, VkDeviceSize size)
-{
-	VkCommandBuffer pCommandBuffer = BeginSingleTimeCommands();
-	{
-		VkBufferCopy bufferCopy = {};
-		bufferCopy.srcOffset = 0;
-		bufferCopy.dstOffset = 0;
-		bufferCopy.size = size;
-
-		vkCmdCopyBuffer(pCommandBuffer, pSrcBuffer, pDstBuffer, 1, &bufferCopy);
-	}
-	EndSingleTimeCommands(pCommandBuffer);
-}
-
-VkShaderModule VulkanDeferredApp::CreateShaderModule(const std::vector<char>& shaderCode) const
+VkShaderModule VulkanDeferredApp::CreateShaderModule(const MappedFile& shaderCode) const
 {
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = shaderCode.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+	createInfo.codeSize = shaderCode.GetSize();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.GetData());
 
 	VkShaderModule pShader = VK_NULL_HANDLE;
 	if (vkCreateShaderModule(m_pDevice, &createInfo, nullptr, &pShader) != VK_SUCCESS)
@@ -1882,36 +2682,3 @@ VkShaderModule VulkanDeferredApp::CreateShaderModule(const std::vector<char>& sh
 	return pShader;
 }
 
-VkCommandBuffer VulkanDeferredApp::BeginSingleTimeCommands()
-{
-	VkCommandBufferAllocateInfo info = {};
-	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	info.commandBufferCount = 1;
-	info.commandPool = m_pCommandPool;
-
-	VkCommandBuffer pCommandBuffer;
-	vkAllocateCommandBuffers(m_pDevice, &info, &pCommandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	vkBeginCommandBuffer(pCommandBuffer, &beginInfo);
-
-	return pCommandBuffer;
-}
-
-void VulkanDeferredApp::EndSingleTimeCommands(VkCommandBuffer pCommandBuffer)
-{
-	vkEndCommandBuffer(pCommandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &pCommandBuffer;
-	vkQueueSubmit(m_pGraphicQueue, 1, &submitInfo, nullptr);
-	vkQueueWaitIdle(m_pGraphicQueue);
-
-	vkFreeCommandBuffers(m_pDevice, m_pCommandPool, 1, &pCommandBuffer);
-}
-
@@ -8,13 +8,26 @@
 #include <vector>
 #include <iostream>
 #include <glm/glm.hpp>
+#include "MemoryAllocator.h"
+#include "FrameAllocator.h"
+#include "TransferUploader.h"
+#include "UploadScheduler.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "TextureStreamer.h"
+#include "VirtualTexture.h"
+#include "TextureArrays.h"
+#include "SamplerCache.h"
+#include "MipChain.h"
+#include "MappedFile.h"
 
 struct QueueFamilyIndex
 {
 	int32_t graphicsFamily;
 	int32_t presentFamily;
+	int32_t transferFamily;// a transfer only family when there is one, graphicsFamily otherwise
 
-	QueueFamilyIndex() : graphicsFamily(-1) {}
+	QueueFamilyIndex() : graphicsFamily(-1), presentFamily(-1), transferFamily(-1) {}
 
 	bool IsComplete() const
 	{
@@ -85,7 +98,7 @@ struct CompositionUbo
 struct UniformBuffer
 {
 	VkBuffer pBuffer;
-	VkDeviceMemory pMem;
+	MemoryAllocation mem;
 };
 
 class VulkanDeferredApp
@@ -128,7 +141,19 @@ private:
 	void CreateIndexBuffer();
 
 	void CreateTextureImage();
+	bool CreateTextureImageKtx2(const char* pPath);
+	bool CreateTextureImageWhileDecoding(const char* pPath);
+	// loadCache: take cooked files that match, storeCache: write what had to be cooked. stageFirst: the first
+	// texture goes straight to UploadTexture, so it is cooked on the calling thread into staging memory
+	void LoadTextures(const std::vector<std::string>& paths, bool parallel, bool loadCache, bool storeCache, bool stageFirst,
+		std::vector<LoadedTexture>& textures);
+	// toStaging: cook into a region of the transfer uploader, main thread only
+	bool CookTexture(const std::string& path, uint32_t filterThreads, bool loadCache, bool storeCache, bool toStaging, LoadedTexture& texture);
+	void UploadTexture(const LoadedTexture& texture, VkImage& pImage, MemoryAllocation& memory);
+	void CreateVirtualTexture();
+	bool CanUseTextureArrays() const;
 	void CreateTextureImageView();
+	void UpdateTextureDescriptor();
 	void CreateTextureSampler();
 	void PrepareOffscreenFrameBuffer();
 	void OffscreenUniformBuffer();
@@ -151,26 +176,22 @@ private:
 	VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) const;
 	void CreateImage(uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels,
 		VkImageType imageType, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-		VkMemoryPropertyFlags propertie, VkImage& pImage, VkDeviceMemory& pMemory);
+		VkMemoryPropertyFlags propertie, VkImage& pImage, MemoryAllocation& memory);
 	void CreateImageView(VkImage pImage, VkImageView& pImageView, VkFormat format, VkImageAspectFlags aspectMask, uint32_t mipLevels);
-	void CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, VkMemoryPropertyFlags Property, VkDeviceMemory& pMemory);
+	void CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, VkMemoryPropertyFlags Property, MemoryAllocation& memory);
+	void CreateBuffer(VkBufferUsageFlags usage, VkDeviceSize size, VkBuffer& pBuffer, MemoryUsage memoryUsage, MemoryAllocation& memory);
+	// Device local buffer filled with pData, written directly when vram is host visible, staged otherwise
+	void CreateBufferWithData(VkBufferUsageFlags usage, const void* pData, VkDeviceSize size, VkBuffer& pBuffer, MemoryAllocation& memory, const char* pName);
 	uint32_t FindMemoryType(uint32_t fliter, VkMemoryPropertyFlags properties);
 	VkFormat FindDepthFormat();
 	VkFormat FindSupportFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
-	void TransitionImageLayout(VkImage pImage, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
-	bool HasStencilComponent(VkFormat format);
-	void CopyBufferToImage(VkBuffer pBuffer, VkImage pImage, uint32_t width, uint32_t height);
-	void CopyBuffer(VkBuffer pSrcBuffer, VkBuffer pDstBuffer, VkDeviceSize size);
-	VkShaderModule CreateShaderModule(const std::vector<char>& shaderCode) const;
-
-	VkCommandBuffer BeginSingleTimeCommands();
-	void EndSingleTimeCommands(VkCommandBuffer pCommandBuffer);
+	VkShaderModule CreateShaderModule(const MappedFile& shaderCode) const;
 
 	struct FrameBufferAttachment
 	{
 		VkImage			pImage;
 		VkImageView		pImageView;
-		VkDeviceMemory	pMemory;
+		MemoryAllocation	memory;
 		VkFormat		format;
 	};
 
@@ -189,10 +210,12 @@ private:
 	VkInstance m_pVKInstance;
 	VkDebugUtilsMessengerEXT m_pDebugUtils;
 	VkPhysicalDevice m_pPhysicalDevice = VK_NULL_HANDLE;//Զ
+	VkPhysicalDeviceProperties mPhysicalDeviceProperties;
 	VkDevice m_pDevice;
 	VkQueue m_pGraphicQueue;//Զ
 	VkSurfaceKHR m_pSurface;
 	VkQueue m_pPresentQueue;
+	VkQueue m_pTransferQueue;
 
 	VkSwapchainKHR m_pSwapChain;
 	std::vector<VkImage> mSwapChainImages;
@@ -217,9 +240,9 @@ private:
 	bool mFramebufferResized;
 
 	VkBuffer m_pVertexBuffer;
-	VkDeviceMemory m_pVertexBufferMemory;
+	MemoryAllocation mVertexBufferMemory;
 	VkBuffer m_pIndexBuffer;
-	VkDeviceMemory m_pIndexBufferMemory;
+	MemoryAllocation mIndexBufferMemory;
 
 	std::vector<VkBuffer> mUniformBuffers;
 	std::vector<VkDeviceMemory> mUniformBuffersMemory;
@@ -228,25 +251,48 @@ private:
 	std::vector<VkDescriptorSet> mDescriptorSets;//ضʱԶ
 
 	uint32_t mMipLevels;
+	VkFormat mTextureFormat;
+	bool mTextureCompressionBC = false;// device supports and has enabled textureCompressionBC
+	bool mFragmentStoresAndAtomics = false;// needed by the virtual texture feedback
+	bool mSampledImageArrayDynamicIndexing = false;// needed to pick a texture array per draw
 	VkImage m_pTextureImage;
-	VkDeviceMemory m_pTextureImageMemory;
+	MemoryAllocation mTextureImageMemory;
+	uint32_t mStreamedTexture = ~0u;// id in mTextureStreamer, ~0u when the texture isn't streamed
 	VkImageView m_pTextureImageView;
 	VkSampler m_pTextureSampler;
 
 	VkImage m_pDepthImage;
-	VkDeviceMemory m_pDepthImageMemory;
+	MemoryAllocation mDepthImageMemory;
 	VkImageView m_pDepthImageView;
 
 	FrameBuffer mOffscreenFrameBuffer;
 	// One sampler for the frame buffer color attachments
 	VkSampler pColorSampler;
-	UniformBuffer mOffscreenUbo;
+	uint32_t mOffscreenUboOffset;// dynamic offset of this frame's ubo in the transient buffer
 	UniformBuffer mCompositionUbo;
 	VkDescriptorSet m_pDeferredSet;// Deferred composition
 	VkDescriptorSet m_pModelSet;
 	VkCommandBuffer m_pOffscreenCmdBuffer;
 	std::vector<VkSemaphore> m_pOffscreenSemaphore;
 	VkPipeline m_pOffscerrnPipeline;
+
+	VulkanMemoryAllocator mMemoryAllocator;
+	VulkanSamplerCache mSamplerCache;// owns every sampler, the ones above included
+	// Per frame in flight scratch memory for ubos and other transient data
+	VkBuffer m_pTransientBuffer;
+	MemoryAllocation mTransientBufferMemory;
+	VulkanFrameAllocator mFrameAllocator;
+	VulkanTransferUploader mTransferUploader;
+	VulkanUploadScheduler mUploadScheduler;
+	uint32_t mUploadSubmitCount;
+	TextureCache mTextureCache;
+	ThreadPool mThreadPool;
+	VulkanTextureStreamer mTextureStreamer;
+	VulkanVirtualTexture mVirtualTexture;
+	bool mVirtualTexturing = false;// the offscreen pass samples mVirtualTexture instead of m_pTextureImageView
+	VulkanTextureArrays mTextureArrays;
+	std::vector<TextureArraySlot> mTextureSlots;// materials the offscreen draws cycle through
+	bool mTextureArraying = false;// the offscreen pass samples mTextureArrays instead of m_pTextureImageView
 };
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(
@@ -0,0 +1,49 @@
+#include "FrameAllocator.h"
+#include <iostream>
+#include <cassert>
+
+void VulkanFrameAllocator::Init(VkBuffer pBuffer, void* pMapped, VkDeviceSize frameSize, uint32_t frameCount)
+{
+	assert(pMapped);
+	m_pBuffer = pBuffer;
+	m_pMapped = static_cast<char*>(pMapped);
+	mFrameSize = frameSize;
+	mFrameCount = frameCount;
+	mFrameIndex = 0;
+	mHead = 0;
+	mPeakUsage = 0;
+}
+
+void VulkanFrameAllocator::BeginFrame(uint32_t frameIndex)
+{
+	assert(frameIndex < mFrameCount);
+	mFrameIndex = frameIndex;
+	mHead = 0;
+}
+
+bool VulkanFrameAllocator::Allocate(VkDeviceSize size, VkDeviceSize alignment, FrameAllocation& allocation)
+{
+	if (alignment == 0)
+	{
+		alignment = 1;
+	}
+	VkDeviceSize frameBase = mFrameSize * mFrameIndex;
+	// align the absolute offset, it is what ends up in descriptors and dynamic offsets
+	VkDeviceSize offset = (frameBase + mHead + alignment - 1) / alignment * alignment;
+	if (offset + size > frameBase + mFrameSize)
+	{
+		std::cerr << "Frame allocator out of memory, frame size: " << mFrameSize << " request: " << size << std::endl;
+		return false;
+	}
+
+	mHead = offset + size - frameBase;
+	if (mHead > mPeakUsage)
+	{
+		mPeakUsage = mHead;
+	}
+
+	allocation.pBuffer = m_pBuffer;
+	allocation.offset = offset;
+	allocation.pData = m_pMapped + offset;
+	return true;
+}
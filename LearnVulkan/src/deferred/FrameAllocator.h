@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct FrameAllocation
+{
+	VkBuffer		pBuffer = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;// offset inside pBuffer, usable as a dynamic offset
+	void*			pData = nullptr;
+};
+
+// Linear (bump) allocator over one persistently mapped host visible buffer that is split
+// into one region per frame in flight. A region is recycled as a whole by BeginFrame once the
+// fence of that frame has signaled, so transient data never has to be freed piece by piece.
+class VulkanFrameAllocator
+{
+public:
+	VulkanFrameAllocator() = default;
+	~VulkanFrameAllocator() = default;
+
+	// pMapped must point at the start of pBuffer, frameSize * frameCount bytes long
+	void Init(VkBuffer pBuffer, void* pMapped, VkDeviceSize frameSize, uint32_t frameCount);
+
+	// Only call once the fence guarding frameIndex has signaled
+	void BeginFrame(uint32_t frameIndex);
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, FrameAllocation& allocation);
+
+	VkBuffer GetBuffer() const { return m_pBuffer; }
+	VkDeviceSize GetFrameSize() const { return mFrameSize; }
+	VkDeviceSize GetPeakUsage() const { return mPeakUsage; }
+
+private:
+	VkBuffer m_pBuffer = VK_NULL_HANDLE;
+	char* m_pMapped = nullptr;
+	VkDeviceSize mFrameSize = 0;
+	uint32_t mFrameCount = 0;
+	uint32_t mFrameIndex = 0;
+	VkDeviceSize mHead = 0;// bytes used in the current frame region
+	VkDeviceSize mPeakUsage = 0;
+};
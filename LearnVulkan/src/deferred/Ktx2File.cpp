@@ -0,0 +1,308 @@
+#include "Ktx2File.h"
+#include <iostream>
+#include <cstring>
+#include "../stb_image.h"
+#include "BlockCompression.h"
+
+namespace
+{
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	const uint32_t KTX2_SUPERCOMPRESSION_NONE = 0;
+	const uint32_t KTX2_SUPERCOMPRESSION_ZLIB = 3;
+
+	// identifier, header, index: 12 + 9 * 4 + 4 * 4 + 2 * 8
+	const uint64_t KTX2_LEVEL_INDEX_OFFSET = 80;
+
+	// Khronos basic data format descriptor block: 24 bytes, then 16 bytes per sample
+	const uint32_t KDF_BASIC_BLOCK_HEADER = 24;
+	const uint32_t KDF_SAMPLE_SIZE = 16;
+
+	uint32_t ReadU32(const unsigned char* p)
+	{
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	uint64_t ReadU64(const unsigned char* p)
+	{
+		return ReadU32(p) | ((uint64_t)ReadU32(p + 4) << 32);
+	}
+
+	// Bytes per texel of the uncompressed color formats, 0 for every other format
+	uint32_t GetTexelBytes(VkFormat format)
+	{
+		struct FormatRange
+		{
+			VkFormat first;
+			VkFormat last;
+			uint32_t bytes;
+		};
+		static const FormatRange ranges[] =
+		{
+			{ VK_FORMAT_R4G4_UNORM_PACK8, VK_FORMAT_R4G4_UNORM_PACK8, 1 },
+			{ VK_FORMAT_R4G4B4A4_UNORM_PACK16, VK_FORMAT_A1R5G5B5_UNORM_PACK16, 2 },
+			{ VK_FORMAT_R8_UNORM, VK_FORMAT_R8_SRGB, 1 },
+			{ VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_SRGB, 2 },
+			{ VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8_SRGB, 3 },
+			{ VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_A2B10G10R10_SINT_PACK32, 4 },
+			{ VK_FORMAT_R16_UNORM, VK_FORMAT_R16_SFLOAT, 2 },
+			{ VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT, 4 },
+			{ VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16_SFLOAT, 6 },
+			{ VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT, 8 },
+			{ VK_FORMAT_R32_UINT, VK_FORMAT_R32_SFLOAT, 4 },
+			{ VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32_SFLOAT, 8 },
+			{ VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32_SFLOAT, 12 },
+			{ VK_FORMAT_R32G32B32A32_UINT, VK_FORMAT_R32G32B32A32_SFLOAT, 16 },
+			{ VK_FORMAT_B10G11R11_UFLOAT_PACK32, VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, 4 },
+		};
+		for (const auto& range : ranges)
+		{
+			if (format >= range.first && format <= range.last)
+			{
+				return range.bytes;
+			}
+		}
+		return 0;
+	}
+}
+
+bool Ktx2File::Open(const char* pPath)
+{
+	Close();
+	mPath = pPath;
+	mFile.open(pPath, std::ios::ate | std::ios::binary);
+	if (!mFile.is_open())
+	{
+		return false;
+	}
+	mFileSize = (uint64_t)mFile.tellg();
+	mFile.seekg(0);
+
+	unsigned char header[KTX2_LEVEL_INDEX_OFFSET];
+	if (mFileSize < sizeof(header) || !mFile.read(reinterpret_cast<char*>(header), sizeof(header))
+		|| memcmp(header, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		std::cerr << "Not a KTX2 file: " << pPath << std::endl;
+		Close();
+		return false;
+	}
+
+	mHeader.format = (VkFormat)ReadU32(header + 12);
+	mHeader.typeSize = ReadU32(header + 16);
+	mHeader.width = ReadU32(header + 20);
+	mHeader.height = ReadU32(header + 24);
+	mHeader.depth = ReadU32(header + 28);
+	mHeader.layerCount = ReadU32(header + 32);
+	mHeader.faceCount = ReadU32(header + 36);
+	mHeader.levelCount = ReadU32(header + 40);
+	mHeader.supercompression = ReadU32(header + 44);
+
+	if (mHeader.format == VK_FORMAT_UNDEFINED || mHeader.width == 0 || mHeader.height == 0 || mHeader.depth > 1
+		|| mHeader.layerCount > 1 || mHeader.faceCount != 1)
+	{
+		std::cerr << "KTX2 " << pPath << ": only single 2D images with a Vulkan format are supported" << std::endl;
+		Close();
+		return false;
+	}
+	if (mHeader.supercompression != KTX2_SUPERCOMPRESSION_NONE && mHeader.supercompression != KTX2_SUPERCOMPRESSION_ZLIB)
+	{
+		std::cerr << "KTX2 " << pPath << ": unsupported supercompression scheme " << mHeader.supercompression << std::endl;
+		Close();
+		return false;
+	}
+
+	uint32_t levelCount = mHeader.levelCount ? mHeader.levelCount : 1;
+	if (levelCount > ComputeMipLevels(mHeader.width, mHeader.height))
+	{
+		std::cerr << "KTX2 " << pPath << ": " << levelCount << " levels, a " << mHeader.width << "x" << mHeader.height
+			<< " chain has " << ComputeMipLevels(mHeader.width, mHeader.height) << std::endl;
+		Close();
+		return false;
+	}
+	std::vector<unsigned char> index((size_t)levelCount * 24);
+	if (!mFile.read(reinterpret_cast<char*>(index.data()), index.size()))
+	{
+		std::cerr << "KTX2 " << pPath << ": truncated level index" << std::endl;
+		Close();
+		return false;
+	}
+	mLevels.resize(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		LevelIndex& level = mLevels[i];
+		level.offset = ReadU64(&index[i * 24]);
+		level.length = ReadU64(&index[i * 24 + 8]);
+		level.uncompressedLength = ReadU64(&index[i * 24 + 16]);
+		if (mHeader.supercompression == KTX2_SUPERCOMPRESSION_NONE)
+		{
+			level.uncompressedLength = level.length;
+		}
+		if (level.length > mFileSize || level.offset > mFileSize - level.length || level.uncompressedLength == 0)
+		{
+			std::cerr << "KTX2 " << pPath << ": level " << i << " is out of the file" << std::endl;
+			Close();
+			return false;
+		}
+	}
+
+	if (!ReadBlockSize())
+	{
+		Close();
+		return false;
+	}
+	uint32_t width = mHeader.width;
+	uint32_t height = mHeader.height;
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		VkDeviceSize required = (VkDeviceSize)((width + mHeader.blockWidth - 1) / mHeader.blockWidth)
+			* ((height + mHeader.blockHeight - 1) / mHeader.blockHeight) * mHeader.blockBytes;
+		if (mLevels[i].uncompressedLength < required)
+		{
+			std::cerr << "KTX2 " << pPath << ": level " << i << " has " << mLevels[i].uncompressedLength << " bytes, "
+				<< width << "x" << height << " needs " << required << std::endl;
+			Close();
+			return false;
+		}
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+bool Ktx2File::ReadBlockSize()
+{
+	// the copies to the image are sized by the format, so that is where the block comes from
+	BlockFormat blockFormat = BlockFormat::BC1;
+	bool srgb = false;
+	if (GetBlockFormat(mHeader.format, blockFormat, srgb))
+	{
+		mHeader.blockWidth = 4;
+		mHeader.blockHeight = 4;
+		mHeader.blockBytes = GetBlockBytes(blockFormat);
+	}
+	else
+	{
+		mHeader.blockWidth = 1;
+		mHeader.blockHeight = 1;
+		mHeader.blockBytes = GetTexelBytes(mHeader.format);
+		if (mHeader.blockBytes == 0)
+		{
+			std::cerr << "KTX2 " << mPath << ": unsupported format " << mHeader.format << std::endl;
+			return false;
+		}
+	}
+
+	unsigned char header[8];
+	mFile.seekg(48);
+	if (!mFile.read(reinterpret_cast<char*>(header), sizeof(header)))
+	{
+		return false;
+	}
+	uint32_t dfdOffset = ReadU32(header);
+	uint32_t dfdLength = ReadU32(header + 4);
+	// total size, then the basic block with at least one sample
+	if (dfdLength < 4 + KDF_BASIC_BLOCK_HEADER + KDF_SAMPLE_SIZE || (uint64_t)dfdOffset + dfdLength > mFileSize)
+	{
+		std::cerr << "KTX2 " << mPath << ": missing data format descriptor" << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> dfd(dfdLength);
+	mFile.seekg(dfdOffset);
+	if (!mFile.read(reinterpret_cast<char*>(dfd.data()), dfd.size()))
+	{
+		std::cerr << "KTX2 " << mPath << ": truncated data format descriptor" << std::endl;
+		return false;
+	}
+
+	const unsigned char* pBlock = dfd.data() + 4;
+	uint32_t blockSize = ReadU32(pBlock + 4) >> 16;
+	if (blockSize < KDF_BASIC_BLOCK_HEADER + KDF_SAMPLE_SIZE || 4 + blockSize > dfdLength)
+	{
+		std::cerr << "KTX2 " << mPath << ": malformed data format descriptor" << std::endl;
+		return false;
+	}
+	uint32_t blockBytes = pBlock[16];
+	if (blockBytes == 0)
+	{
+		// bytesPlane0 may be cleared in supercompressed files, the samples still span the whole block
+		uint32_t bits = 0;
+		for (uint32_t offset = KDF_BASIC_BLOCK_HEADER; offset + KDF_SAMPLE_SIZE <= blockSize; offset += KDF_SAMPLE_SIZE)
+		{
+			uint32_t sample = ReadU32(pBlock + offset);
+			uint32_t end = (sample & 0xFFFF) + ((sample >> 16) & 0xFF) + 1;
+			bits = end > bits ? end : bits;
+		}
+		blockBytes = (bits + 7) / 8;
+	}
+	if (pBlock[12] + 1u != mHeader.blockWidth || pBlock[13] + 1u != mHeader.blockHeight || blockBytes != mHeader.blockBytes)
+	{
+		std::cerr << "KTX2 " << mPath << ": data format descriptor has " << pBlock[12] + 1u << "x" << pBlock[13] + 1u << " blocks of "
+			<< blockBytes << " bytes, format " << mHeader.format << " has " << mHeader.blockWidth << "x" << mHeader.blockHeight
+			<< " blocks of " << mHeader.blockBytes << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Ktx2File::Close()
+{
+	if (mFile.is_open())
+	{
+		mFile.close();
+	}
+	mFile.clear();
+	mLevels.clear();
+	mHeader = Ktx2Header();
+	mFileSize = 0;
+}
+
+VkDeviceSize Ktx2File::ComputeLevelLayout(std::vector<MipLevelLayout>& levels) const
+{
+	levels.resize(mLevels.size());
+	VkDeviceSize offset = 0;
+	uint32_t width = mHeader.width;
+	uint32_t height = mHeader.height;
+	for (size_t i = 0; i < mLevels.size(); i++)
+	{
+		offset = (offset + 15) & ~(VkDeviceSize)15;
+		levels[i].offset = offset;
+		levels[i].width = width;
+		levels[i].height = height;
+		offset += mLevels[i].uncompressedLength;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return offset;
+}
+
+bool Ktx2File::ReadLevel(uint32_t level, void* pDst)
+{
+	const LevelIndex& index = mLevels[level];
+	mFile.seekg((std::streamoff)index.offset);
+	if (mHeader.supercompression == KTX2_SUPERCOMPRESSION_NONE)
+	{
+		if (!mFile.read(static_cast<char*>(pDst), (std::streamsize)index.length))
+		{
+			std::cerr << "KTX2 " << mPath << ": failed to read level " << level << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	mCompressed.resize((size_t)index.length);
+	if (!mFile.read(mCompressed.data(), (std::streamsize)index.length))
+	{
+		std::cerr << "KTX2 " << mPath << ": failed to read level " << level << std::endl;
+		return false;
+	}
+	// inflate copies matches out of the bytes it already wrote, so it works in cached memory and pDst is only written
+	std::vector<char> inflated((size_t)index.uncompressedLength);
+	int size = stbi_zlib_decode_buffer(inflated.data(), (int)inflated.size(), mCompressed.data(), (int)mCompressed.size());
+	if (size != (int)index.uncompressedLength)
+	{
+		std::cerr << "KTX2 " << mPath << ": level " << level << " failed to inflate" << std::endl;
+		return false;
+	}
+	memcpy(pDst, inflated.data(), inflated.size());
+	return true;
+}
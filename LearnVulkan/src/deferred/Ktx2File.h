@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <fstream>
+#include <string>
+#include "MipChain.h"
+
+struct Ktx2Header
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t typeSize = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t depth = 0;
+	uint32_t layerCount = 0;
+	uint32_t faceCount = 0;
+	uint32_t levelCount = 0;// 0: the file only has level 0 and asks for mips to be generated
+	uint32_t supercompression = 0;
+	// texel block of the format: 4x4 for BC, 1x1 and the texel size for uncompressed formats
+	uint32_t blockWidth = 1;
+	uint32_t blockHeight = 1;
+	uint32_t blockBytes = 0;
+};
+
+// Reader for KTX2 containers holding one 2D image with its pre-baked mip chain. Only the header and the
+// level index are read by Open(), every level is streamed from disk into the caller's memory by ReadLevel().
+// Supercompression: none and zlib (inflated with stb_image). BasisLZ and Zstandard are rejected.
+// Formats: the BC formats of BlockCompression.h and uncompressed color formats, with a data format
+// descriptor that agrees on the block size. A level shorter than its extent needs in the format's
+// texel blocks is rejected too, so every level can be copied to the image as is.
+class Ktx2File
+{
+public:
+	Ktx2File() = default;
+	~Ktx2File() = default;
+
+	bool Open(const char* pPath);
+	void Close();
+
+	const Ktx2Header& GetHeader() const { return mHeader; }
+	uint32_t GetLevelCount() const { return (uint32_t)mLevels.size(); }
+	VkDeviceSize GetLevelSize(uint32_t level) const { return mLevels[level].uncompressedLength; }
+
+	// Places every level at a 16 byte aligned offset (enough for any block or texel size up to 16 bytes),
+	// returns the total size
+	VkDeviceSize ComputeLevelLayout(std::vector<MipLevelLayout>& levels) const;
+
+	// Writes GetLevelSize(level) bytes to pDst. Uncompressed levels are read straight into pDst,
+	// so pDst can be mapped staging memory.
+	bool ReadLevel(uint32_t level, void* pDst);
+
+private:
+	bool ReadBlockSize();
+
+	struct LevelIndex
+	{
+		uint64_t offset;
+		uint64_t length;
+		uint64_t uncompressedLength;
+	};
+
+	std::ifstream mFile;
+	std::string mPath;
+	uint64_t mFileSize = 0;
+	Ktx2Header mHeader;
+	std::vector<LevelIndex> mLevels;
+	std::vector<char> mCompressed;// scratch for supercompressed levels
+};
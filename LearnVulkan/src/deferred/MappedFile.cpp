@@ -0,0 +1,171 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <algorithm>
+#include <utility>
+
+bool MappedFile::Open(const char* pPath)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(pPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	m_pFile = file;
+	mSize = (size_t)size.QuadPart;
+	mOpen = true;
+	if (mSize == 0)
+	{
+		// empty files can't be mapped
+		return true;
+	}
+	m_pMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_pMapping)
+	{
+		m_pData = static_cast<const unsigned char*>(MapViewOfFile(m_pMapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	mMapped = m_pData != nullptr;
+	if (!mMapped && ReadAll(file))
+	{
+		m_pData = mBuffer.data();
+	}
+#else
+	int fd = open(pPath, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	mSize = (size_t)info.st_size;
+	mOpen = true;
+	if (mSize > 0)
+	{
+		void* pData = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (pData != MAP_FAILED)
+		{
+			// read ahead aggressively and drop pages behind, files are decoded front to back
+			madvise(pData, mSize, MADV_SEQUENTIAL);
+			m_pData = static_cast<const unsigned char*>(pData);
+			mMapped = true;
+		}
+		else if (ReadAll(fd))
+		{
+			m_pData = mBuffer.data();
+		}
+	}
+	// the mapping keeps the file referenced
+	close(fd);
+#endif
+	if (mSize > 0 && !m_pData)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+#ifdef _WIN32
+bool MappedFile::ReadAll(void* pFile)
+{
+	mBuffer.resize(mSize);
+	size_t done = 0;
+	while (done < mSize)
+	{
+		DWORD chunk = (DWORD)std::min<size_t>(mSize - done, 1u << 30);
+		DWORD read = 0;
+		if (!::ReadFile(pFile, mBuffer.data() + done, chunk, &read, nullptr) || read == 0)
+		{
+			return false;
+		}
+		done += read;
+	}
+	return true;
+}
+#else
+bool MappedFile::ReadAll(int fd)
+{
+	mBuffer.resize(mSize);
+	size_t done = 0;
+	while (done < mSize)
+	{
+		ssize_t read = pread(fd, mBuffer.data() + done, mSize - done, (off_t)done);
+		if (read < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (read <= 0)
+		{
+			return false;
+		}
+		done += (size_t)read;
+	}
+	return true;
+}
+#endif
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (mMapped)
+	{
+		UnmapViewOfFile(m_pData);
+	}
+	if (m_pMapping)
+	{
+		CloseHandle(m_pMapping);
+	}
+	if (m_pFile)
+	{
+		CloseHandle(m_pFile);
+	}
+	m_pMapping = nullptr;
+	m_pFile = nullptr;
+#else
+	if (mMapped)
+	{
+		munmap(const_cast<unsigned char*>(m_pData), mSize);
+	}
+#endif
+	m_pData = nullptr;
+	mSize = 0;
+	mOpen = false;
+	mMapped = false;
+	mBuffer.clear();
+	mBuffer.shrink_to_fit();
+}
+
+void MappedFile::Swap(MappedFile& other)
+{
+	std::swap(m_pData, other.m_pData);
+	std::swap(mSize, other.mSize);
+	std::swap(mOpen, other.mOpen);
+	std::swap(mMapped, other.mMapped);
+	mBuffer.swap(other.mBuffer);
+#ifdef _WIN32
+	std::swap(m_pFile, other.m_pFile);
+	std::swap(m_pMapping, other.m_pMapping);
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Read only memory mapping of a whole file (CreateFileMapping on Windows, mmap elsewhere).
+// The pages are faulted in by the first access, so opening costs no read, and they are the page cache's own,
+// shared with every other process reading the file. Both sides are hinted for sequential access. Where the
+// file can't be mapped it is read into a buffer of its own instead, GetData() works the same either way.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept { Swap(other); }
+	MappedFile& operator=(MappedFile&& other) noexcept { Close(); Swap(other); return *this; }
+
+	bool Open(const char* pPath);
+	void Close();
+
+	bool IsOpen() const { return mOpen; }
+	bool IsMapped() const { return mMapped; }
+	const unsigned char* GetData() const { return m_pData; }
+	size_t GetSize() const { return mSize; }
+
+private:
+	void Swap(MappedFile& other);
+#ifdef _WIN32
+	bool ReadAll(void* pFile);
+#else
+	bool ReadAll(int fd);
+#endif
+
+private:
+	const unsigned char* m_pData = nullptr;
+	size_t mSize = 0;
+	bool mOpen = false;
+	bool mMapped = false;
+	std::vector<unsigned char> mBuffer;// the read fallback
+#ifdef _WIN32
+	void* m_pFile = nullptr;// HANDLE
+	void* m_pMapping = nullptr;// HANDLE
+#endif
+};
@@ -0,0 +1,416 @@
+#include "MemoryAllocator.h"
+#include <iostream>
+#include <iterator>
+#include <cassert>
+
+static VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Whether the last byte of one resource and the first byte of the next fall on the same granularity page
+static bool OnSamePage(VkDeviceSize endOfA, VkDeviceSize startOfB, VkDeviceSize pageSize)
+{
+	return (endOfA & ~(pageSize - 1)) == (startOfB & ~(pageSize - 1));
+}
+
+void VulkanMemoryAllocator::Init(VkPhysicalDevice pPhysicalDevice, VkDevice pDevice, VkDeviceSize blockSize)
+{
+	m_pDevice = pDevice;
+	mBlockSize = blockSize;
+	vkGetPhysicalDeviceMemoryProperties(pPhysicalDevice, &mMemoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(pPhysicalDevice, &properties);
+	mBufferImageGranularity = properties.limits.bufferImageGranularity > 0 ? properties.limits.bufferImageGranularity : 1;
+	mMaxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+	mBlocks.resize(mMemoryProperties.memoryTypeCount);
+
+	// Discrete cards without resizable BAR only expose a 256MB host visible window into vram,
+	// that is too small to place whole resources in, so only larger heaps enable the direct path
+	const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++)
+	{
+		const VkMemoryType& memoryType = mMemoryProperties.memoryTypes[i];
+		if ((memoryType.propertyFlags & directFlags) == directFlags)
+		{
+			if (properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
+				|| mMemoryProperties.memoryHeaps[memoryType.heapIndex].size > 256ull * 1024 * 1024)
+			{
+				mHostVisibleDeviceMemory = true;
+			}
+		}
+	}
+}
+
+void VulkanMemoryAllocator::Destroy()
+{
+	for (auto& blocks : mBlocks)
+	{
+		for (auto& block : blocks)
+		{
+			if (block->pMapped)
+			{
+				vkUnmapMemory(m_pDevice, block->pMemory);
+			}
+			vkFreeMemory(m_pDevice, block->pMemory, nullptr);
+		}
+		blocks.clear();
+	}
+}
+
+bool VulkanMemoryAllocator::Allocate(const VkMemoryRequirements& requirements, uint32_t memoryType, AllocationType type, MemoryAllocation& allocation)
+{
+	assert(memoryType < mBlocks.size());
+
+	// Big resources (full screen attachments, large textures) get a block of their own
+	if (requirements.size > mBlockSize / 2)
+	{
+		MemoryBlock* pBlock = CreateBlock(memoryType, requirements.size, true);
+		return pBlock && AllocateFromBlock(pBlock, requirements, type, allocation);
+	}
+
+	for (auto& block : mBlocks[memoryType])
+	{
+		if (!block->dedicated && AllocateFromBlock(block.get(), requirements, type, allocation))
+		{
+			return true;
+		}
+	}
+
+	MemoryBlock* pBlock = CreateBlock(memoryType, mBlockSize, false);
+	return pBlock && AllocateFromBlock(pBlock, requirements, type, allocation);
+}
+
+void VulkanMemoryAllocator::Free(MemoryAllocation& allocation)
+{
+	MemoryBlock* pBlock = allocation.pBlock;
+	if (!pBlock)
+	{
+		return;
+	}
+
+	// the chunk starts at or before the allocation offset (alignment padding lives in front of it)
+	auto it = std::prev(pBlock->chunks.upper_bound(allocation.offset));
+	assert(it->second.type != AllocationType::Free);
+
+	pBlock->allocationCount--;
+	pBlock->usedBytes -= it->second.size - it->second.padding;
+	pBlock->wastedBytes -= it->second.padding;
+
+	VkDeviceSize offset = it->first;
+	VkDeviceSize size = it->second.size;
+
+	// merge with the free neighbours
+	auto next = std::next(it);
+	if (next != pBlock->chunks.end() && next->second.type == AllocationType::Free)
+	{
+		EraseFreeChunk(pBlock, next->first, next->second.size);
+		size += next->second.size;
+		pBlock->chunks.erase(next);
+	}
+	if (it != pBlock->chunks.begin())
+	{
+		auto prev = std::prev(it);
+		if (prev->second.type == AllocationType::Free)
+		{
+			EraseFreeChunk(pBlock, prev->first, prev->second.size);
+			offset = prev->first;
+			size += prev->second.size;
+			pBlock->chunks.erase(prev);
+		}
+	}
+	pBlock->chunks.erase(it);
+	InsertFreeChunk(pBlock, offset, size);
+
+	allocation = MemoryAllocation();
+
+	if (pBlock->allocationCount == 0)
+	{
+		// keep one empty block per memory type around so a free/alloc pair does not hit the driver
+		bool hasOtherEmptyBlock = false;
+		for (auto& block : mBlocks[pBlock->memoryType])
+		{
+			if (block.get() != pBlock && !block->dedicated && block->allocationCount == 0)
+			{
+				hasOtherEmptyBlock = true;
+				break;
+			}
+		}
+		if (pBlock->dedicated || hasOtherEmptyBlock)
+		{
+			DestroyBlock(pBlock);
+		}
+	}
+}
+
+MemoryTypePolicy VulkanMemoryAllocator::GetPolicy(MemoryUsage usage) const
+{
+	MemoryTypePolicy policy;
+	switch (usage)
+	{
+	case MemoryUsage::GpuOnly:
+		policy.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		policy.avoidedFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		break;
+	case MemoryUsage::Upload:
+		policy.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		if (mHostVisibleDeviceMemory)
+		{
+			policy.preferredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+			policy.avoidedFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		}
+		else
+		{
+			policy.avoidedFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		}
+		break;
+	case MemoryUsage::CpuToGpu:
+		policy.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		policy.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		policy.avoidedFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		break;
+	case MemoryUsage::Staging:
+		policy.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		policy.avoidedFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		break;
+	case MemoryUsage::Readback:
+		// uncached reads from the cpu are very slow
+		policy.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		policy.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		break;
+	}
+	return policy;
+}
+
+bool VulkanMemoryAllocator::FindMemoryType(uint32_t filter, const MemoryTypePolicy& policy, uint32_t& memoryType) const
+{
+	int bestScore = -1;
+	for (uint32_t i = 0; i < mMemoryProperties.memoryTypeCount; i++)
+	{
+		VkMemoryPropertyFlags flags = mMemoryProperties.memoryTypes[i].propertyFlags;
+		if (!(filter & (1 << i)) || (flags & policy.requiredFlags) != policy.requiredFlags)
+		{
+			continue;
+		}
+
+		// every preferred bit present counts one, every avoided bit present costs one
+		int score = 32;
+		for (uint32_t bit = 0; bit < 32; bit++)
+		{
+			VkMemoryPropertyFlags mask = 1u << bit;
+			if (flags & mask & policy.preferredFlags)
+			{
+				score++;
+			}
+			if (flags & mask & policy.avoidedFlags)
+			{
+				score--;
+			}
+		}
+		if (score > bestScore)
+		{
+			bestScore = score;
+			memoryType = i;
+		}
+	}
+	return bestScore >= 0;
+}
+
+bool VulkanMemoryAllocator::IsHostVisible(uint32_t memoryType) const
+{
+	return (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+MemoryAllocatorStats VulkanMemoryAllocator::GetStats() const
+{
+	MemoryAllocatorStats stats;
+	stats.deviceAllocationCount = mDeviceAllocationCount;
+	for (const auto& blocks : mBlocks)
+	{
+		for (const auto& block : blocks)
+		{
+			stats.blockCount++;
+			if (block->dedicated)
+			{
+				stats.dedicatedBlockCount++;
+			}
+			stats.allocationCount += block->allocationCount;
+			stats.blockBytes += block->size;
+			stats.usedBytes += block->usedBytes;
+			stats.wastedBytes += block->wastedBytes;
+		}
+	}
+	stats.freeBytes = stats.blockBytes - stats.usedBytes - stats.wastedBytes;
+	return stats;
+}
+
+void VulkanMemoryAllocator::PrintStats() const
+{
+	MemoryAllocatorStats stats = GetStats();
+	std::cout << "Device memory: " << stats.blockCount << " blocks (" << stats.dedicatedBlockCount << " dedicated), "
+		<< stats.allocationCount << " allocations, " << stats.deviceAllocationCount << " live device allocations (limit " << mMaxAllocationCount << ")" << std::endl;
+	std::cout << "\t block bytes: " << stats.blockBytes << " used: " << stats.usedBytes
+		<< " wasted: " << stats.wastedBytes << " free: " << stats.freeBytes << std::endl;
+	for (uint32_t i = 0; i < (uint32_t)mBlocks.size(); i++)
+	{
+		for (const auto& block : mBlocks[i])
+		{
+			std::cout << "\t memory type " << i << (block->dedicated ? " dedicated" : "") << " block: " << block->size
+				<< " bytes, " << block->allocationCount << " allocations, " << block->freeChunks.size() << " free ranges" << std::endl;
+		}
+	}
+}
+
+MemoryBlock* VulkanMemoryAllocator::CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated)
+{
+	if (mMaxAllocationCount > 0 && mDeviceAllocationCount >= mMaxAllocationCount)
+	{
+		std::cerr << "maxMemoryAllocationCount reached" << std::endl;
+		return nullptr;
+	}
+
+	VkMemoryAllocateInfo allocateInfo = {};
+	allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocateInfo.allocationSize = size;
+	allocateInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory pMemory = VK_NULL_HANDLE;
+	if (vkAllocateMemory(m_pDevice, &allocateInfo, nullptr, &pMemory) != VK_SUCCESS)
+	{
+		std::cerr << "vkAllocateMemory failed, size: " << size << std::endl;
+		return nullptr;
+	}
+	mDeviceAllocationCount++;
+
+	auto block = std::make_unique<MemoryBlock>();
+	block->pMemory = pMemory;
+	block->size = size;
+	block->memoryType = memoryType;
+	block->dedicated = dedicated;
+	// host visible blocks stay mapped for their whole life, a memory object can only be mapped once
+	if (mMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		if (vkMapMemory(m_pDevice, pMemory, 0, VK_WHOLE_SIZE, 0, &block->pMapped) != VK_SUCCESS)
+		{
+			std::cerr << "vkMapMemory failed" << std::endl;
+			block->pMapped = nullptr;
+		}
+	}
+	InsertFreeChunk(block.get(), 0, size);
+
+	MemoryBlock* pBlock = block.get();
+	mBlocks[memoryType].emplace_back(std::move(block));
+	return pBlock;
+}
+
+void VulkanMemoryAllocator::DestroyBlock(MemoryBlock* pBlock)
+{
+	auto& blocks = mBlocks[pBlock->memoryType];
+	for (auto it = blocks.begin(); it != blocks.end(); ++it)
+	{
+		if (it->get() == pBlock)
+		{
+			if (pBlock->pMapped)
+			{
+				vkUnmapMemory(m_pDevice, pBlock->pMemory);
+			}
+			vkFreeMemory(m_pDevice, pBlock->pMemory, nullptr);
+			mDeviceAllocationCount--;
+			blocks.erase(it);
+			return;
+		}
+	}
+}
+
+bool VulkanMemoryAllocator::AllocateFromBlock(MemoryBlock* pBlock, const VkMemoryRequirements& requirements, AllocationType type, MemoryAllocation& allocation)
+{
+	const VkDeviceSize alignment = requirements.alignment > 0 ? requirements.alignment : 1;
+	const VkDeviceSize granularity = mBufferImageGranularity;
+
+	// best fit: smallest free range that still holds the request after alignment
+	for (auto it = pBlock->freeChunks.lower_bound(requirements.size); it != pBlock->freeChunks.end(); ++it)
+	{
+		VkDeviceSize chunkSize = it->first;
+		VkDeviceSize chunkOffset = it->second;
+		auto chunk = pBlock->chunks.find(chunkOffset);
+
+		VkDeviceSize offset = AlignUp(chunkOffset, alignment);
+		if (granularity > 1 && chunk != pBlock->chunks.begin())
+		{
+			auto prev = std::prev(chunk);
+			VkDeviceSize prevEnd = prev->first + prev->second.size;
+			if (IsGranularityConflict(prev->second.type, type) && OnSamePage(prevEnd - 1, offset, granularity))
+			{
+				offset = AlignUp(offset, granularity);
+			}
+		}
+		if (offset + requirements.size > chunkOffset + chunkSize)
+		{
+			continue;
+		}
+		if (granularity > 1)
+		{
+			auto next = std::next(chunk);
+			if (next != pBlock->chunks.end() && IsGranularityConflict(next->second.type, type)
+				&& OnSamePage(offset + requirements.size - 1, next->first, granularity))
+			{
+				continue;
+			}
+		}
+
+		VkDeviceSize padding = offset - chunkOffset;
+		VkDeviceSize tail = chunkOffset + chunkSize - (offset + requirements.size);
+
+		pBlock->freeChunks.erase(it);
+		chunk->second.size = padding + requirements.size;
+		chunk->second.padding = padding;
+		chunk->second.type = type;
+		if (tail > 0)
+		{
+			InsertFreeChunk(pBlock, offset + requirements.size, tail);
+		}
+
+		pBlock->allocationCount++;
+		pBlock->usedBytes += requirements.size;
+		pBlock->wastedBytes += padding;
+
+		allocation.pMemory = pBlock->pMemory;
+		allocation.offset = offset;
+		allocation.size = requirements.size;
+		allocation.pMapped = pBlock->pMapped ? static_cast<char*>(pBlock->pMapped) + offset : nullptr;
+		allocation.memoryType = pBlock->memoryType;
+		allocation.pBlock = pBlock;
+		return true;
+	}
+	return false;
+}
+
+bool VulkanMemoryAllocator::IsGranularityConflict(AllocationType a, AllocationType b) const
+{
+	if (a == AllocationType::Free || b == AllocationType::Free)
+	{
+		return false;
+	}
+	return (a == AllocationType::ImageOptimal) != (b == AllocationType::ImageOptimal);
+}
+
+void VulkanMemoryAllocator::InsertFreeChunk(MemoryBlock* pBlock, VkDeviceSize offset, VkDeviceSize size)
+{
+	pBlock->chunks[offset] = { size, 0, AllocationType::Free };
+	pBlock->freeChunks.emplace(size, offset);
+}
+
+void VulkanMemoryAllocator::EraseFreeChunk(MemoryBlock* pBlock, VkDeviceSize offset, VkDeviceSize size)
+{
+	auto range = pBlock->freeChunks.equal_range(size);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == offset)
+		{
+			pBlock->freeChunks.erase(it);
+			return;
+		}
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <map>
+#include <memory>
+
+// What kind of resource is bound to an allocation. Linear (buffers, linear images)
+// and optimal-tiling images must not share a bufferImageGranularity page.
+enum class AllocationType : uint32_t
+{
+	Free = 0,
+	Buffer,
+	ImageLinear,
+	ImageOptimal
+};
+
+// How a resource is accessed, mapped to memory property flags by VulkanMemoryAllocator::GetPolicy
+enum class MemoryUsage : uint32_t
+{
+	GpuOnly = 0,// render targets, resources that are only written by the gpu
+	Upload,// written once by the cpu, read by the gpu; device local, host visible when that is cheap
+	CpuToGpu,// rewritten by the cpu every frame
+	Staging,// transfer source
+	Readback// written by the gpu, read by the cpu
+};
+
+struct MemoryTypePolicy
+{
+	VkMemoryPropertyFlags requiredFlags = 0;
+	VkMemoryPropertyFlags preferredFlags = 0;
+	VkMemoryPropertyFlags avoidedFlags = 0;
+};
+
+struct MemoryBlock;
+
+struct MemoryAllocation
+{
+	VkDeviceMemory	pMemory = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;
+	VkDeviceSize	size = 0;
+	void*			pMapped = nullptr;// nullptr unless the memory type is host visible
+	uint32_t		memoryType = 0;
+	MemoryBlock*	pBlock = nullptr;
+};
+
+struct MemoryAllocatorStats
+{
+	uint32_t blockCount = 0;
+	uint32_t dedicatedBlockCount = 0;
+	uint32_t allocationCount = 0;
+	uint32_t deviceAllocationCount = 0;// live device allocations, what maxMemoryAllocationCount limits
+	VkDeviceSize blockBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize wastedBytes = 0;// alignment and granularity padding
+	VkDeviceSize freeBytes = 0;
+};
+
+struct MemoryBlock
+{
+	struct Chunk
+	{
+		VkDeviceSize size;
+		VkDeviceSize padding;// bytes skipped in front of the allocation
+		AllocationType type;
+	};
+
+	VkDeviceMemory pMemory = VK_NULL_HANDLE;
+	VkDeviceSize size = 0;
+	void* pMapped = nullptr;
+	uint32_t memoryType = 0;
+	bool dedicated = false;
+	uint32_t allocationCount = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize wastedBytes = 0;
+
+	// every chunk (used and free) keyed by offset, so neighbours are one step away
+	std::map<VkDeviceSize, Chunk> chunks;
+	// free chunks by size for best fit
+	std::multimap<VkDeviceSize, VkDeviceSize> freeChunks;
+};
+
+// Sub-allocates buffers and images out of large per-memory-type VkDeviceMemory blocks,
+// so a resource costs a free-list lookup instead of a vkAllocateMemory call.
+class VulkanMemoryAllocator
+{
+public:
+	VulkanMemoryAllocator() = default;
+	~VulkanMemoryAllocator() = default;
+
+	void Init(VkPhysicalDevice pPhysicalDevice, VkDevice pDevice, VkDeviceSize blockSize = 64ull * 1024 * 1024);
+	void Destroy();
+
+	bool Allocate(const VkMemoryRequirements& requirements, uint32_t memoryType, AllocationType type, MemoryAllocation& allocation);
+	void Free(MemoryAllocation& allocation);
+
+	MemoryTypePolicy GetPolicy(MemoryUsage usage) const;
+	bool FindMemoryType(uint32_t filter, const MemoryTypePolicy& policy, uint32_t& memoryType) const;
+	bool IsHostVisible(uint32_t memoryType) const;
+	// A device local + host visible heap big enough to put whole resources in (ReBAR, UMA, CPU devices)
+	bool HasHostVisibleDeviceMemory() const { return mHostVisibleDeviceMemory; }
+
+	MemoryAllocatorStats GetStats() const;
+	void PrintStats() const;
+
+private:
+	MemoryBlock* CreateBlock(uint32_t memoryType, VkDeviceSize size, bool dedicated);
+	void DestroyBlock(MemoryBlock* pBlock);
+	bool AllocateFromBlock(MemoryBlock* pBlock, const VkMemoryRequirements& requirements, AllocationType type, MemoryAllocation& allocation);
+	bool IsGranularityConflict(AllocationType a, AllocationType b) const;
+	void InsertFreeChunk(MemoryBlock* pBlock, VkDeviceSize offset, VkDeviceSize size);
+	void EraseFreeChunk(MemoryBlock* pBlock, VkDeviceSize offset, VkDeviceSize size);
+
+private:
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties mMemoryProperties = {};
+	VkDeviceSize mBlockSize = 0;
+	VkDeviceSize mBufferImageGranularity = 1;
+	uint32_t mMaxAllocationCount = 0;
+	uint32_t mDeviceAllocationCount = 0;
+	bool mHostVisibleDeviceMemory = false;
+	std::vector<std::vector<std::unique_ptr<MemoryBlock>>> mBlocks;// per memory type
+};
@@ -0,0 +1,457 @@
+#include "MipChain.h"
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <functional>
+#include <chrono>
+#include <iostream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_CHAIN_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define MIP_CHAIN_SSE 1
+#endif
+
+namespace
+{
+	// Source taps of one destination texel along one axis, edges already clamped
+	struct FilterTap
+	{
+		uint32_t first;
+		uint32_t count;
+		uint32_t weightOffset;
+	};
+
+	struct FilterTable
+	{
+		std::vector<FilterTap> taps;
+		std::vector<float> weights;
+	};
+
+	const float PI = 3.14159265358979f;
+
+	float Sinc(float x)
+	{
+		if (std::fabs(x) < 1e-5f)
+		{
+			return 1.f;
+		}
+		return std::sin(PI * x) / (PI * x);
+	}
+
+	float BesselI0(float x)
+	{
+		// power series, converges quickly for the small arguments a kaiser window needs
+		float sum = 1.f;
+		float term = 1.f;
+		float halfX = x * 0.5f;
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (halfX / k) * (halfX / k);
+			sum += term;
+			if (term < sum * 1e-7f)
+			{
+				break;
+			}
+		}
+		return sum;
+	}
+
+	float FilterRadius(MipFilter filter)
+	{
+		switch (filter)
+		{
+		case MipFilter::Box: return 0.5f;
+		case MipFilter::Kaiser: return 3.f;
+		case MipFilter::Lanczos3: return 3.f;
+		}
+		return 0.5f;
+	}
+
+	// x is in destination texels
+	float FilterWeight(MipFilter filter, float x)
+	{
+		switch (filter)
+		{
+		case MipFilter::Box:
+			return (x >= -0.5f && x < 0.5f) ? 1.f : 0.f;
+		case MipFilter::Kaiser:
+		{
+			const float width = 3.f;
+			const float alpha = 4.f;
+			float t = x / width;
+			if (t * t >= 1.f)
+			{
+				return 0.f;
+			}
+			return Sinc(x) * BesselI0(alpha * std::sqrt(1.f - t * t)) / BesselI0(alpha);
+		}
+		case MipFilter::Lanczos3:
+			return std::fabs(x) < 3.f ? Sinc(x) * Sinc(x / 3.f) : 0.f;
+		}
+		return 0.f;
+	}
+
+	void BuildFilterTable(MipFilter filter, uint32_t srcSize, uint32_t dstSize, FilterTable& table)
+	{
+		table.taps.resize(dstSize);
+		table.weights.clear();
+
+		float scale = (float)srcSize / dstSize;
+		float support = FilterRadius(filter) * scale;
+		std::vector<float> clamped;
+		for (uint32_t i = 0; i < dstSize; i++)
+		{
+			float center = (i + 0.5f) * scale;
+			int32_t first = (int32_t)std::floor(center - support);
+			int32_t last = (int32_t)std::ceil(center + support);
+			int32_t clampedFirst = first < 0 ? 0 : first;
+			int32_t clampedLast = last > (int32_t)srcSize - 1 ? (int32_t)srcSize - 1 : last;
+
+			// taps past the edge repeat the edge texel, so their weight lands on it
+			clamped.assign(clampedLast - clampedFirst + 1, 0.f);
+			float sum = 0.f;
+			for (int32_t s = first; s <= last; s++)
+			{
+				float w = FilterWeight(filter, (s + 0.5f - center) / scale);
+				int32_t index = s < 0 ? 0 : (s > (int32_t)srcSize - 1 ? (int32_t)srcSize - 1 : s);
+				clamped[index - clampedFirst] += w;
+				sum += w;
+			}
+
+			// drop zero weights at both ends
+			uint32_t begin = 0;
+			uint32_t end = (uint32_t)clamped.size();
+			while (begin + 1 < end && clamped[begin] == 0.f)
+			{
+				begin++;
+			}
+			while (end - 1 > begin && clamped[end - 1] == 0.f)
+			{
+				end--;
+			}
+
+			FilterTap& tap = table.taps[i];
+			tap.first = clampedFirst + begin;
+			tap.count = end - begin;
+			tap.weightOffset = (uint32_t)table.weights.size();
+			for (uint32_t k = begin; k < end; k++)
+			{
+				table.weights.push_back(sum != 0.f ? clamped[k] / sum : 1.f / (end - begin));
+			}
+		}
+	}
+
+	const float* GetSrgbToLinearTable()
+	{
+		static const std::vector<float> table = []()
+		{
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.f;
+				values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	// indexed by linear * 65535, fine enough that the darkest sRGB steps still round correctly
+	const unsigned char* GetLinearToSrgbTable()
+	{
+		static const std::vector<unsigned char> table = []()
+		{
+			std::vector<unsigned char> values(65536);
+			for (int i = 0; i < 65536; i++)
+			{
+				float c = i / 65535.f;
+				float s = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+				values[i] = (unsigned char)(s * 255.f + 0.5f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	// Runs task(begin, end) over [0, count) on up to threadCount threads, the calling thread takes the last slice
+	void ParallelFor(uint32_t count, uint32_t threadCount, const std::function<void(uint32_t, uint32_t)>& task)
+	{
+		const uint32_t minRowsPerThread = 8;
+		uint32_t threads = threadCount;
+		if (threads > count / minRowsPerThread)
+		{
+			threads = count / minRowsPerThread;
+		}
+		if (threads <= 1)
+		{
+			task(0, count);
+			return;
+		}
+
+		// rounding the slice up can leave the last threads nothing, e.g. 125 rows on 15 threads is 14 slices of 9
+		uint32_t slice = (count + threads - 1) / threads;
+		threads = (count + slice - 1) / slice;
+		std::vector<std::thread> workers;
+		workers.reserve(threads - 1);
+		for (uint32_t t = 0; t + 1 < threads; t++)
+		{
+			workers.emplace_back(task, t * slice, (t + 1) * slice);
+		}
+		task((threads - 1) * slice, count);
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// RGBA8 row -> linear float4 row, premultiplied when asked
+	void LoadRow(const unsigned char* pSrc, uint32_t width, const MipBuildOptions& options, float* pDst)
+	{
+		const float* pToLinear = GetSrgbToLinearTable();
+		const float inv255 = 1.f / 255.f;
+		for (uint32_t x = 0; x < width; x++)
+		{
+			const unsigned char* p = pSrc + x * 4;
+			float a = p[3] * inv255;
+			float r = options.srgb ? pToLinear[p[0]] : p[0] * inv255;
+			float g = options.srgb ? pToLinear[p[1]] : p[1] * inv255;
+			float b = options.srgb ? pToLinear[p[2]] : p[2] * inv255;
+			if (options.premultipliedAlpha)
+			{
+				r *= a;
+				g *= a;
+				b *= a;
+			}
+			pDst[x * 4 + 0] = r;
+			pDst[x * 4 + 1] = g;
+			pDst[x * 4 + 2] = b;
+			pDst[x * 4 + 3] = a;
+		}
+	}
+
+	// linear float4 row -> RGBA8 row
+	void StoreRow(const float* pSrc, uint32_t width, const MipBuildOptions& options, unsigned char* pDst)
+	{
+		const unsigned char* pToSrgb = GetLinearToSrgbTable();
+		for (uint32_t x = 0; x < width; x++)
+		{
+			float c[4] = { pSrc[x * 4 + 0], pSrc[x * 4 + 1], pSrc[x * 4 + 2], pSrc[x * 4 + 3] };
+			if (options.premultipliedAlpha)
+			{
+				float invA = c[3] > 1e-6f ? 1.f / c[3] : 0.f;
+				c[0] *= invA;
+				c[1] *= invA;
+				c[2] *= invA;
+			}
+			for (int k = 0; k < 4; k++)
+			{
+				// the negative lobes of kaiser and lanczos overshoot
+				float v = c[k] < 0.f ? 0.f : (c[k] > 1.f ? 1.f : c[k]);
+				pDst[x * 4 + k] = (options.srgb && k < 3) ? pToSrgb[(uint32_t)(v * 65535.f + 0.5f)] : (unsigned char)(v * 255.f + 0.5f);
+			}
+		}
+	}
+
+	void FilterRowHorizontal(const float* pSrc, const FilterTable& table, uint32_t dstWidth, float* pDst)
+	{
+		for (uint32_t x = 0; x < dstWidth; x++)
+		{
+			const FilterTap& tap = table.taps[x];
+			const float* pWeights = table.weights.data() + tap.weightOffset;
+			const float* p = pSrc + tap.first * 4;
+#if MIP_CHAIN_SSE
+			__m128 acc = _mm_setzero_ps();
+			for (uint32_t k = 0; k < tap.count; k++)
+			{
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(pWeights[k]), _mm_loadu_ps(p + k * 4)));
+			}
+			_mm_storeu_ps(pDst + x * 4, acc);
+#else
+			float acc[4] = { 0.f, 0.f, 0.f, 0.f };
+			for (uint32_t k = 0; k < tap.count; k++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					acc[c] += pWeights[k] * p[k * 4 + c];
+				}
+			}
+			memcpy(pDst + x * 4, acc, sizeof(acc));
+#endif
+		}
+	}
+
+	// pRows points at the horizontally filtered rows, rowFloats apart
+	void FilterRowVertical(const float* pRows, size_t rowFloats, const FilterTap& tap, const float* pWeights, float* pDst)
+	{
+		size_t i = 0;
+#if MIP_CHAIN_AVX2
+		for (; i + 8 <= rowFloats; i += 8)
+		{
+			__m256 acc = _mm256_setzero_ps();
+			for (uint32_t k = 0; k < tap.count; k++)
+			{
+				const float* pRow = pRows + (tap.first + k) * rowFloats;
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(pWeights[k]), _mm256_loadu_ps(pRow + i)));
+			}
+			_mm256_storeu_ps(pDst + i, acc);
+		}
+#endif
+#if MIP_CHAIN_SSE
+		for (; i + 4 <= rowFloats; i += 4)
+		{
+			__m128 acc = _mm_setzero_ps();
+			for (uint32_t k = 0; k < tap.count; k++)
+			{
+				const float* pRow = pRows + (tap.first + k) * rowFloats;
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(pWeights[k]), _mm_loadu_ps(pRow + i)));
+			}
+			_mm_storeu_ps(pDst + i, acc);
+		}
+#endif
+		for (; i < rowFloats; i++)
+		{
+			float acc = 0.f;
+			for (uint32_t k = 0; k < tap.count; k++)
+			{
+				acc += pWeights[k] * pRows[(tap.first + k) * rowFloats + i];
+			}
+			pDst[i] = acc;
+		}
+	}
+
+	const char* GetFilterName(MipFilter filter)
+	{
+		switch (filter)
+		{
+		case MipFilter::Box: return "box";
+		case MipFilter::Kaiser: return "kaiser";
+		case MipFilter::Lanczos3: return "lanczos3";
+		}
+		return "unknown";
+	}
+}
+
+uint32_t ComputeMipLevels(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	uint32_t size = width > height ? width : height;
+	while (size > 1)
+	{
+		size >>= 1;
+		levels++;
+	}
+	return levels;
+}
+
+VkDeviceSize ComputeMipChainLayout(uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<MipLevelLayout>& levels)
+{
+	levels.resize(mipLevels);
+	VkDeviceSize offset = 0;
+	for (uint32_t i = 0; i < mipLevels; i++)
+	{
+		levels[i].offset = offset;
+		levels[i].width = width;
+		levels[i].height = height;
+		// RGBA8 levels stay 4 byte aligned, which is all vkCmdCopyBufferToImage asks for
+		offset += (VkDeviceSize)width * height * 4;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return offset;
+}
+
+void BuildMipChainRGBA8(const unsigned char* pSource, uint32_t sourcePitch, unsigned char* pChain,
+	const std::vector<MipLevelLayout>& levels, const MipBuildOptions& options)
+{
+	if (levels.empty())
+	{
+		return;
+	}
+	uint32_t threadCount = options.threadCount ? options.threadCount : std::thread::hardware_concurrency();
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+
+	const MipLevelLayout& base = levels[0];
+	ParallelFor(base.height, threadCount, [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			memcpy(pChain + base.offset + (size_t)y * base.width * 4, pSource + (size_t)y * sourcePitch, (size_t)base.width * 4);
+		}
+	});
+
+	// the previous level stays in float so the error of each 8 bit store doesn't feed into the next level
+	std::vector<float> previous;
+	std::vector<float> current;
+	std::vector<float> horizontal;
+	FilterTable rowTable;
+	FilterTable columnTable;
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		const MipLevelLayout& src = levels[level - 1];
+		const MipLevelLayout& dst = levels[level];
+		BuildFilterTable(options.filter, src.width, dst.width, rowTable);
+		BuildFilterTable(options.filter, src.height, dst.height, columnTable);
+
+		size_t dstRowFloats = (size_t)dst.width * 4;
+		horizontal.resize(dstRowFloats * src.height);
+		ParallelFor(src.height, threadCount, [&](uint32_t begin, uint32_t end)
+		{
+			std::vector<float> row;
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const float* pRow = nullptr;
+				if (level == 1)
+				{
+					row.resize((size_t)src.width * 4);
+					LoadRow(pSource + (size_t)y * sourcePitch, src.width, options, row.data());
+					pRow = row.data();
+				}
+				else
+				{
+					pRow = previous.data() + (size_t)y * src.width * 4;
+				}
+				FilterRowHorizontal(pRow, rowTable, dst.width, horizontal.data() + y * dstRowFloats);
+			}
+		});
+
+		current.resize(dstRowFloats * dst.height);
+		ParallelFor(dst.height, threadCount, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t y = begin; y < end; y++)
+			{
+				const FilterTap& tap = columnTable.taps[y];
+				float* pRow = current.data() + y * dstRowFloats;
+				FilterRowVertical(horizontal.data(), dstRowFloats, tap, columnTable.weights.data() + tap.weightOffset, pRow);
+				StoreRow(pRow, dst.width, options, pChain + dst.offset + y * dstRowFloats);
+			}
+		});
+		previous.swap(current);
+	}
+}
+
+void BenchmarkMipFilters(const unsigned char* pSource, uint32_t width, uint32_t height, uint32_t sourcePitch, bool srgb)
+{
+	std::vector<MipLevelLayout> levels;
+	VkDeviceSize chainSize = ComputeMipChainLayout(width, height, ComputeMipLevels(width, height), levels);
+	std::vector<unsigned char> chain((size_t)chainSize);
+
+	const MipFilter filters[] = { MipFilter::Box, MipFilter::Kaiser, MipFilter::Lanczos3 };
+	for (MipFilter filter : filters)
+	{
+		MipBuildOptions options;
+		options.filter = filter;
+		options.srgb = srgb;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		BuildMipChainRGBA8(pSource, sourcePitch, chain.data(), levels, options);
+		float ms = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+		std::cout << "Mip chain " << width << "x" << height << " " << GetFilterName(filter) << ": " << ms << " ms, "
+			<< (width * (double)height) / (ms * 1000.0) << " MPix/s" << std::endl;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct MipLevelLayout
+{
+	VkDeviceSize	offset = 0;// from the start of the chain
+	uint32_t		width = 0;
+	uint32_t		height = 0;
+};
+
+enum class MipFilter : uint32_t
+{
+	Box = 0,// 2x2 average, fastest
+	Kaiser,// kaiser windowed sinc, width 3, alpha 4
+	Lanczos3
+};
+
+struct MipBuildOptions
+{
+	MipFilter filter = MipFilter::Kaiser;
+	bool srgb = true;// color is sRGB encoded, average in linear space
+	bool premultipliedAlpha = true;// filter premultiplied color so transparent texels don't bleed into their neighbours
+	uint32_t threadCount = 0;// 0 uses every hardware thread
+};
+
+// Full chain down to 1x1
+uint32_t ComputeMipLevels(uint32_t width, uint32_t height);
+
+// Lays out mipLevels tightly packed RGBA8 levels back to back, level 0 first. Returns the chain size.
+VkDeviceSize ComputeMipChainLayout(uint32_t width, uint32_t height, uint32_t mipLevels, std::vector<MipLevelLayout>& levels);
+
+// Writes every level of the chain into pChain: level 0 is copied from pSource, the others are filtered from
+// the level above in float. pChain is only ever written, so it can be mapped write combined staging memory.
+// Rows are split across threads, the inner loops use SSE (AVX2 when the compiler targets it).
+void BuildMipChainRGBA8(const unsigned char* pSource, uint32_t sourcePitch, unsigned char* pChain,
+	const std::vector<MipLevelLayout>& levels, const MipBuildOptions& options);
+
+// Builds the full chain of the given image with every filter and prints ms and MPix/s (source pixels) for each
+void BenchmarkMipFilters(const unsigned char* pSource, uint32_t width, uint32_t height, uint32_t sourcePitch, bool srgb);
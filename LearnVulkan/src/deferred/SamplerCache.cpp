@@ -0,0 +1,99 @@
+#include "SamplerCache.h"
+#include "TextureCache.h"
+#include <cstring>
+#include <iostream>
+#include <cassert>
+
+void VulkanSamplerCache::Init(VkPhysicalDevice pPhysicalDevice, VkDevice pDevice)
+{
+	m_pDevice = pDevice;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(pPhysicalDevice, &properties);
+	mMaxSamplerCount = properties.limits.maxSamplerAllocationCount;
+}
+
+void VulkanSamplerCache::Destroy()
+{
+	for (auto& sampler : mSamplers)
+	{
+		vkDestroySampler(m_pDevice, sampler.second.pSampler, nullptr);
+	}
+	mSamplers.clear();
+	mImmutableSamplers.clear();
+	mRequestCount = 0;
+}
+
+VkSamplerCreateInfo VulkanSamplerCache::MakeKey(const VkSamplerCreateInfo& info)
+{
+	// field by field into zeroed memory, so padding never differs between two equal states
+	VkSamplerCreateInfo key;
+	memset(&key, 0, sizeof(key));
+	key.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	key.flags = info.flags;
+	key.magFilter = info.magFilter;
+	key.minFilter = info.minFilter;
+	key.mipmapMode = info.mipmapMode;
+	key.addressModeU = info.addressModeU;
+	key.addressModeV = info.addressModeV;
+	key.addressModeW = info.addressModeW;
+	key.mipLodBias = info.mipLodBias;
+	key.anisotropyEnable = info.anisotropyEnable;
+	key.maxAnisotropy = info.anisotropyEnable ? info.maxAnisotropy : 1.f;// ignored when disabled
+	key.compareEnable = info.compareEnable;
+	key.compareOp = info.compareEnable ? info.compareOp : VK_COMPARE_OP_NEVER;
+	key.minLod = info.minLod;
+	key.maxLod = info.maxLod;
+	key.borderColor = info.borderColor;
+	key.unnormalizedCoordinates = info.unnormalizedCoordinates;
+	return key;
+}
+
+VkSampler VulkanSamplerCache::GetSampler(const VkSamplerCreateInfo& info)
+{
+	assert(info.pNext == nullptr);
+	mRequestCount++;
+	VkSamplerCreateInfo key = MakeKey(info);
+	uint64_t hash = HashBytes(&key, sizeof(key));
+	auto range = mSamplers.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (memcmp(&it->second.info, &key, sizeof(key)) == 0)
+		{
+			return it->second.pSampler;
+		}
+	}
+
+	if (mSamplers.size() >= mMaxSamplerCount)
+	{
+		std::cerr << "Sampler cache: maxSamplerAllocationCount (" << mMaxSamplerCount << ") reached" << std::endl;
+		return VK_NULL_HANDLE;
+	}
+	Entry entry;
+	entry.info = key;
+	if (vkCreateSampler(m_pDevice, &key, nullptr, &entry.pSampler) != VK_SUCCESS)
+	{
+		std::cerr << "VkSampler create failed" << std::endl;
+		return VK_NULL_HANDLE;
+	}
+	mSamplers.emplace(hash, entry);
+	return entry.pSampler;
+}
+
+const VkSampler* VulkanSamplerCache::GetImmutableSamplers(VkSampler sampler, uint32_t count)
+{
+	for (const auto& samplers : mImmutableSamplers)
+	{
+		if (samplers.size() == count && samplers[0] == sampler)
+		{
+			return samplers.data();
+		}
+	}
+	mImmutableSamplers.emplace_back(count, sampler);
+	return mImmutableSamplers.back().data();
+}
+
+void VulkanSamplerCache::PrintStats() const
+{
+	std::cout << "Samplers: " << mSamplers.size() << " unique for " << mRequestCount << " requests (limit "
+		<< mMaxSamplerCount << ")" << std::endl;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+
+// Shared, immutable samplers keyed by a hash of their VkSamplerCreateInfo. Two requests with the same state get
+// the same VkSampler, which lives until Destroy(), so a sampler can be baked into descriptor set layouts as an
+// immutable sampler and new texture types don't add sampler objects against maxSamplerAllocationCount.
+class VulkanSamplerCache
+{
+public:
+	VulkanSamplerCache() = default;
+	~VulkanSamplerCache() = default;
+
+	void Init(VkPhysicalDevice pPhysicalDevice, VkDevice pDevice);
+	void Destroy();
+
+	// info.pNext must be null, chained structs aren't part of the key. VK_NULL_HANDLE when creation fails.
+	VkSampler GetSampler(const VkSamplerCreateInfo& info);
+	// count copies of sampler for VkDescriptorSetLayoutBinding::pImmutableSamplers, valid until Destroy()
+	const VkSampler* GetImmutableSamplers(VkSampler sampler, uint32_t count);
+
+	uint32_t GetSamplerCount() const { return (uint32_t)mSamplers.size(); }
+	void PrintStats() const;
+
+private:
+	struct Entry
+	{
+		VkSamplerCreateInfo info;// normalized, see MakeKey
+		VkSampler pSampler;
+	};
+
+	static VkSamplerCreateInfo MakeKey(const VkSamplerCreateInfo& info);
+
+private:
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	uint32_t mMaxSamplerCount = 0;
+	std::unordered_multimap<uint64_t, Entry> mSamplers;
+	std::deque<std::vector<VkSampler>> mImmutableSamplers;
+	uint32_t mRequestCount = 0;
+};
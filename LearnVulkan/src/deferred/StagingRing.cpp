@@ -0,0 +1,110 @@
+#include "StagingRing.h"
+#include <cassert>
+
+void VulkanStagingRing::Init(VkBuffer pBuffer, void* pMapped, VkDeviceSize size)
+{
+	assert(pMapped);
+	m_pBuffer = pBuffer;
+	m_pMapped = static_cast<char*>(pMapped);
+	mSize = size;
+	Reset();
+}
+
+void VulkanStagingRing::Reset()
+{
+	mHead = 0;
+	mTail = 0;
+	mUsed = 0;
+	mLastBytes = 0;
+	mRanges.clear();
+}
+
+bool VulkanStagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t retireValue, StagingRegion& region)
+{
+	if (alignment == 0)
+	{
+		alignment = 1;
+	}
+	if (mUsed == 0)
+	{
+		// nothing in flight, start over at the front so big requests see the whole ring
+		mHead = 0;
+		mTail = 0;
+	}
+
+	VkDeviceSize offset = (mHead + alignment - 1) / alignment * alignment;
+	VkDeviceSize newHead = 0;
+	bool wrapped = false;
+	if (mHead >= mTail && mUsed < mSize)
+	{
+		// free space is [head, size) and [0, tail)
+		if (offset + size <= mSize)
+		{
+			newHead = offset + size;
+		}
+		else if (size <= mTail)
+		{
+			// the end of the ring is skipped and retires with this allocation
+			offset = 0;
+			newHead = size;
+			wrapped = true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else if (mHead < mTail && offset + size <= mTail)
+	{
+		newHead = offset + size;
+	}
+	else
+	{
+		return false;
+	}
+
+	VkDeviceSize bytes = wrapped ? mSize - mHead + newHead : newHead - mHead;
+	if (!mRanges.empty() && mRanges.back().retireValue == retireValue)
+	{
+		mRanges.back().end = newHead;
+		mRanges.back().bytes += bytes;
+	}
+	else
+	{
+		mRanges.push_back({ newHead, bytes, retireValue });
+	}
+	mLastHead = mHead;
+	mLastBytes = bytes;
+	mHead = newHead;
+	mUsed += bytes;
+
+	region.pBuffer = m_pBuffer;
+	region.offset = offset;
+	region.pData = m_pMapped + offset;
+	return true;
+}
+
+void VulkanStagingRing::Release(const StagingRegion& region)
+{
+	assert(mLastBytes > 0 && region.pData == m_pMapped + region.offset && !mRanges.empty());
+	Range& range = mRanges.back();
+	range.end = mLastHead;
+	range.bytes -= mLastBytes;
+	if (range.bytes == 0)
+	{
+		mRanges.pop_back();
+	}
+	mHead = mLastHead;
+	mUsed -= mLastBytes;
+	mLastBytes = 0;
+}
+
+void VulkanStagingRing::Reclaim(uint64_t completedValue)
+{
+	while (!mRanges.empty() && mRanges.front().retireValue <= completedValue)
+	{
+		mTail = mRanges.front().end;
+		mUsed -= mRanges.front().bytes;
+		mRanges.pop_front();
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <deque>
+
+struct StagingRegion
+{
+	VkBuffer		pBuffer = VK_NULL_HANDLE;
+	VkDeviceSize	offset = 0;// offset inside pBuffer, the copy source offset
+	void*			pData = nullptr;
+};
+
+// Ring allocator over one persistently mapped staging buffer. Every region is tagged with the
+// timeline value of the submission that reads it and comes back in order once Reclaim() sees
+// that value completed, so steady state uploads never create buffers or allocate memory.
+// Allocate() fails when the ring is full; the owner waits for its oldest submission and reclaims.
+class VulkanStagingRing
+{
+public:
+	VulkanStagingRing() = default;
+	~VulkanStagingRing() = default;
+
+	// pMapped must point at the start of pBuffer, size bytes long
+	void Init(VkBuffer pBuffer, void* pMapped, VkDeviceSize size);
+
+	bool Allocate(VkDeviceSize size, VkDeviceSize alignment, uint64_t retireValue, StagingRegion& region);
+	// Gives back the region the last Allocate() returned, for producers that fail before anything reads it.
+	// Only the newest allocation can be released, and only once.
+	void Release(const StagingRegion& region);
+	void Reclaim(uint64_t completedValue);
+	// Frees everything; only when no submission reads the ring
+	void Reset();
+
+	VkBuffer GetBuffer() const { return m_pBuffer; }
+	VkDeviceSize GetSize() const { return mSize; }
+	VkDeviceSize GetUsedBytes() const { return mUsed; }
+
+private:
+	struct Range
+	{
+		VkDeviceSize end;// head after the last allocation of this range
+		VkDeviceSize bytes;// including alignment and wrap padding
+		uint64_t retireValue;
+	};
+
+	VkBuffer m_pBuffer = VK_NULL_HANDLE;
+	char* m_pMapped = nullptr;
+	VkDeviceSize mSize = 0;
+	VkDeviceSize mHead = 0;// next free byte
+	VkDeviceSize mTail = 0;// oldest byte still in use
+	VkDeviceSize mUsed = 0;
+	VkDeviceSize mLastHead = 0;// head before the last allocation
+	VkDeviceSize mLastBytes = 0;// what the last allocation added to mUsed, 0 once released
+	std::deque<Range> mRanges;// oldest first
+};
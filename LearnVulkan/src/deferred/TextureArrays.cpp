@@ -0,0 +1,173 @@
+#include "TextureArrays.h"
+#include <cstring>
+#include <iostream>
+
+void VulkanTextureArrays::Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader)
+{
+	m_pDevice = pDevice;
+	m_pAllocator = pAllocator;
+	m_pUploader = pUploader;
+}
+
+void VulkanTextureArrays::Destroy()
+{
+	for (auto& array : mArrays)
+	{
+		if (array.pView)
+		{
+			vkDestroyImageView(m_pDevice, array.pView, nullptr);
+		}
+		if (array.pImage)
+		{
+			vkDestroyImage(m_pDevice, array.pImage, nullptr);
+			m_pAllocator->Free(array.memory);
+		}
+	}
+	mArrays.clear();
+	mTextureCount = 0;
+}
+
+bool VulkanTextureArrays::CreateArray(TextureArray& array)
+{
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.extent = { array.width, array.height, 1 };
+	createInfo.mipLevels = array.mipLevels;
+	createInfo.arrayLayers = array.layerCount;
+	createInfo.format = array.format;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	createInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (vkCreateImage(m_pDevice, &createInfo, nullptr, &array.pImage) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_pDevice, array.pImage, &requirements);
+	uint32_t memoryType = 0;
+	if (!m_pAllocator->FindMemoryType(requirements.memoryTypeBits, m_pAllocator->GetPolicy(MemoryUsage::GpuOnly), memoryType)
+		|| !m_pAllocator->Allocate(requirements, memoryType, AllocationType::ImageOptimal, array.memory))
+	{
+		vkDestroyImage(m_pDevice, array.pImage, nullptr);
+		array.pImage = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindImageMemory(m_pDevice, array.pImage, array.memory.pMemory, array.memory.offset);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = array.pImage;
+	viewInfo.format = array.format;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = array.mipLevels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = array.layerCount;
+	return vkCreateImageView(m_pDevice, &viewInfo, nullptr, &array.pView) == VK_SUCCESS;
+}
+
+void VulkanTextureArrays::Pack(const std::vector<LoadedTexture>& textures, std::vector<TextureArraySlot>& slots)
+{
+	// group by everything the layers of one image have to share
+	slots.assign(textures.size(), TextureArraySlot());
+	std::vector<std::vector<uint32_t>> groups;
+	std::vector<TextureArray> arrays;
+	for (uint32_t i = 0; i < (uint32_t)textures.size(); i++)
+	{
+		const LoadedTexture& texture = textures[i];
+		if (!texture.loaded || texture.generateMips || texture.levels.size() != texture.mipLevels)
+		{
+			std::cerr << "Texture " << texture.path << " has no cpu mip chain and can't be packed" << std::endl;
+			continue;
+		}
+		uint32_t group = 0;
+		while (group < (uint32_t)arrays.size() && !(arrays[group].format == texture.format && arrays[group].width == texture.width
+			&& arrays[group].height == texture.height && arrays[group].mipLevels == texture.mipLevels))
+		{
+			group++;
+		}
+		if (group == (uint32_t)arrays.size())
+		{
+			if (mArrays.size() + arrays.size() >= MaxArrays)
+			{
+				std::cerr << "Texture " << texture.path << " needs a texture array past the " << MaxArrays << " there are" << std::endl;
+				continue;
+			}
+			TextureArray array;
+			array.format = texture.format;
+			array.width = texture.width;
+			array.height = texture.height;
+			array.mipLevels = texture.mipLevels;
+			array.layerCount = 0;
+			arrays.push_back(array);
+			groups.emplace_back();
+		}
+		slots[i].array = group;// made an array index once the group's image exists
+		slots[i].layer = arrays[group].layerCount++;
+		groups[group].push_back(i);
+	}
+
+	for (uint32_t group = 0; group < (uint32_t)arrays.size(); group++)
+	{
+		TextureArray& array = arrays[group];
+		const std::vector<uint32_t>& members = groups[group];
+		if (!CreateArray(array))
+		{
+			std::cerr << "Texture array " << array.width << "x" << array.height << " can't be created" << std::endl;
+			if (array.pImage)
+			{
+				vkDestroyImage(m_pDevice, array.pImage, nullptr);
+				m_pAllocator->Free(array.memory);
+			}
+			for (uint32_t i : members)
+			{
+				slots[i].array = ~0u;
+			}
+			continue;
+		}
+		for (uint32_t i : members)
+		{
+			slots[i].array = (uint32_t)mArrays.size();
+		}
+
+		// every layer's chain back to back in one staging region, one copy per layer and level
+		VkDeviceSize layerSize = textures[members[0]].size;
+		StagingRegion staging = m_pUploader->AllocateStaging(layerSize * members.size());
+		std::vector<VkBufferImageCopy> copies;
+		for (uint32_t layer = 0; layer < (uint32_t)members.size(); layer++)
+		{
+			const LoadedTexture& texture = textures[members[layer]];
+			memcpy((unsigned char*)staging.pData + layerSize * layer, texture.GetTexels(), (size_t)layerSize);
+			for (uint32_t level = 0; level < array.mipLevels; level++)
+			{
+				VkBufferImageCopy copy = {};
+				copy.bufferOffset = layerSize * layer + texture.levels[level].offset;
+				copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				copy.imageSubresource.mipLevel = level;
+				copy.imageSubresource.baseArrayLayer = layer;
+				copy.imageSubresource.layerCount = 1;
+				copy.imageExtent = { texture.levels[level].width, texture.levels[level].height, 1 };
+				copies.push_back(copy);
+			}
+		}
+		m_pUploader->UploadImageLayers(array.pImage, staging, copies.data(), (uint32_t)copies.size(), array.mipLevels, array.layerCount,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		mTextureCount += array.layerCount;
+		mArrays.push_back(array);
+	}
+}
+
+void VulkanTextureArrays::PrintStats() const
+{
+	std::cout << "Texture arrays: " << mTextureCount << " textures in " << mArrays.size() << " arrays" << std::endl;
+	for (const auto& array : mArrays)
+	{
+		std::cout << "\t" << array.width << "x" << array.height << " format " << array.format << ", " << array.mipLevels << " mip levels, "
+			<< array.layerCount << " layers" << std::endl;
+	}
+}
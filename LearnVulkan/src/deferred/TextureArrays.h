@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "MemoryAllocator.h"
+#include "TransferUploader.h"
+#include "TextureStreamer.h"
+
+// Where a packed texture ended up: which array image and which layer of it
+struct TextureArraySlot
+{
+	uint32_t array = ~0u;
+	uint32_t layer = 0;
+};
+
+// Push constants of the texture array variant of deferred.frag, one per draw
+struct TextureArrayDraw
+{
+	uint32_t array;
+	uint32_t layer;
+};
+
+// Packs cooked textures into 2D array images at import, one array per format, size and level count,
+// so every material goes through the same MaxArrays descriptors and a draw only pushes its slot
+// instead of binding a descriptor set of its own.
+class VulkanTextureArrays
+{
+public:
+	static const uint32_t MaxArrays = 4;// descriptors at binding 4 of the texture array shader
+
+	VulkanTextureArrays() = default;
+	~VulkanTextureArrays() = default;
+
+	void Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader);
+	void Destroy();
+
+	// One slot per texture, in order. Textures without their full chain on the cpu (blitted on the gpu) and
+	// groups past MaxArrays are left out with array ~0u. Layers are recorded on the uploader, not flushed.
+	void Pack(const std::vector<LoadedTexture>& textures, std::vector<TextureArraySlot>& slots);
+
+	uint32_t GetArrayCount() const { return (uint32_t)mArrays.size(); }
+	VkImageView GetImageView(uint32_t array) const { return mArrays[array].pView; }
+	uint32_t GetMipLevels(uint32_t array) const { return mArrays[array].mipLevels; }
+	void PrintStats() const;
+
+private:
+	struct TextureArray
+	{
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t layerCount;
+		VkImage pImage = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView pView = VK_NULL_HANDLE;
+	};
+
+	bool CreateArray(TextureArray& array);
+
+private:
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	VulkanMemoryAllocator* m_pAllocator = nullptr;
+	VulkanTransferUploader* m_pUploader = nullptr;
+	std::vector<TextureArray> mArrays;
+	uint32_t mTextureCount = 0;
+};
@@ -0,0 +1,114 @@
+#include "TextureCache.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	const uint32_t COOKED_TEXTURE_MAGIC = 0x5845544C;// "LTEX"
+	// bump whenever the cook output changes for the same options
+	const uint32_t COOKED_TEXTURE_VERSION = 1;
+}
+
+uint64_t HashBytes(const void* pData, size_t size, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(pData);
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+void TextureCache::Init(const char* pDirectory)
+{
+	mDirectory = pDirectory;
+	std::error_code error;
+	std::filesystem::create_directories(mDirectory, error);
+	if (error)
+	{
+		std::cerr << "Texture cache directory " << mDirectory << " create failed: " << error.message() << std::endl;
+	}
+}
+
+std::string TextureCache::GetPath(const TextureCacheKey& key) const
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/%016llx%016llx.tex", (unsigned long long)key.sourceHash, (unsigned long long)key.optionsHash);
+	return mDirectory + name;
+}
+
+bool TextureCache::Load(const TextureCacheKey& key, CookedTexture& texture)
+{
+	std::string path = GetPath(key);
+	bool valid = texture.file.Open(path.c_str()) && texture.file.GetSize() >= sizeof(CookedTextureHeader);
+	if (valid)
+	{
+		memcpy(&texture.header, texture.file.GetData(), sizeof(CookedTextureHeader));
+		const CookedTextureHeader& header = texture.header;
+		valid = header.magic == COOKED_TEXTURE_MAGIC && header.version == COOKED_TEXTURE_VERSION
+			&& header.sourceHash == key.sourceHash && header.optionsHash == key.optionsHash
+			&& header.dataSize == texture.file.GetSize() - sizeof(CookedTextureHeader);
+	}
+	if (!valid)
+	{
+		texture.file.Close();
+		mMissCount++;
+		return false;
+	}
+	texture.pData = texture.file.GetData() + sizeof(CookedTextureHeader);
+	mHitCount++;
+	return true;
+}
+
+bool TextureCache::Store(const TextureCacheKey& key, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount,
+	const void* pData, uint64_t size)
+{
+	CookedTextureHeader header = {};
+	header.magic = COOKED_TEXTURE_MAGIC;
+	header.version = COOKED_TEXTURE_VERSION;
+	header.sourceHash = key.sourceHash;
+	header.optionsHash = key.optionsHash;
+	header.format = (uint32_t)format;
+	header.width = width;
+	header.height = height;
+	header.levelCount = levelCount;
+	header.dataSize = size;
+
+	// written next to the final name and renamed, so a crash never leaves a truncated file that looks valid
+	std::string path = GetPath(key);
+	std::string tempPath = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out.is_open())
+		{
+			std::cerr << "Texture cache write failed: " << tempPath << std::endl;
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(static_cast<const char*>(pData), (std::streamsize)size);
+		if (!out)
+		{
+			std::cerr << "Texture cache write failed: " << tempPath << std::endl;
+			return false;
+		}
+	}
+	std::remove(path.c_str());
+	if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		std::cerr << "Texture cache rename failed: " << path << std::endl;
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+void TextureCache::PrintStats() const
+{
+	std::cout << "Texture cache " << mDirectory << ": " << mHitCount << " hits, " << mMissCount << " misses" << std::endl;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <atomic>
+#include "MappedFile.h"
+
+// 64 bit FNV-1a, seed chains several inputs into one hash
+uint64_t HashBytes(const void* pData, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+
+struct TextureCacheKey
+{
+	uint64_t sourceHash = 0;// content of the source image file
+	uint64_t optionsHash = 0;// everything that changes the cooked texels: format, mip count, filter...
+};
+
+struct CookedTextureHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint64_t optionsHash;
+	uint32_t format;// VkFormat
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+	uint64_t dataSize;// texels following the header, laid out the way the cook wrote them
+};
+
+struct CookedTexture
+{
+	MappedFile file;
+	CookedTextureHeader header = {};
+	const unsigned char* pData = nullptr;// inside file, header.dataSize bytes
+};
+
+// Directory of cooked textures, one file per key: a CookedTextureHeader followed by the texels ready to be
+// copied into staging memory. Cooked files are memory mapped on load, so a hit costs no decode and no read call.
+class TextureCache
+{
+public:
+	TextureCache() = default;
+	~TextureCache() = default;
+
+	void Init(const char* pDirectory);
+
+	// Counts a hit when a cooked file for key exists and its header matches
+	bool Load(const TextureCacheKey& key, CookedTexture& texture);
+	bool Store(const TextureCacheKey& key, VkFormat format, uint32_t width, uint32_t height, uint32_t levelCount,
+		const void* pData, uint64_t size);
+
+	// A lookup skipped on purpose (cold start runs) counts as a miss too
+	void CountMiss() { mMissCount++; }
+
+	uint32_t GetHitCount() const { return mHitCount; }
+	uint32_t GetMissCount() const { return mMissCount; }
+	void PrintStats() const;
+
+private:
+	std::string GetPath(const TextureCacheKey& key) const;
+
+private:
+	std::string mDirectory;
+	// Load and Store are called from the texture loading workers
+	std::atomic<uint32_t> mHitCount = 0;
+	std::atomic<uint32_t> mMissCount = 0;
+};
@@ -0,0 +1,332 @@
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// above any stream in, below the virtual texture's pages
+static const int StreamOutPriority = std::numeric_limits<int>::max() - 1;
+
+void VulkanTextureStreamer::Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader, VulkanUploadScheduler* pScheduler,
+	uint32_t frameCount, VkDeviceSize budget, uint32_t minResidentSize)
+{
+	m_pDevice = pDevice;
+	m_pAllocator = pAllocator;
+	m_pUploader = pUploader;
+	m_pScheduler = pScheduler;
+	mFrameCount = frameCount;
+	mBudget = budget;
+	mMinResidentSize = minResidentSize;
+	mReportTime = std::chrono::high_resolution_clock::now();
+}
+
+void VulkanTextureStreamer::Destroy()
+{
+	for (auto& retired : mRetired)
+	{
+		Release(retired.residency);
+	}
+	mRetired.clear();
+	for (auto& texture : mTextures)
+	{
+		Release(texture.current);
+		Release(texture.pending);
+	}
+	mTextures.clear();
+	mResidentBytes = 0;
+}
+
+VkDeviceSize VulkanTextureStreamer::GetChainBytes(const Texture& texture, uint32_t level) const
+{
+	// levels are stored largest first, a level and everything below it is a suffix of the chain
+	return texture.source.size - texture.source.levels[level].offset;
+}
+
+uint32_t VulkanTextureStreamer::Add(LoadedTexture&& source)
+{
+	Texture texture;
+	texture.source = std::move(source);
+	texture.streamable = !texture.source.generateMips && texture.source.levels.size() == texture.source.mipLevels;
+	if (texture.streamable)
+	{
+		texture.tailLevel = texture.source.mipLevels - 1;
+		while (texture.tailLevel > 0)
+		{
+			const MipLevelLayout& level = texture.source.levels[texture.tailLevel - 1];
+			if (level.width > mMinResidentSize || level.height > mMinResidentSize)
+			{
+				break;
+			}
+			texture.tailLevel--;
+		}
+	}
+	texture.requestedLevel = texture.tailLevel;
+	texture.wantedLevel = texture.tailLevel;
+
+	if (!Upload(texture, texture.tailLevel, texture.current))
+	{
+		std::cerr << "Texture " << texture.source.path << " can't be made resident" << std::endl;
+	}
+	mTextures.push_back(std::move(texture));
+	return (uint32_t)mTextures.size() - 1;
+}
+
+void VulkanTextureStreamer::RequestLevel(uint32_t id, float screenSize)
+{
+	Texture& texture = mTextures[id];
+	if (!texture.streamable)
+	{
+		return;
+	}
+	// one texel per pixel at the requested level, the finer levels would only be minified away
+	float size = (float)std::max(texture.source.width, texture.source.height);
+	float level = std::floor(std::log2(size / std::max(screenSize, 1.f)));
+	texture.requestedLevel = (uint32_t)std::min(std::max(level, 0.f), (float)texture.tailLevel);
+}
+
+bool VulkanTextureStreamer::Upload(Texture& texture, uint32_t level, Residency& residency)
+{
+	const LoadedTexture& source = texture.source;
+	uint32_t levelCount = source.mipLevels - level;
+	uint32_t width = texture.streamable ? source.levels[level].width : source.width;
+	uint32_t height = texture.streamable ? source.levels[level].height : source.height;
+
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.extent = { width, height, 1 };
+	createInfo.mipLevels = levelCount;
+	createInfo.arrayLayers = 1;
+	createInfo.format = source.format;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	createInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (source.generateMips)
+	{
+		createInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (vkCreateImage(m_pDevice, &createInfo, nullptr, &residency.pImage) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_pDevice, residency.pImage, &requirements);
+	uint32_t memoryType = 0;
+	if (!m_pAllocator->FindMemoryType(requirements.memoryTypeBits, m_pAllocator->GetPolicy(MemoryUsage::GpuOnly), memoryType)
+		|| !m_pAllocator->Allocate(requirements, memoryType, AllocationType::ImageOptimal, residency.memory))
+	{
+		vkDestroyImage(m_pDevice, residency.pImage, nullptr);
+		residency.pImage = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindImageMemory(m_pDevice, residency.pImage, residency.memory.pMemory, residency.memory.offset);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = residency.pImage;
+	viewInfo.format = source.format;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = levelCount;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	if (vkCreateImageView(m_pDevice, &viewInfo, nullptr, &residency.pView) != VK_SUCCESS)
+	{
+		Release(residency);
+		return false;
+	}
+
+	if (source.generateMips)
+	{
+		StagingRegion staging = m_pUploader->AllocateStaging(source.size);
+		memcpy(staging.pData, source.GetTexels(), (size_t)source.size);
+		m_pUploader->UploadImageGenerateMips(residency.pImage, staging, width, height, 0, levelCount, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+	else
+	{
+		// the resident levels are one contiguous run of the cooked chain, staged with one copy
+		VkDeviceSize offset = source.levels[level].offset;
+		VkDeviceSize size = source.size - offset;
+		StagingRegion staging = m_pUploader->AllocateStaging(size);
+		memcpy(staging.pData, source.GetTexels() + offset, (size_t)size);
+
+		std::vector<VkBufferImageCopy> regions(levelCount);
+		for (uint32_t i = 0; i < levelCount; i++)
+		{
+			const MipLevelLayout& layout = source.levels[level + i];
+			regions[i] = {};
+			regions[i].bufferOffset = layout.offset - offset;
+			regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			regions[i].imageSubresource.mipLevel = i;
+			regions[i].imageSubresource.baseArrayLayer = 0;
+			regions[i].imageSubresource.layerCount = 1;
+			regions[i].imageExtent = { layout.width, layout.height, 1 };
+		}
+		m_pUploader->UploadImageLevels(residency.pImage, staging, regions.data(), levelCount, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		mStreamedBytes += size;
+	}
+
+	residency.level = level;
+	residency.bytes = requirements.size;
+	mResidentBytes += residency.bytes;
+	return true;
+}
+
+void VulkanTextureStreamer::Release(Residency& residency)
+{
+	if (residency.pView)
+	{
+		vkDestroyImageView(m_pDevice, residency.pView, nullptr);
+	}
+	if (residency.pImage)
+	{
+		vkDestroyImage(m_pDevice, residency.pImage, nullptr);
+		m_pAllocator->Free(residency.memory);
+		mResidentBytes -= residency.bytes;
+	}
+	residency = Residency();
+}
+
+bool VulkanTextureStreamer::BeginFrame()
+{
+	mFrame++;
+	for (size_t i = 0; i < mRetired.size();)
+	{
+		if (mRetired[i].frame <= mFrame)
+		{
+			Release(mRetired[i].residency);
+			mRetired[i] = std::move(mRetired.back());
+			mRetired.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	if (!mPending)
+	{
+		return false;
+	}
+	// the last Update() flushed these, this frame's submit acquires and waits for them
+	// before anything samples the new views
+	for (auto& texture : mTextures)
+	{
+		if (texture.pending.pImage)
+		{
+			Retired retired;
+			retired.residency = texture.current;
+			// the frames still in flight may sample the old view
+			retired.frame = mFrame + mFrameCount;
+			mRetired.push_back(retired);
+			texture.current = texture.pending;
+			texture.pending = Residency();
+		}
+	}
+	mPending = false;
+	return true;
+}
+
+void VulkanTextureStreamer::Update()
+{
+	// start from what every texture asks for, then coarsen whichever texture frees the most
+	// memory with one level until the chains fit in the budget
+	VkDeviceSize total = 0;
+	for (auto& texture : mTextures)
+	{
+		texture.wantedLevel = texture.requestedLevel;
+		total += texture.streamable ? GetChainBytes(texture, texture.wantedLevel) : texture.current.bytes;
+	}
+	while (total > mBudget)
+	{
+		Texture* pCoarsest = nullptr;
+		VkDeviceSize freed = 0;
+		for (auto& texture : mTextures)
+		{
+			if (texture.streamable && texture.wantedLevel < texture.tailLevel)
+			{
+				VkDeviceSize levelBytes = GetChainBytes(texture, texture.wantedLevel) - GetChainBytes(texture, texture.wantedLevel + 1);
+				if (levelBytes > freed)
+				{
+					pCoarsest = &texture;
+					freed = levelBytes;
+				}
+			}
+		}
+		if (!pCoarsest)
+		{
+			break;
+		}
+		pCoarsest->wantedLevel++;
+		total -= freed;
+	}
+
+	// stream outs first, they give memory back and their uploads are small; then the textures missing the most levels.
+	// The scheduler drains them in that order within its per frame limit, the rest wait in its queue.
+	for (uint32_t id = 0; id < (uint32_t)mTextures.size(); id++)
+	{
+		Texture& texture = mTextures[id];
+		if (!texture.streamable || texture.queued || texture.pending.pImage || !texture.current.pImage || texture.wantedLevel == texture.current.level)
+		{
+			continue;
+		}
+		int priority = texture.wantedLevel < texture.current.level ? (int)(texture.current.level - texture.wantedLevel) : StreamOutPriority;
+		texture.queued = true;
+		m_pScheduler->Enqueue(GetChainBytes(texture, texture.wantedLevel), [this, id]() { Record(id); }, priority);
+	}
+
+	auto now = std::chrono::high_resolution_clock::now();
+	if (std::chrono::duration<float>(now - mReportTime).count() >= 1.f)
+	{
+		if (mStreamIns > 0 || mStreamOuts > 0)
+		{
+			PrintStats();
+		}
+		mReportTime = now;
+		mStreamIns = 0;
+		mStreamOuts = 0;
+		mStreamedBytes = 0;
+	}
+}
+
+void VulkanTextureStreamer::Record(uint32_t id)
+{
+	Texture& texture = mTextures[id];
+	texture.queued = false;
+	// the budget may have moved the texture back while it waited
+	if (texture.wantedLevel == texture.current.level)
+	{
+		return;
+	}
+	bool streamIn = texture.wantedLevel < texture.current.level;
+	if (!Upload(texture, texture.wantedLevel, texture.pending))
+	{
+		// out of video memory, keep what is resident and try again next frame
+		return;
+	}
+	mPending = true;
+	if (streamIn)
+	{
+		mStreamIns++;
+	}
+	else
+	{
+		mStreamOuts++;
+	}
+}
+
+void VulkanTextureStreamer::PrintStats() const
+{
+	std::cout << "Texture streamer: " << mTextures.size() << " textures, " << mResidentBytes / 1024 << " KB resident of a "
+		<< mBudget / 1024 << " KB budget, " << mStreamIns << " in, " << mStreamOuts << " out, " << mStreamedBytes / 1024 << " KB streamed" << std::endl;
+	for (const auto& texture : mTextures)
+	{
+		std::cout << "\t" << texture.source.path << ": levels " << texture.current.level << ".." << texture.source.mipLevels - 1
+			<< " resident, " << texture.requestedLevel << " requested" << (texture.streamable ? "" : " (not streamed)") << std::endl;
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "MemoryAllocator.h"
+#include "TransferUploader.h"
+#include "UploadScheduler.h"
+#include "TextureCache.h"
+#include "MipChain.h"
+
+// A texture read, decoded, mipped and compressed on a worker thread, waiting for its upload
+struct LoadedTexture
+{
+	std::string path;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t mipLevels = 0;
+	bool generateMips = false;// only level 0 is staged, the rest is blitted on the gpu
+	std::vector<MipLevelLayout> levels;// what is staged
+	VkDeviceSize size = 0;
+	std::vector<unsigned char> texels;// cooked by the worker...
+	CookedTexture cooked;// ...or mapped from the texture cache...
+	StagingRegion staging;// ...or cooked into staging memory on the main thread, for UploadTexture only
+	bool cacheHit = false;
+	bool loaded = false;
+	float cookTime = 0.f;// ms, on the worker
+
+	const unsigned char* GetTexels() const { return cacheHit ? cooked.pData : texels.data(); }
+};
+
+// Keeps only the mip levels a texture needs on screen in video memory. Every texture starts with
+// its small levels resident; the renderer reports how big each one is on screen, and Update() moves
+// textures toward the level that asks for, within a memory budget and the upload scheduler's per frame limit.
+// Without sparse residency a level can only be given back by dropping the image, so a texture's image
+// holds exactly its resident levels and is recreated, from the cpu side chain, when that changes.
+class VulkanTextureStreamer
+{
+public:
+	VulkanTextureStreamer() = default;
+	~VulkanTextureStreamer() = default;
+
+	// minResidentSize: levels no bigger than this on either side are always resident
+	void Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader, VulkanUploadScheduler* pScheduler,
+		uint32_t frameCount, VkDeviceSize budget, uint32_t minResidentSize = 64);
+	void Destroy();
+
+	// Keeps the cooked chain as the source of later stream ins and uploads its resident levels.
+	// A chain that is blitted on the gpu has no cpu side levels, all of it is uploaded and never streamed.
+	uint32_t Add(LoadedTexture&& texture);
+
+	// screenSize is the texture's larger side in pixels on screen this frame
+	void RequestLevel(uint32_t id, float screenSize);
+
+	// After the frame fence: images retired frameCount frames ago are destroyed, and images the scheduler
+	// uploaded last frame become current. Returns true when a view changed and descriptors need rewriting.
+	bool BeginFrame();
+	// Once per frame after the graphics submit, before the scheduler's Update(): fits the requested levels
+	// into the budget and queues the uploads that change residency on the scheduler
+	void Update();
+
+	VkImageView GetImageView(uint32_t id) const { return mTextures[id].current.pView; }
+	// first level of the full chain that is resident
+	uint32_t GetResidentLevel(uint32_t id) const { return mTextures[id].current.level; }
+	uint32_t GetMipLevels(uint32_t id) const { return mTextures[id].source.mipLevels; }
+	VkDeviceSize GetResidentBytes() const { return mResidentBytes; }
+	void PrintStats() const;
+
+private:
+	struct Residency
+	{
+		VkImage pImage = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView pView = VK_NULL_HANDLE;
+		uint32_t level = 0;
+		VkDeviceSize bytes = 0;// of the allocation
+	};
+
+	struct Texture
+	{
+		LoadedTexture source;
+		bool streamable = false;
+		uint32_t tailLevel = 0;// first level that is always resident
+		uint32_t requestedLevel = 0;
+		uint32_t wantedLevel = 0;// requestedLevel after the budget
+		Residency current;
+		Residency pending;// uploaded, current from the next BeginFrame()
+		bool queued = false;// waiting in the scheduler
+	};
+
+	struct Retired
+	{
+		Residency residency;
+		uint64_t frame;// destroyed once BeginFrame() reaches it
+	};
+
+	bool Upload(Texture& texture, uint32_t level, Residency& residency);
+	// the scheduler's turn for a queued texture
+	void Record(uint32_t id);
+	void Release(Residency& residency);
+	VkDeviceSize GetChainBytes(const Texture& texture, uint32_t level) const;
+
+private:
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	VulkanMemoryAllocator* m_pAllocator = nullptr;
+	VulkanTransferUploader* m_pUploader = nullptr;
+	VulkanUploadScheduler* m_pScheduler = nullptr;
+	uint32_t mFrameCount = 0;
+	VkDeviceSize mBudget = 0;
+	uint32_t mMinResidentSize = 0;
+
+	std::vector<Texture> mTextures;
+	std::vector<Retired> mRetired;
+	uint64_t mFrame = 0;
+	bool mPending = false;
+	VkDeviceSize mResidentBytes = 0;// current and pending images
+
+	// traffic report, once a second while there is traffic
+	std::chrono::high_resolution_clock::time_point mReportTime;
+	uint32_t mStreamIns = 0;
+	uint32_t mStreamOuts = 0;
+	VkDeviceSize mStreamedBytes = 0;
+};
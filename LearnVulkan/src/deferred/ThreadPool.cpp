@@ -0,0 +1,123 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+void ThreadPool::Init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+	}
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+	mStopping = false;
+	mWorkers.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		mWorkers.emplace_back(&ThreadPool::WorkerMain, this);
+	}
+}
+
+void ThreadPool::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mCondition.notify_all();
+	for (auto& worker : mWorkers)
+	{
+		worker.join();
+	}
+	mWorkers.clear();
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task)
+{
+	std::packaged_task<void()> packaged(std::move(task));
+	std::future<void> future = packaged.get_future();
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(std::move(packaged));
+	}
+	mCondition.notify_one();
+	return future;
+}
+
+void ThreadPool::ParallelFor(int count, uint32_t maxThreads, const std::function<void(int)>& task)
+{
+	// shared with the helpers, which may outlive the call when they start late
+	struct Loop
+	{
+		std::atomic<int> next{ 0 };
+		int count = 0;
+		const std::function<void(int)>* pTask = nullptr;
+		int finished = 0;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	auto pLoop = std::make_shared<Loop>();
+	pLoop->count = count;
+	pLoop->pTask = &task;
+	auto run = [](Loop& loop)
+	{
+		int ran = 0;
+		for (int i = loop.next++; i < loop.count; i = loop.next++)
+		{
+			(*loop.pTask)(i);
+			ran++;
+		}
+		if (ran > 0)
+		{
+			std::lock_guard<std::mutex> lock(loop.mutex);
+			loop.finished += ran;
+			if (loop.finished == loop.count)
+			{
+				loop.done.notify_one();
+			}
+		}
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		uint32_t helpers = mIdleCount > mTasks.size() ? mIdleCount - (uint32_t)mTasks.size() : 0;
+		helpers = std::min(helpers, (uint32_t)std::max(count - 1, 0));
+		if (maxThreads > 0)
+		{
+			helpers = std::min(helpers, maxThreads - 1);
+		}
+		for (uint32_t i = 0; i < helpers; i++)
+		{
+			mTasks.emplace_back([pLoop, run]() { run(*pLoop); });
+		}
+		if (helpers > 0)
+		{
+			mCondition.notify_all();
+		}
+	}
+	run(*pLoop);
+	std::unique_lock<std::mutex> lock(pLoop->mutex);
+	pLoop->done.wait(lock, [&]() { return pLoop->finished == pLoop->count; });
+}
+
+void ThreadPool::WorkerMain()
+{
+	for (;;)
+	{
+		std::packaged_task<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mIdleCount++;
+			mCondition.wait(lock, [this]() { return mStopping || !mTasks.empty(); });
+			mIdleCount--;
+			if (mTasks.empty())
+			{
+				return;// stopping and drained
+			}
+			task = std::move(mTasks.front());
+			mTasks.pop_front();
+		}
+		task();
+	}
+}
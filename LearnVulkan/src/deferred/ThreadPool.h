@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <memory>
+
+// Fixed set of worker threads draining one FIFO of tasks. For cpu work that doesn't touch Vulkan
+// (file reads, decoding, mip filtering); command recording stays on the thread that owns the queue.
+class ThreadPool
+{
+public:
+	ThreadPool() = default;
+	~ThreadPool() = default;
+
+	// 0 uses every hardware thread
+	void Init(uint32_t threadCount = 0);
+	// Finishes the queued tasks, then joins the workers
+	void Destroy();
+
+	std::future<void> Submit(std::function<void()> task);
+	// Runs task(0) to task(count - 1) on the calling thread and the workers idle right now, at most maxThreads
+	// threads in all (0: no limit), and returns once every index has run. Callable from a worker: helpers that
+	// only get a thread after the indices ran out return without doing anything, so nothing waits on the queue.
+	void ParallelFor(int count, uint32_t maxThreads, const std::function<void(int)>& task);
+
+	uint32_t GetThreadCount() const { return (uint32_t)mWorkers.size(); }
+
+private:
+	void WorkerMain();
+
+private:
+	std::vector<std::thread> mWorkers;
+	std::deque<std::packaged_task<void()>> mTasks;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mStopping = false;
+	uint32_t mIdleCount = 0;// workers waiting for a task
+};
@@ -0,0 +1,657 @@
+#include "TransferUploader.h"
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <cassert>
+
+void VulkanTransferUploader::Init(VkDevice pDevice, uint32_t transferFamily, VkQueue pTransferQueue, uint32_t graphicsFamily,
+	uint32_t frameCount, VulkanMemoryAllocator* pAllocator, VkDeviceSize stagingSize)
+{
+	m_pDevice = pDevice;
+	mTransferFamily = transferFamily;
+	m_pTransferQueue = pTransferQueue;
+	mGraphicsFamily = graphicsFamily;
+	m_pAllocator = pAllocator;
+	mFrameAcquires.resize(frameCount);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = mTransferFamily;
+	if (vkCreateCommandPool(m_pDevice, &poolInfo, nullptr, &m_pTransferPool) != VK_SUCCESS)
+	{
+		std::cerr << "Transfer VkCommandPool create failed" << std::endl;
+	}
+	if (IsDedicatedQueue())
+	{
+		poolInfo.queueFamilyIndex = mGraphicsFamily;
+		if (vkCreateCommandPool(m_pDevice, &poolInfo, nullptr, &m_pGraphicsPool) != VK_SUCCESS)
+		{
+			std::cerr << "Acquire VkCommandPool create failed" << std::endl;
+		}
+	}
+
+	VkSemaphoreTypeCreateInfo typeInfo = {};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if (vkCreateSemaphore(m_pDevice, &semaphoreInfo, nullptr, &m_pTimeline) != VK_SUCCESS)
+	{
+		std::cerr << "Timeline VkSemaphore create failed" << std::endl;
+	}
+
+	CreateStagingBuffer(stagingSize, m_pStagingBuffer, mStagingMemory);
+	mStagingRing.Init(m_pStagingBuffer, mStagingMemory.pMapped, stagingSize);
+
+	std::cout << "Transfer uploader on queue family " << mTransferFamily
+		<< (IsDedicatedQueue() ? " (dedicated)" : " (shared with graphics)") << std::endl;
+}
+
+void VulkanTransferUploader::Destroy()
+{
+	assert(m_pRecording == VK_NULL_HANDLE);
+	WaitIdle();
+
+	// the caller has waited for the graphics queue, so the acquire command buffers are done as well
+	for (uint32_t i = 0; i < mFrameAcquires.size(); i++)
+	{
+		BeginFrame(i);
+	}
+
+	vkDestroyBuffer(m_pDevice, m_pStagingBuffer, nullptr);
+	m_pAllocator->Free(mStagingMemory);
+	vkDestroySemaphore(m_pDevice, m_pTimeline, nullptr);
+	vkDestroyCommandPool(m_pDevice, m_pTransferPool, nullptr);
+	if (m_pGraphicsPool)
+	{
+		vkDestroyCommandPool(m_pDevice, m_pGraphicsPool, nullptr);
+	}
+}
+
+void VulkanTransferUploader::WaitIdle()
+{
+	Wait(mNextValue - 1);
+}
+
+void VulkanTransferUploader::Wait(uint64_t value)
+{
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_pTimeline;
+	waitInfo.pValues = &value;
+	vkWaitSemaphores(m_pDevice, &waitInfo, UINT64_MAX);
+	Collect();
+}
+
+void VulkanTransferUploader::BeginFrame(uint32_t frameIndex)
+{
+	mFrameIndex = frameIndex;
+	auto& acquires = mFrameAcquires[frameIndex];
+	if (!acquires.empty())
+	{
+		vkFreeCommandBuffers(m_pDevice, m_pGraphicsPool, (uint32_t)acquires.size(), acquires.data());
+		acquires.clear();
+	}
+
+	Collect();
+}
+
+void VulkanTransferUploader::Collect()
+{
+	if (mInFlight.empty())
+	{
+		return;
+	}
+	uint64_t completed = GetCompletedValue();
+	auto it = mInFlight.begin();
+	for (; it != mInFlight.end() && it->value <= completed; ++it)
+	{
+		vkFreeCommandBuffers(m_pDevice, m_pTransferPool, 1, &it->pCommandBuffer);
+		for (auto& staging : it->stagingBuffers)
+		{
+			vkDestroyBuffer(m_pDevice, staging.pBuffer, nullptr);
+			m_pAllocator->Free(staging.memory);
+		}
+	}
+	mInFlight.erase(mInFlight.begin(), it);
+	mStagingRing.Reclaim(completed);
+}
+
+uint64_t VulkanTransferUploader::GetCompletedValue() const
+{
+	uint64_t value = 0;
+	vkGetSemaphoreCounterValue(m_pDevice, m_pTimeline, &value);
+	return value;
+}
+
+void VulkanTransferUploader::BeginRecording()
+{
+	if (m_pRecording)
+	{
+		return;
+	}
+
+	VkCommandBufferAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	info.commandBufferCount = 1;
+	info.commandPool = m_pTransferPool;
+	vkAllocateCommandBuffers(m_pDevice, &info, &m_pRecording);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(m_pRecording, &beginInfo);
+}
+
+void VulkanTransferUploader::CreateStagingBuffer(VkDeviceSize size, VkBuffer& pBuffer, MemoryAllocation& memory)
+{
+	VkBufferCreateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	info.size = size;
+	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	vkCreateBuffer(m_pDevice, &info, nullptr, &pBuffer);
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_pDevice, pBuffer, &requirements);
+	uint32_t memoryType = 0;
+	if (!m_pAllocator->FindMemoryType(requirements.memoryTypeBits, m_pAllocator->GetPolicy(MemoryUsage::Staging), memoryType)
+		|| !m_pAllocator->Allocate(requirements, memoryType, AllocationType::Buffer, memory))
+	{
+		assert(0);
+	}
+	vkBindBufferMemory(m_pDevice, pBuffer, memory.pMemory, memory.offset);
+}
+
+StagingRegion VulkanTransferUploader::AllocateStaging(VkDeviceSize size)
+{
+	StagingRegion region;
+	if (size > mStagingRing.GetSize())
+	{
+		// too big for the ring, a one off buffer that is released with the batch
+		StagingBuffer staging;
+		CreateStagingBuffer(size, staging.pBuffer, staging.memory);
+		mRecordingStaging.push_back(staging);
+		region.pBuffer = staging.pBuffer;
+		region.pData = staging.memory.pMapped;
+	}
+	else
+	{
+		// the region is read by the submission Flush() makes next, which signals mNextValue
+		while (!mStagingRing.Allocate(size, 16, mNextValue, region))
+		{
+			if (mInFlight.empty())
+			{
+				// the ring is full of the current recording
+				Flush();
+				if (mInFlight.empty())
+				{
+					// nothing was recorded either, so no submission reads the ring: it only holds regions that
+					// were allocated and never recorded
+					mStagingRing.Reset();
+					continue;
+				}
+			}
+			Wait(mInFlight.front().value);
+		}
+	}
+	return region;
+}
+
+void VulkanTransferUploader::ReleaseStaging(const StagingRegion& staging)
+{
+	if (staging.pBuffer != m_pStagingBuffer)
+	{
+		// a one off buffer, still the last one of the recording
+		assert(!mRecordingStaging.empty() && mRecordingStaging.back().pBuffer == staging.pBuffer);
+		vkDestroyBuffer(m_pDevice, mRecordingStaging.back().pBuffer, nullptr);
+		m_pAllocator->Free(mRecordingStaging.back().memory);
+		mRecordingStaging.pop_back();
+		return;
+	}
+	mStagingRing.Release(staging);
+}
+
+void VulkanTransferUploader::UploadBuffer(VkBuffer pBuffer, const void* pData, VkDeviceSize size,
+	VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+	// may flush the current recording, so staging comes first
+	StagingRegion staging = AllocateStaging(size);
+	memcpy(staging.pData, pData, size);
+	BeginRecording();
+
+	VkBufferCopy region = {};
+	region.srcOffset = staging.offset;
+	region.size = size;
+	vkCmdCopyBuffer(m_pRecording, staging.pBuffer, pBuffer, 1, &region);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = IsDedicatedQueue() ? mTransferFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = IsDedicatedQueue() ? mGraphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = pBuffer;
+	barrier.offset = 0;
+	barrier.size = size;
+	if (IsDedicatedQueue())
+	{
+		// release half, dst access and stage are ignored here and given by the acquire
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dstAccess;
+		mRecordingBufferAcquires.push_back(barrier);
+	}
+	else
+	{
+		barrier.dstAccessMask = dstAccess;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	}
+	mRecordingStages |= dstStage;
+}
+
+void VulkanTransferUploader::UploadImage(VkImage pImage, const void* pData, VkDeviceSize size, uint32_t width, uint32_t height,
+	VkPipelineStageFlags dstStage)
+{
+	StagingRegion staging = AllocateStaging(size);
+	memcpy(staging.pData, pData, size);
+	UploadImage(pImage, staging, width, height, 0, dstStage);
+}
+
+void VulkanTransferUploader::UploadImage(VkImage pImage, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t rowLength,
+	VkPipelineStageFlags dstStage)
+{
+	VkBufferImageCopy region = {};
+	region.bufferRowLength = rowLength;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = width;
+	region.imageExtent.height = height;
+	region.imageExtent.depth = 1;
+	UploadImageLevels(pImage, staging, &region, 1, dstStage);
+}
+
+void VulkanTransferUploader::RecordImageCopy(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pLevels,
+	uint32_t copyCount, uint32_t levelCount, uint32_t layerCount)
+{
+	// contents are undefined before the first copy, so no ownership is needed for this transition
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = pImage;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	std::vector<VkBufferImageCopy> regions(pLevels, pLevels + copyCount);
+	for (auto& region : regions)
+	{
+		region.bufferOffset += staging.offset;
+	}
+	vkCmdCopyBufferToImage(m_pRecording, staging.pBuffer, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)regions.size(), regions.data());
+}
+
+void VulkanTransferUploader::UploadImageLevels(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pLevels, uint32_t levelCount,
+	VkPipelineStageFlags dstStage)
+{
+	UploadImageLayers(pImage, staging, pLevels, levelCount, levelCount, 1, dstStage);
+}
+
+void VulkanTransferUploader::UploadImageLayers(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pCopies, uint32_t copyCount,
+	uint32_t levelCount, uint32_t layerCount, VkPipelineStageFlags dstStage)
+{
+	BeginRecording();
+	RecordImageCopy(pImage, staging, pCopies, copyCount, levelCount, layerCount);
+	RecordImageRelease(pImage, levelCount, layerCount, dstStage);
+}
+
+void VulkanTransferUploader::RecordImageRelease(VkImage pImage, uint32_t levelCount, uint32_t layerCount, VkPipelineStageFlags dstStage)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = pImage;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	if (IsDedicatedQueue())
+	{
+		// release half: the layout transition happens once, between release and acquire
+		barrier.srcQueueFamilyIndex = mTransferFamily;
+		barrier.dstQueueFamilyIndex = mGraphicsFamily;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		mRecordingImageAcquires.push_back(barrier);
+	}
+	else
+	{
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	mRecordingStages |= dstStage;
+}
+
+void VulkanTransferUploader::UpdateImageRegions(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pRegions,
+	uint32_t regionCount, uint32_t levelCount, VkImageLayout oldLayout, VkPipelineStageFlags dstStage)
+{
+	BeginRecording();
+
+	// concurrent sharing: plain layout transitions on whichever queue records them
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = pImage;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = levelCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	std::vector<VkBufferImageCopy> regions(pRegions, pRegions + regionCount);
+	for (auto& region : regions)
+	{
+		region.bufferOffset += staging.offset;
+	}
+	vkCmdCopyBufferToImage(m_pRecording, staging.pBuffer, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regionCount, regions.data());
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	if (IsDedicatedQueue())
+	{
+		// the transfer queue has no shader stages, the graphics submit's timeline wait makes the writes visible
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	else
+	{
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	mRecordingStages |= dstStage;
+}
+
+void VulkanTransferUploader::UploadImageGenerateMips(VkImage pImage, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t rowLength,
+	uint32_t mipLevels, VkPipelineStageFlags dstStage)
+{
+	BeginRecording();
+
+	VkBufferImageCopy region = {};
+	region.bufferRowLength = rowLength;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = width;
+	region.imageExtent.height = height;
+	region.imageExtent.depth = 1;
+	RecordImageCopy(pImage, staging, &region, 1, mipLevels);
+	RecordMipRelease({ pImage, width, height, mipLevels, dstStage });
+}
+
+void VulkanTransferUploader::UploadImageRows(VkImage pImage, const void* pRows, size_t rowPitch, uint32_t width, uint32_t height,
+	uint32_t firstRow, uint32_t rowCount, uint32_t mipLevels, VkPipelineStageFlags dstStage)
+{
+	// staged tightly packed, the decoder's pitch may be wider
+	size_t bandPitch = (size_t)width * 4;
+	StagingRegion staging = AllocateStaging((VkDeviceSize)bandPitch * rowCount);
+	for (uint32_t row = 0; row < rowCount; row++)
+	{
+		memcpy((unsigned char*)staging.pData + bandPitch * row, (const unsigned char*)pRows + rowPitch * row, bandPitch);
+	}
+	BeginRecording();
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, (int32_t)firstRow, 0 };
+	region.imageExtent = { width, rowCount, 1 };
+	if (firstRow == 0)
+	{
+		RecordImageCopy(pImage, staging, &region, 1, mipLevels);
+	}
+	else
+	{
+		// still in TRANSFER_DST from the first band, and bands don't overlap
+		region.bufferOffset = staging.offset;
+		vkCmdCopyBufferToImage(m_pRecording, staging.pBuffer, pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	}
+
+	if (firstRow + rowCount == height)
+	{
+		if (mipLevels > 1)
+		{
+			RecordMipRelease({ pImage, width, height, mipLevels, dstStage });
+		}
+		else
+		{
+			RecordImageRelease(pImage, 1, 1, dstStage);
+		}
+	}
+}
+
+void VulkanTransferUploader::RecordMipRelease(const MipJob& job)
+{
+	if (IsDedicatedQueue())
+	{
+		// transfer-only queues can't blit: hand every level over in TRANSFER_DST, the acquire side blits
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = job.pImage;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = mTransferFamily;
+		barrier.dstQueueFamilyIndex = mGraphicsFamily;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = job.mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		vkCmdPipelineBarrier(m_pRecording, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		mRecordingImageAcquires.push_back(barrier);
+		mRecordingMips.push_back(job);
+		// the blits read level 0 as soon as the wait is over
+		mRecordingStages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	else
+	{
+		// shared with graphics, so this queue can blit
+		RecordMipBlits(m_pRecording, job);
+		mRecordingStages |= job.dstStage;
+	}
+}
+
+void VulkanTransferUploader::RecordMipBlits(VkCommandBuffer pCommandBuffer, const MipJob& job)
+{
+	// every level starts in TRANSFER_DST with level 0 written, each level is read once and then handed to the shaders
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = job.pImage;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+
+	int32_t w = (int32_t)job.width;
+	int32_t h = (int32_t)job.height;
+	for (uint32_t i = 1; i < job.mipLevels; i++)
+	{
+		barrier.subresourceRange.baseMipLevel = i - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(pCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkImageBlit blit = {};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { w, h, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { w > 1 ? w / 2 : 1, h > 1 ? h / 2 : 1, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		vkCmdBlitImage(pCommandBuffer, job.pImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			job.pImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(pCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, job.dstStage, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		if (w > 1)
+		{
+			w /= 2;
+		}
+		if (h > 1)
+		{
+			h /= 2;
+		}
+	}
+	barrier.subresourceRange.baseMipLevel = job.mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(pCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, job.dstStage, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+uint64_t VulkanTransferUploader::Flush()
+{
+	if (!m_pRecording)
+	{
+		return mNextValue - 1;
+	}
+	vkEndCommandBuffer(m_pRecording);
+
+	Batch batch;
+	batch.value = mNextValue++;
+	batch.pCommandBuffer = m_pRecording;
+	batch.stagingBuffers.swap(mRecordingStaging);
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.pCommandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_pTimeline;
+	if (vkQueueSubmit(m_pTransferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+	{
+		std::cerr << "TransferQueue submit failed" << std::endl;
+	}
+
+	mBufferAcquires.insert(mBufferAcquires.end(), mRecordingBufferAcquires.begin(), mRecordingBufferAcquires.end());
+	mImageAcquires.insert(mImageAcquires.end(), mRecordingImageAcquires.begin(), mRecordingImageAcquires.end());
+	mMips.insert(mMips.end(), mRecordingMips.begin(), mRecordingMips.end());
+	mAcquireStages |= mRecordingStages;
+	mRecordingBufferAcquires.clear();
+	mRecordingImageAcquires.clear();
+	mRecordingMips.clear();
+	mRecordingStages = 0;
+	mPendingWaitValue = batch.value;
+
+	m_pRecording = VK_NULL_HANDLE;
+	mInFlight.push_back(std::move(batch));
+	return mPendingWaitValue;
+}
+
+void VulkanTransferUploader::TakeAcquire(VkCommandBuffer& pCommandBuffer, uint64_t& waitValue, VkPipelineStageFlags& waitStage)
+{
+	pCommandBuffer = VK_NULL_HANDLE;
+	waitValue = mPendingWaitValue;
+	waitStage = mAcquireStages;
+	mPendingWaitValue = 0;
+	mAcquireStages = 0;
+
+	if (mBufferAcquires.empty() && mImageAcquires.empty())
+	{
+		return;
+	}
+
+	VkCommandBufferAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	info.commandBufferCount = 1;
+	info.commandPool = m_pGraphicsPool;
+	vkAllocateCommandBuffers(m_pDevice, &info, &pCommandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(pCommandBuffer, &beginInfo);
+	// the source scope chains with the timeline wait, which uses the same stages
+	vkCmdPipelineBarrier(pCommandBuffer, waitStage, waitStage, 0, 0, nullptr,
+		(uint32_t)mBufferAcquires.size(), mBufferAcquires.data(),
+		(uint32_t)mImageAcquires.size(), mImageAcquires.data());
+	for (const auto& job : mMips)
+	{
+		RecordMipBlits(pCommandBuffer, job);
+	}
+	vkEndCommandBuffer(pCommandBuffer);
+
+	mBufferAcquires.clear();
+	mImageAcquires.clear();
+	mMips.clear();
+	mFrameAcquires[mFrameIndex].push_back(pCommandBuffer);
+}
+
+void VulkanTransferUploader::ForgetImage(VkImage pImage)
+{
+	assert(std::none_of(mRecordingImageAcquires.begin(), mRecordingImageAcquires.end(),
+		[pImage](const VkImageMemoryBarrier& barrier) { return barrier.image == pImage; }));
+	mImageAcquires.erase(std::remove_if(mImageAcquires.begin(), mImageAcquires.end(),
+		[pImage](const VkImageMemoryBarrier& barrier) { return barrier.image == pImage; }), mImageAcquires.end());
+	mMips.erase(std::remove_if(mMips.begin(), mMips.end(),
+		[pImage](const MipJob& job) { return job.pImage == pImage; }), mMips.end());
+}
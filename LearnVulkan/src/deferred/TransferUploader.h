@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
+
+// Uploads buffers and images on the transfer queue, off the graphics queue. Data is staged in a
+// persistent ring that is recycled by timeline value; only uploads bigger than the ring get a buffer of their own.
+// Recorded uploads go out with Flush(), which signals a timeline semaphore. When the transfer family
+// differs from the graphics family, resources are released on the transfer queue and acquired by
+// a small command buffer that TakeAcquire() hands to the next graphics submit together with the
+// timeline value that submit has to wait for.
+class VulkanTransferUploader
+{
+public:
+	VulkanTransferUploader() = default;
+	~VulkanTransferUploader() = default;
+
+	void Init(VkDevice pDevice, uint32_t transferFamily, VkQueue pTransferQueue, uint32_t graphicsFamily,
+		uint32_t frameCount, VulkanMemoryAllocator* pAllocator, VkDeviceSize stagingSize = 32ull * 1024 * 1024);
+	void Destroy();
+
+	// Recycles what the gpu is done with: staging memory of finished batches, and the acquire
+	// command buffers of frameIndex, whose fence has signaled
+	void BeginFrame(uint32_t frameIndex);
+
+	// The data is copied into staging memory right away, pData can be released on return.
+	// Blocks on the oldest upload in flight while the staging ring is full.
+	void UploadBuffer(VkBuffer pBuffer, const void* pData, VkDeviceSize size,
+		VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+	// Leaves the image in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	void UploadImage(VkImage pImage, const void* pData, VkDeviceSize size, uint32_t width, uint32_t height,
+		VkPipelineStageFlags dstStage);
+
+	// For producers that write straight into staging memory (image decoders): fill the region,
+	// then record it with the overload below before calling into the uploader again.
+	StagingRegion AllocateStaging(VkDeviceSize size);
+	// Returns the region AllocateStaging() just gave out when the producer fails before recording it
+	void ReleaseStaging(const StagingRegion& staging);
+	// rowLength is the staging row pitch in texels, 0 for tightly packed rows
+	void UploadImage(VkImage pImage, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t rowLength,
+		VkPipelineStageFlags dstStage);
+	// One copy per level in pLevels, bufferOffset relative to the start of staging. Covers levels [0, levelCount).
+	void UploadImageLevels(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pLevels, uint32_t levelCount,
+		VkPipelineStageFlags dstStage);
+	// Same for array images: copyCount copies covering levels [0, levelCount) of layers [0, layerCount)
+	void UploadImageLayers(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pCopies, uint32_t copyCount,
+		uint32_t levelCount, uint32_t layerCount, VkPipelineStageFlags dstStage);
+	// Copies level 0 and fills levels 1..mipLevels-1 with linear blits. The image needs TRANSFER_SRC usage and a
+	// format with blit and linear filter support. With a dedicated transfer queue the blits are recorded
+	// after the acquire, on the graphics queue.
+	void UploadImageGenerateMips(VkImage pImage, const StagingRegion& staging, uint32_t width, uint32_t height, uint32_t rowLength,
+		uint32_t mipLevels, VkPipelineStageFlags dstStage);
+	// Level 0 of an RGBA8 image in bands of rows, for decoders that hand rows out as they finish them: one call per
+	// band, top to bottom, pRows rowPitch bytes apart. The first band moves every level out of UNDEFINED, the band
+	// that reaches height finishes like UploadImage, or like UploadImageGenerateMips when mipLevels > 1. Flush()
+	// between bands so each copy runs while the next band is still decoding.
+	void UploadImageRows(VkImage pImage, const void* pRows, size_t rowPitch, uint32_t width, uint32_t height,
+		uint32_t firstRow, uint32_t rowCount, uint32_t mipLevels, VkPipelineStageFlags dstStage);
+	// Rewrites pRegions of an image that stays in use, the texels outside them are kept. The image must be created
+	// VK_SHARING_MODE_CONCURRENT over GetQueueFamilies() when the queue is dedicated, so no ownership moves, and the
+	// caller makes sure the gpu no longer reads it. oldLayout is VK_IMAGE_LAYOUT_UNDEFINED for the first write,
+	// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL after that.
+	void UpdateImageRegions(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pRegions, uint32_t regionCount,
+		uint32_t levelCount, VkImageLayout oldLayout, VkPipelineStageFlags dstStage);
+
+	// Submits everything recorded so far, returns the timeline value signaled on completion
+	uint64_t Flush();
+
+	// What the next graphics submit needs before it may use anything flushed so far: the acquire
+	// command buffer to run first (VK_NULL_HANDLE when the queue is shared) and the timeline value to
+	// wait for at waitStage. waitValue is 0 when nothing was flushed since the last call.
+	void TakeAcquire(VkCommandBuffer& pCommandBuffer, uint64_t& waitValue, VkPipelineStageFlags& waitStage);
+	// Drops the acquire barriers and mip blits still queued for pImage, so it can be destroyed before the next
+	// TakeAcquire(). Every upload to pImage must have been flushed and completed, see WaitIdle().
+	void ForgetImage(VkImage pImage);
+
+	// Blocks until value (or everything flushed so far) has completed on the transfer queue
+	void Wait(uint64_t value);
+	void WaitIdle();
+
+	VkSemaphore GetTimelineSemaphore() const { return m_pTimeline; }
+	uint64_t GetCompletedValue() const;
+	bool IsDedicatedQueue() const { return mTransferFamily != mGraphicsFamily; }
+	// transfer family first, then graphics; the same index twice when the queue is shared
+	void GetQueueFamilies(uint32_t families[2]) const { families[0] = mTransferFamily; families[1] = mGraphicsFamily; }
+
+private:
+	void BeginRecording();
+	void Collect();
+	void CreateStagingBuffer(VkDeviceSize size, VkBuffer& pBuffer, MemoryAllocation& memory);
+	void RecordImageCopy(VkImage pImage, const StagingRegion& staging, const VkBufferImageCopy* pLevels, uint32_t copyCount,
+		uint32_t levelCount, uint32_t layerCount = 1);
+	void RecordImageRelease(VkImage pImage, uint32_t levelCount, uint32_t layerCount, VkPipelineStageFlags dstStage);
+
+private:
+	struct MipJob
+	{
+		VkImage pImage;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		VkPipelineStageFlags dstStage;
+	};
+
+	void RecordMipRelease(const MipJob& job);
+	static void RecordMipBlits(VkCommandBuffer pCommandBuffer, const MipJob& job);
+
+	struct StagingBuffer
+	{
+		VkBuffer pBuffer;
+		MemoryAllocation memory;
+	};
+
+	struct Batch
+	{
+		uint64_t value;
+		VkCommandBuffer pCommandBuffer;
+		std::vector<StagingBuffer> stagingBuffers;
+	};
+
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	VkQueue m_pTransferQueue = VK_NULL_HANDLE;
+	uint32_t mTransferFamily = 0;
+	uint32_t mGraphicsFamily = 0;
+	VulkanMemoryAllocator* m_pAllocator = nullptr;
+
+	VkCommandPool m_pTransferPool = VK_NULL_HANDLE;
+	VkCommandPool m_pGraphicsPool = VK_NULL_HANDLE;// acquire side of the ownership transfers
+	VkSemaphore m_pTimeline = VK_NULL_HANDLE;
+	VkBuffer m_pStagingBuffer = VK_NULL_HANDLE;
+	MemoryAllocation mStagingMemory;
+	VulkanStagingRing mStagingRing;
+	uint64_t mNextValue = 1;
+	uint64_t mPendingWaitValue = 0;
+
+	// recording state
+	VkCommandBuffer m_pRecording = VK_NULL_HANDLE;
+	std::vector<StagingBuffer> mRecordingStaging;
+	std::vector<VkBufferMemoryBarrier> mRecordingBufferAcquires;
+	std::vector<VkImageMemoryBarrier> mRecordingImageAcquires;
+	std::vector<MipJob> mRecordingMips;
+	VkPipelineStageFlags mRecordingStages = 0;
+
+	// flushed, not yet handed to the graphics queue
+	std::vector<VkBufferMemoryBarrier> mBufferAcquires;
+	std::vector<VkImageMemoryBarrier> mImageAcquires;
+	std::vector<MipJob> mMips;// blitted right after the acquire
+	VkPipelineStageFlags mAcquireStages = 0;
+
+	std::vector<Batch> mInFlight;
+	std::vector<std::vector<VkCommandBuffer>> mFrameAcquires;// per frame in flight
+	uint32_t mFrameIndex = 0;
+};
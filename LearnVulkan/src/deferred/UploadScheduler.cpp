@@ -0,0 +1,96 @@
+#include "UploadScheduler.h"
+#include <algorithm>
+#include <iostream>
+
+void VulkanUploadScheduler::Init(VulkanTransferUploader* pUploader, VkDeviceSize bytesPerFrame)
+{
+	m_pUploader = pUploader;
+	mBytesPerFrame = bytesPerFrame;
+	mReportTime = std::chrono::high_resolution_clock::now();
+}
+
+bool VulkanUploadScheduler::Compare(const Item& a, const Item& b)
+{
+	// std heaps keep the largest on top: higher priority, then the older request
+	if (a.priority != b.priority)
+	{
+		return a.priority < b.priority;
+	}
+	return a.sequence > b.sequence;
+}
+
+void VulkanUploadScheduler::Push(Item&& item)
+{
+	item.sequence = mNextSequence++;
+	mQueuedBytes += item.size;
+	mQueue.push_back(std::move(item));
+	std::push_heap(mQueue.begin(), mQueue.end(), Compare);
+}
+
+void VulkanUploadScheduler::Enqueue(VkDeviceSize size, RecordCallback record, int priority, SubmitCallback onSubmitted)
+{
+	Item item = {};
+	item.priority = priority;
+	item.size = size;
+	item.record = std::move(record);
+	item.onSubmitted = std::move(onSubmitted);
+	Push(std::move(item));
+}
+
+void VulkanUploadScheduler::Update()
+{
+	VkDeviceSize budget = mBytesPerFrame;
+	VkDeviceSize drained = 0;
+	std::vector<SubmitCallback> callbacks;
+	while (!mQueue.empty())
+	{
+		const Item& top = mQueue.front();
+		VkDeviceSize size = top.size;
+		// stop at the first item that does not fit, smaller ones behind it must not overtake it forever
+		if (drained > 0 && drained + size > budget)
+		{
+			break;
+		}
+
+		std::pop_heap(mQueue.begin(), mQueue.end(), Compare);
+		Item item = std::move(mQueue.back());
+		mQueue.pop_back();
+		mQueuedBytes -= size;
+		drained += size;
+
+		item.record();
+		if (item.onSubmitted)
+		{
+			callbacks.push_back(std::move(item.onSubmitted));
+		}
+	}
+
+	if (drained > 0)
+	{
+		uint64_t value = m_pUploader->Flush();
+		for (auto& callback : callbacks)
+		{
+			callback(value);
+		}
+		mFlushed.push_back({ value, drained });
+	}
+
+	uint64_t completed = m_pUploader->GetCompletedValue();
+	while (!mFlushed.empty() && mFlushed.front().value <= completed)
+	{
+		mReportBytes += mFlushed.front().size;
+		mFlushed.pop_front();
+	}
+	auto now = std::chrono::high_resolution_clock::now();
+	float seconds = std::chrono::duration<float>(now - mReportTime).count();
+	if (seconds >= 1.f)
+	{
+		if (mReportBytes > 0 || !mQueue.empty() || !mFlushed.empty())
+		{
+			std::cout << "Upload scheduler: " << mQueue.size() << " pending (" << mQueuedBytes / 1024 << " KB), "
+				<< mFlushed.size() << " flushes in flight, " << mReportBytes / (1024.f * 1024.f) / seconds << " MB/s completed" << std::endl;
+		}
+		mReportTime = now;
+		mReportBytes = 0;
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include "TransferUploader.h"
+
+// Queues uploads requested at runtime and feeds them to the transfer uploader a few megabytes per
+// frame, highest priority first, so a big asset arriving mid-game does not stall a frame.
+// An item is never split: one bigger than the budget goes alone in a frame of its own.
+class VulkanUploadScheduler
+{
+public:
+	// Records the item's copies into the transfer uploader, when the item's turn comes
+	using RecordCallback = std::function<void()>;
+	// Called once the upload is flushed, with the timeline value that signals its completion
+	using SubmitCallback = std::function<void(uint64_t value)>;
+
+	VulkanUploadScheduler() = default;
+	~VulkanUploadScheduler() = default;
+
+	void Init(VulkanTransferUploader* pUploader, VkDeviceSize bytesPerFrame = 8ull * 1024 * 1024);
+
+	// size is what record puts through the staging ring
+	void Enqueue(VkDeviceSize size, RecordCallback record, int priority = 0, SubmitCallback onSubmitted = nullptr);
+
+	// Once per frame after the frame's submits, after everything that enqueues that frame: drains up to
+	// the budget and flushes it, so the next frame's submit acquires the uploads
+	void Update();
+
+	void SetBytesPerFrame(VkDeviceSize bytesPerFrame) { mBytesPerFrame = bytesPerFrame; }
+	size_t GetQueueDepth() const { return mQueue.size(); }
+	VkDeviceSize GetQueuedBytes() const { return mQueuedBytes; }
+
+private:
+	struct Item
+	{
+		int priority;
+		uint64_t sequence;// fifo among equal priorities
+		VkDeviceSize size;
+		RecordCallback record;
+		SubmitCallback onSubmitted;
+	};
+	static bool Compare(const Item& a, const Item& b);
+	void Push(Item&& item);
+
+private:
+	VulkanTransferUploader* m_pUploader = nullptr;
+	VkDeviceSize mBytesPerFrame = 0;
+	std::vector<Item> mQueue;// binary heap on Compare
+	VkDeviceSize mQueuedBytes = 0;
+	uint64_t mNextSequence = 0;
+
+	// throughput report, once a second while there is traffic. Bytes count when the transfer queue
+	// has completed them, not when they are recorded.
+	struct Flushed
+	{
+		uint64_t value;
+		VkDeviceSize size;
+	};
+	std::deque<Flushed> mFlushed;
+	std::chrono::high_resolution_clock::time_point mReportTime;
+	VkDeviceSize mReportBytes = 0;
+};
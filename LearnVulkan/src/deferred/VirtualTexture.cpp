@@ -0,0 +1,543 @@
+#include "VirtualTexture.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+	uint32_t NextPowerOfTwo(uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result < value)
+		{
+			result <<= 1;
+		}
+		return result;
+	}
+
+	// Bilinear, edges clamped; only used to stretch level 0 onto whole pages
+	void ResampleRGBA8(const unsigned char* pSource, uint32_t width, uint32_t height, uint32_t pitch,
+		unsigned char* pDest, uint32_t destWidth, uint32_t destHeight)
+	{
+		float scaleX = (float)width / destWidth;
+		float scaleY = (float)height / destHeight;
+		for (uint32_t y = 0; y < destHeight; y++)
+		{
+			float sy = std::min(std::max((y + 0.5f) * scaleY - 0.5f, 0.f), (float)(height - 1));
+			uint32_t y0 = (uint32_t)sy;
+			uint32_t y1 = std::min(y0 + 1, height - 1);
+			float fy = sy - y0;
+			for (uint32_t x = 0; x < destWidth; x++)
+			{
+				float sx = std::min(std::max((x + 0.5f) * scaleX - 0.5f, 0.f), (float)(width - 1));
+				uint32_t x0 = (uint32_t)sx;
+				uint32_t x1 = std::min(x0 + 1, width - 1);
+				float fx = sx - x0;
+				const unsigned char* p00 = pSource + (size_t)y0 * pitch + x0 * 4;
+				const unsigned char* p01 = pSource + (size_t)y0 * pitch + x1 * 4;
+				const unsigned char* p10 = pSource + (size_t)y1 * pitch + x0 * 4;
+				const unsigned char* p11 = pSource + (size_t)y1 * pitch + x1 * 4;
+				unsigned char* pOut = pDest + ((size_t)y * destWidth + x) * 4;
+				for (int c = 0; c < 4; c++)
+				{
+					float top = p00[c] + (p01[c] - p00[c]) * fx;
+					float bottom = p10[c] + (p11[c] - p10[c]) * fx;
+					pOut[c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+				}
+			}
+		}
+	}
+}
+
+bool VulkanVirtualTexture::Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader, VulkanUploadScheduler* pScheduler,
+	VulkanSamplerCache* pSamplers, uint32_t frameCount, const unsigned char* pRGBA, uint32_t width, uint32_t height, uint32_t pitch, uint32_t atlasPages, uint32_t pagesPerFrame)
+{
+	m_pDevice = pDevice;
+	m_pAllocator = pAllocator;
+	m_pUploader = pUploader;
+	m_pScheduler = pScheduler;
+	mFrameCount = frameCount;
+	mAtlasPages = atlasPages;
+	mPagesPerFrame = pagesPerFrame;
+
+	// a power of two page grid: every level is whole pages, and page (x, y) covers the same uv range as
+	// (x / 2, y / 2) one level down. The chain stops where the shorter side is one page.
+	mPagesX = NextPowerOfTwo((width + PagePayload - 1) / PagePayload);
+	mPagesY = NextPowerOfTwo((height + PagePayload - 1) / PagePayload);
+	mLevelCount = 1;
+	while ((mPagesX >> mLevelCount) > 0 && (mPagesY >> mLevelCount) > 0)
+	{
+		mLevelCount++;
+	}
+	uint32_t coarsestPages = (mPagesX >> (mLevelCount - 1)) * (mPagesY >> (mLevelCount - 1));
+	if (coarsestPages > mAtlasPages * mAtlasPages / 2)
+	{
+		std::cerr << "Virtual texture: " << width << "x" << height << " is too long and thin for the page atlas" << std::endl;
+		return false;
+	}
+
+	uint32_t virtualWidth = mPagesX * PagePayload;
+	uint32_t virtualHeight = mPagesY * PagePayload;
+	std::vector<unsigned char> level0((size_t)virtualWidth * virtualHeight * 4);
+	ResampleRGBA8(pRGBA, width, height, pitch, level0.data(), virtualWidth, virtualHeight);
+	mChain.resize((size_t)ComputeMipChainLayout(virtualWidth, virtualHeight, mLevelCount, mLevels));
+	BuildMipChainRGBA8(level0.data(), virtualWidth * 4, mChain.data(), mLevels, MipBuildOptions());
+
+	mPageOffsets.resize(mLevelCount);
+	mPageCount = 0;
+	for (uint32_t i = 0; i < mLevelCount; i++)
+	{
+		mPageOffsets[i] = mPageCount;
+		mPageCount += (mPagesX >> i) * (mPagesY >> i);
+	}
+
+	if (!CreateImage(mAtlasPages * PageSize, mAtlasPages * PageSize, 1, mAtlas) || !CreateImage(mPagesX, mPagesY, mLevelCount, mPageTable))
+	{
+		return false;
+	}
+
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.maxLod = 0.f;
+	m_pAtlasSampler = pSamplers->GetSampler(samplerInfo);
+	if (!m_pAtlasSampler)
+	{
+		return false;
+	}
+	// page table entries are indices, never blended
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = (float)(mLevelCount - 1);
+	m_pPageTableSampler = pSamplers->GetSampler(samplerInfo);
+	if (!m_pPageTableSampler)
+	{
+		return false;
+	}
+
+	mFeedbackWords = (mPageCount + 31) / 32;
+	mFeedbackSize = (VkDeviceSize)mFeedbackWords * 4 * mFrameCount;
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = mFeedbackSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(m_pDevice, &bufferInfo, nullptr, &m_pFeedbackBuffer) != VK_SUCCESS)
+	{
+		return false;
+	}
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_pDevice, m_pFeedbackBuffer, &requirements);
+	uint32_t memoryType = 0;
+	if (!m_pAllocator->FindMemoryType(requirements.memoryTypeBits, m_pAllocator->GetPolicy(MemoryUsage::Readback), memoryType)
+		|| !m_pAllocator->Allocate(requirements, memoryType, AllocationType::Buffer, mFeedbackMemory))
+	{
+		vkDestroyBuffer(m_pDevice, m_pFeedbackBuffer, nullptr);
+		m_pFeedbackBuffer = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindBufferMemory(m_pDevice, m_pFeedbackBuffer, mFeedbackMemory.pMemory, mFeedbackMemory.offset);
+	// the first frames read their slot before any pass cleared it
+	memset(mFeedbackMemory.pMapped, 0, (size_t)mFeedbackSize);
+
+	mPageSlots.assign(mPageCount, -1);
+	mSlots.assign(mAtlasPages * mAtlasPages, Slot());
+	mRequested.assign(mPageCount, false);
+
+	// the coarsest level is pinned, every lookup falls back to it
+	std::vector<uint32_t> pages;
+	std::vector<uint32_t> slots;
+	for (uint32_t page = mPageOffsets[mLevelCount - 1]; page < mPageCount; page++)
+	{
+		uint32_t slot = (uint32_t)pages.size();
+		mSlots[slot].page = (int32_t)page;
+		mSlots[slot].lastUsed = UINT64_MAX;
+		mPageSlots[page] = (int32_t)slot;
+		pages.push_back(page);
+		slots.push_back(slot);
+	}
+	UploadPages(pages, slots);
+	UploadPageTable();
+
+	mReportTime = std::chrono::high_resolution_clock::now();
+	std::cout << "Virtual texture: " << virtualWidth << "x" << virtualHeight << ", " << mLevelCount << " levels, " << mPageCount
+		<< " pages of " << PagePayload << " texels, " << mAtlasPages * mAtlasPages << " page atlas" << std::endl;
+	return true;
+}
+
+void VulkanVirtualTexture::Destroy()
+{
+	DestroyImage(mAtlas);
+	DestroyImage(mPageTable);
+	// the samplers belong to the sampler cache
+	m_pAtlasSampler = VK_NULL_HANDLE;
+	m_pPageTableSampler = VK_NULL_HANDLE;
+	if (m_pFeedbackBuffer)
+	{
+		vkDestroyBuffer(m_pDevice, m_pFeedbackBuffer, nullptr);
+		m_pAllocator->Free(mFeedbackMemory);
+		m_pFeedbackBuffer = VK_NULL_HANDLE;
+	}
+	mChain.clear();
+}
+
+bool VulkanVirtualTexture::CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, Image& image)
+{
+	VkImageCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	createInfo.imageType = VK_IMAGE_TYPE_2D;
+	createInfo.extent = { width, height, 1 };
+	createInfo.mipLevels = mipLevels;
+	createInfo.arrayLayers = 1;
+	createInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	createInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	// both images are rewritten in place while in use, shared so no ownership has to move every frame
+	uint32_t families[2];
+	m_pUploader->GetQueueFamilies(families);
+	if (families[0] != families[1])
+	{
+		createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		createInfo.queueFamilyIndexCount = 2;
+		createInfo.pQueueFamilyIndices = families;
+	}
+	else
+	{
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+	if (vkCreateImage(m_pDevice, &createInfo, nullptr, &image.pImage) != VK_SUCCESS)
+	{
+		return false;
+	}
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_pDevice, image.pImage, &requirements);
+	uint32_t memoryType = 0;
+	if (!m_pAllocator->FindMemoryType(requirements.memoryTypeBits, m_pAllocator->GetPolicy(MemoryUsage::GpuOnly), memoryType)
+		|| !m_pAllocator->Allocate(requirements, memoryType, AllocationType::ImageOptimal, image.memory))
+	{
+		vkDestroyImage(m_pDevice, image.pImage, nullptr);
+		image.pImage = VK_NULL_HANDLE;
+		return false;
+	}
+	vkBindImageMemory(m_pDevice, image.pImage, image.memory.pMemory, image.memory.offset);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image.pImage;
+	viewInfo.format = createInfo.format;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = mipLevels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	return vkCreateImageView(m_pDevice, &viewInfo, nullptr, &image.pView) == VK_SUCCESS;
+}
+
+void VulkanVirtualTexture::DestroyImage(Image& image)
+{
+	if (image.pView)
+	{
+		vkDestroyImageView(m_pDevice, image.pView, nullptr);
+	}
+	if (image.pImage)
+	{
+		vkDestroyImage(m_pDevice, image.pImage, nullptr);
+		m_pAllocator->Free(image.memory);
+	}
+	image = Image();
+}
+
+uint32_t VulkanVirtualTexture::GetPageId(uint32_t level, uint32_t x, uint32_t y) const
+{
+	return mPageOffsets[level] + y * (mPagesX >> level) + x;
+}
+
+void VulkanVirtualTexture::CopyPage(uint32_t page, unsigned char* pDst) const
+{
+	uint32_t level = mLevelCount - 1;
+	while (mPageOffsets[level] > page)
+	{
+		level--;
+	}
+	uint32_t index = page - mPageOffsets[level];
+	uint32_t pageX = index % (mPagesX >> level);
+	uint32_t pageY = index / (mPagesX >> level);
+
+	// the border wraps around the level like the REPEAT sampler of the plain texture
+	const MipLevelLayout& layout = mLevels[level];
+	const unsigned char* pLevel = mChain.data() + layout.offset;
+	int32_t left = (int32_t)(pageX * PagePayload) - (int32_t)PageBorder;
+	int32_t top = (int32_t)(pageY * PagePayload) - (int32_t)PageBorder;
+	for (uint32_t y = 0; y < PageSize; y++)
+	{
+		uint32_t sy = (uint32_t)((top + (int32_t)y + (int32_t)layout.height) % (int32_t)layout.height);
+		const uint32_t* pRow = (const uint32_t*)(pLevel + (size_t)sy * layout.width * 4);
+		uint32_t* pOut = (uint32_t*)(pDst + (size_t)y * PageSize * 4);
+		for (uint32_t x = 0; x < PageSize; x++)
+		{
+			pOut[x] = pRow[(left + (int32_t)x + (int32_t)layout.width) % (int32_t)layout.width];
+		}
+	}
+}
+
+void VulkanVirtualTexture::UploadPages(const std::vector<uint32_t>& pages, const std::vector<uint32_t>& slots)
+{
+	const VkDeviceSize pageBytes = (VkDeviceSize)PageSize * PageSize * 4;
+	StagingRegion staging = m_pUploader->AllocateStaging(pageBytes * pages.size());
+	std::vector<VkBufferImageCopy> regions(pages.size());
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		CopyPage(pages[i], (unsigned char*)staging.pData + pageBytes * i);
+		regions[i] = {};
+		regions[i].bufferOffset = pageBytes * i;
+		regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[i].imageSubresource.mipLevel = 0;
+		regions[i].imageSubresource.baseArrayLayer = 0;
+		regions[i].imageSubresource.layerCount = 1;
+		regions[i].imageOffset = { (int32_t)((slots[i] % mAtlasPages) * PageSize), (int32_t)((slots[i] / mAtlasPages) * PageSize), 0 };
+		regions[i].imageExtent = { PageSize, PageSize, 1 };
+	}
+	m_pUploader->UpdateImageRegions(mAtlas.pImage, staging, regions.data(), (uint32_t)regions.size(), 1,
+		mAtlasWritten ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	mAtlasWritten = true;
+	mUploadedPages += (uint32_t)pages.size();
+}
+
+void VulkanVirtualTexture::UploadPageTable()
+{
+	// one RGBA8 texel per page: atlas x, atlas y, level of the page it resolves to. Missing pages take the
+	// entry of their parent, so the levels are filled coarsest first.
+	std::vector<std::vector<uint32_t>> levels(mLevelCount);
+	VkDeviceSize size = 0;
+	for (int32_t level = (int32_t)mLevelCount - 1; level >= 0; level--)
+	{
+		uint32_t pagesX = mPagesX >> level;
+		uint32_t pagesY = mPagesY >> level;
+		std::vector<uint32_t>& entries = levels[level];
+		entries.resize(pagesX * pagesY);
+		for (uint32_t y = 0; y < pagesY; y++)
+		{
+			for (uint32_t x = 0; x < pagesX; x++)
+			{
+				int32_t slot = mPageSlots[GetPageId(level, x, y)];
+				if (slot >= 0)
+				{
+					entries[y * pagesX + x] = (slot % mAtlasPages) | ((slot / mAtlasPages) << 8) | ((uint32_t)level << 16) | 0xFF000000u;
+				}
+				else
+				{
+					entries[y * pagesX + x] = levels[level + 1][(y / 2) * (pagesX / 2) + x / 2];
+				}
+			}
+		}
+		size += entries.size() * 4;
+	}
+
+	StagingRegion staging = m_pUploader->AllocateStaging(size);
+	std::vector<VkBufferImageCopy> regions(mLevelCount);
+	VkDeviceSize offset = 0;
+	for (uint32_t level = 0; level < mLevelCount; level++)
+	{
+		memcpy((unsigned char*)staging.pData + offset, levels[level].data(), levels[level].size() * 4);
+		regions[level] = {};
+		regions[level].bufferOffset = offset;
+		regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[level].imageSubresource.mipLevel = level;
+		regions[level].imageSubresource.baseArrayLayer = 0;
+		regions[level].imageSubresource.layerCount = 1;
+		regions[level].imageExtent = { mPagesX >> level, mPagesY >> level, 1 };
+		offset += levels[level].size() * 4;
+	}
+	// every texel is rewritten, the old contents can be discarded
+	m_pUploader->UpdateImageRegions(mPageTable.pImage, staging, regions.data(), mLevelCount, mLevelCount,
+		VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void VulkanVirtualTexture::BeginFrame(uint32_t frameIndex)
+{
+	mFrame++;
+	mReportFrames++;
+	const uint32_t* pBits = (const uint32_t*)mFeedbackMemory.pMapped + (size_t)frameIndex * mFeedbackWords;
+	for (uint32_t word = 0; word < mFeedbackWords; word++)
+	{
+		uint32_t bits = pBits[word];
+		for (uint32_t bit = 0; bits != 0; bit++, bits >>= 1)
+		{
+			uint32_t page = word * 32 + bit;
+			if (!(bits & 1) || page >= mPageCount)
+			{
+				continue;
+			}
+			int32_t slot = mPageSlots[page];
+			if (slot >= 0)
+			{
+				if (mSlots[slot].lastUsed != UINT64_MAX)
+				{
+					mSlots[slot].lastUsed = mFrame;
+				}
+			}
+			else
+			{
+				mMisses++;
+				if (!mRequested[page])
+				{
+					mRequested[page] = true;
+					mRequests.push_back(page);
+				}
+			}
+		}
+	}
+}
+
+void VulkanVirtualTexture::RecordFeedbackClear(VkCommandBuffer pCommandBuffer, uint32_t frameIndex)
+{
+	VkDeviceSize offset = (VkDeviceSize)frameIndex * mFeedbackWords * 4;
+	vkCmdFillBuffer(pCommandBuffer, m_pFeedbackBuffer, offset, (VkDeviceSize)mFeedbackWords * 4, 0);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = m_pFeedbackBuffer;
+	barrier.offset = offset;
+	barrier.size = (VkDeviceSize)mFeedbackWords * 4;
+	vkCmdPipelineBarrier(pCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void VulkanVirtualTexture::RecordFeedbackBarrier(VkCommandBuffer pCommandBuffer)
+{
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = m_pFeedbackBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(pCommandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void VulkanVirtualTexture::Update()
+{
+	// coarse pages first, they are what the finer ones fall back to while they load. Level 0's pages
+	// come first in the id space and ids grow toward the coarsest level, so that is descending id order.
+	std::sort(mRequests.begin(), mRequests.end(), std::greater<uint32_t>());
+	std::vector<uint32_t> pages;
+	std::vector<uint32_t> slots;
+	for (uint32_t page : mRequests)
+	{
+		mRequested[page] = false;
+		if (pages.size() >= mPagesPerFrame)
+		{
+			// dropped, the feedback asks again if the page is still on screen
+			continue;
+		}
+
+		// a free page, otherwise the least recently used one that wasn't asked for this frame
+		int32_t best = -1;
+		for (uint32_t slot = 0; slot < (uint32_t)mSlots.size(); slot++)
+		{
+			if (mSlots[slot].page < 0)
+			{
+				best = (int32_t)slot;
+				break;
+			}
+			if (mSlots[slot].lastUsed < mFrame && (best < 0 || mSlots[slot].lastUsed < mSlots[best].lastUsed))
+			{
+				best = (int32_t)slot;
+			}
+		}
+		if (best < 0)
+		{
+			// everything in the atlas is on screen
+			continue;
+		}
+		if (mSlots[best].page >= 0)
+		{
+			mPageSlots[mSlots[best].page] = -1;
+			mEvictions++;
+		}
+		mSlots[best].page = (int32_t)page;
+		mSlots[best].lastUsed = mFrame;
+		mPageSlots[page] = best;
+		pages.push_back(page);
+		slots.push_back((uint32_t)best);
+	}
+	mRequests.clear();
+
+	// DrawFrame has waited for the last pass that sampled the atlas, so pages can be replaced in place;
+	// the next frame's submit waits for these copies. The slots above are already reassigned, so the pages
+	// go out with the highest priority: the scheduler always drains its top item in the same frame.
+	if (!pages.empty())
+	{
+		VkDeviceSize size = (VkDeviceSize)pages.size() * PageSize * PageSize * 4;
+		m_pScheduler->Enqueue(size, [this, pages = std::move(pages), slots = std::move(slots)]()
+		{
+			UploadPages(pages, slots);
+			UploadPageTable();
+		}, std::numeric_limits<int>::max());
+	}
+
+	auto now = std::chrono::high_resolution_clock::now();
+	float seconds = std::chrono::duration<float>(now - mReportTime).count();
+	if (seconds >= 1.f)
+	{
+		mMissesPerFrame = mReportFrames > 0 ? (float)mMisses / mReportFrames : 0.f;
+		mUploadRate = mUploadedPages * (float)(PageSize * PageSize * 4) / (1024.f * 1024.f) / seconds;
+		if (mMisses > 0 || mUploadedPages > 0)
+		{
+			PrintStats();
+		}
+		mReportTime = now;
+		mReportFrames = 0;
+		mMisses = 0;
+		mUploadedPages = 0;
+		mEvictions = 0;
+	}
+}
+
+VirtualTextureParams VulkanVirtualTexture::GetParams(uint32_t frameIndex) const
+{
+	VirtualTextureParams params = {};
+	params.virtualSize[0] = (float)(mPagesX * PagePayload);
+	params.virtualSize[1] = (float)(mPagesY * PagePayload);
+	params.pageCount[0] = (float)mPagesX;
+	params.pageCount[1] = (float)mPagesY;
+	params.atlasPages = (float)mAtlasPages;
+	params.maxLevel = (float)(mLevelCount - 1);
+	params.pageBorder = (float)PageBorder / PageSize;
+	params.pagePayload = (float)PagePayload / PageSize;
+	params.feedbackOffset = frameIndex * mFeedbackWords;
+	return params;
+}
+
+void VulkanVirtualTexture::PrintStats() const
+{
+	uint32_t resident = 0;
+	for (const auto& slot : mSlots)
+	{
+		if (slot.page >= 0)
+		{
+			resident++;
+		}
+	}
+	std::cout << "Virtual texture: " << resident << "/" << mSlots.size() << " atlas pages resident (" << mPageCount << " virtual), "
+		<< mMissesPerFrame << " misses per frame, " << mUploadRate << " MB/s uploaded, " << mEvictions << " evictions" << std::endl;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <chrono>
+#include "MemoryAllocator.h"
+#include "TransferUploader.h"
+#include "UploadScheduler.h"
+#include "SamplerCache.h"
+#include "MipChain.h"
+
+// Push constants of the virtual texturing variant of deferred.frag, same layout as the shader block
+struct VirtualTextureParams
+{
+	float virtualSize[2];// level 0 in texels
+	float pageCount[2];// pages of level 0
+	float atlasPages;// pages per side of the atlas
+	float maxLevel;// coarsest level
+	float pageBorder;// border / page size
+	float pagePayload;// payload / page size
+	uint32_t feedbackOffset;// first word of this frame's feedback bits
+};
+
+// Software virtual texturing, no sparse binding needed. The texture is cut into pages of PagePayload
+// texels per level; resident pages live in one physical atlas, and an indirection image (one texel per
+// page, one mip per level) tells the shader where a page is, or where its closest resident parent is.
+// The shader sets a bit per page it wants in a feedback buffer; BeginFrame() reads it back once that
+// frame's fence has signaled and Update() loads what is missing, evicting the least recently used pages.
+class VulkanVirtualTexture
+{
+public:
+	static const uint32_t PageSize = 128;// texels per side of an atlas page, borders included
+	static const uint32_t PageBorder = 4;// texels repeated around every page so bilinear filtering stays inside it
+	static const uint32_t PagePayload = PageSize - 2 * PageBorder;
+
+	VulkanVirtualTexture() = default;
+	~VulkanVirtualTexture() = default;
+
+	// pRGBA is level 0, resampled to whole pages and mipped here. The coarsest level is always resident.
+	// Both samplers come from pSamplers and stay owned by it.
+	bool Init(VkDevice pDevice, VulkanMemoryAllocator* pAllocator, VulkanTransferUploader* pUploader, VulkanUploadScheduler* pScheduler,
+		VulkanSamplerCache* pSamplers, uint32_t frameCount, const unsigned char* pRGBA, uint32_t width, uint32_t height, uint32_t pitch,
+		uint32_t atlasPages = 16, uint32_t pagesPerFrame = 32);
+	void Destroy();
+
+	// After frameIndex's fence: reads the pages that frame asked for
+	void BeginFrame(uint32_t frameIndex);
+	// Clears frameIndex's feedback bits; outside the render pass, before the pass that samples the texture
+	void RecordFeedbackClear(VkCommandBuffer pCommandBuffer, uint32_t frameIndex);
+	// After that pass: makes the feedback writes visible to the host
+	void RecordFeedbackBarrier(VkCommandBuffer pCommandBuffer);
+	// Once per frame after the graphics submit: loads missing pages coarse to fine and rewrites the page table
+	void Update();
+
+	VirtualTextureParams GetParams(uint32_t frameIndex) const;
+	VkImageView GetPageTableView() const { return mPageTable.pView; }
+	VkSampler GetPageTableSampler() const { return m_pPageTableSampler; }
+	VkImageView GetAtlasView() const { return mAtlas.pView; }
+	VkSampler GetAtlasSampler() const { return m_pAtlasSampler; }
+	VkBuffer GetFeedbackBuffer() const { return m_pFeedbackBuffer; }
+	VkDeviceSize GetFeedbackSize() const { return mFeedbackSize; }
+
+	void PrintStats() const;
+
+private:
+	struct Image
+	{
+		VkImage pImage = VK_NULL_HANDLE;
+		MemoryAllocation memory;
+		VkImageView pView = VK_NULL_HANDLE;
+	};
+
+	struct Slot
+	{
+		int32_t page = -1;
+		uint64_t lastUsed = 0;// frame, UINT64_MAX for pinned pages
+	};
+
+	bool CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, Image& image);
+	void DestroyImage(Image& image);
+	uint32_t GetPageId(uint32_t level, uint32_t x, uint32_t y) const;
+	void CopyPage(uint32_t page, unsigned char* pDst) const;
+	void UploadPages(const std::vector<uint32_t>& pages, const std::vector<uint32_t>& slots);
+	void UploadPageTable();
+
+private:
+	VkDevice m_pDevice = VK_NULL_HANDLE;
+	VulkanMemoryAllocator* m_pAllocator = nullptr;
+	VulkanTransferUploader* m_pUploader = nullptr;
+	VulkanUploadScheduler* m_pScheduler = nullptr;
+	uint32_t mFrameCount = 0;
+	uint32_t mAtlasPages = 0;
+	uint32_t mPagesPerFrame = 0;
+
+	// the cooked chain every page is cut from
+	uint32_t mPagesX = 0;
+	uint32_t mPagesY = 0;
+	uint32_t mLevelCount = 0;
+	std::vector<unsigned char> mChain;
+	std::vector<MipLevelLayout> mLevels;
+	std::vector<uint32_t> mPageOffsets;// first page id of every level
+	uint32_t mPageCount = 0;
+
+	Image mAtlas;
+	Image mPageTable;
+	VkSampler m_pAtlasSampler = VK_NULL_HANDLE;
+	VkSampler m_pPageTableSampler = VK_NULL_HANDLE;
+	bool mAtlasWritten = false;
+
+	VkBuffer m_pFeedbackBuffer = VK_NULL_HANDLE;
+	MemoryAllocation mFeedbackMemory;
+	uint32_t mFeedbackWords = 0;// per frame
+	VkDeviceSize mFeedbackSize = 0;// all frames
+
+	std::vector<int32_t> mPageSlots;// per page, -1 when not resident
+	std::vector<Slot> mSlots;// per atlas page
+	std::vector<uint32_t> mRequests;// missing pages asked for, not loaded yet
+	std::vector<bool> mRequested;
+	uint64_t mFrame = 0;
+
+	// report, once a second
+	std::chrono::high_resolution_clock::time_point mReportTime;
+	uint32_t mReportFrames = 0;
+	uint32_t mMisses = 0;
+	uint32_t mUploadedPages = 0;
+	uint32_t mEvictions = 0;
+	float mMissesPerFrame = 0.f;
+	float mUploadRate = 0.f;// MB/s
+};
@@ -433,6 +433,36 @@ extern "C" {
 #endif // STBI_NO_STDIO
 
 
+	////////////////////////////////////
+	//
+	// decode into caller memory
+	//
+	// Decodes 8-bit per channel pixels straight into dst, e.g. a mapped staging buffer, instead of
+	// a heap buffer the caller then copies. Row j starts at dst + j * row_pitch; dst_size must cover
+	// row_pitch * (height - 1) + width * desired_channels bytes (get the size with stbi_info first).
+	// Only the width * desired_channels bytes of each row are written, so dst can be a sub-rectangle.
+	// desired_channels must not be 0. Returns 1 on success, 0 on failure (see stbi_failure_reason).
+	// JPEG writes its output rows in place; other formats decode to a temporary and copy rows.
+	STBIDEF int      stbi_load_into_from_memory(stbi_uc const *buffer, int len, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *channels_in_file, int desired_channels);
+	STBIDEF int      stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+	STBIDEF int      stbi_load_into(char const *filename, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *channels_in_file, int desired_channels);
+	STBIDEF int      stbi_load_into_from_file(FILE *f, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+	// Same as stbi_load_into_from_memory, and rows_ready(user, first_row, row_count) is called, in order, as rows
+	// of dst become final so they can be copied out while the rest decodes. Baseline JPEG hands them out every
+	// MCU row (unless its scan is decoded in parallel, see stbi_set_jpeg_parallel) and 8-bit non-interlaced PNG
+	// without palette or tRNS every zlib block; anything else once, when it's done.
+	typedef void stbi_rows_ready_func(void *user, int first_row, int row_count);
+	STBIDEF int      stbi_load_into_rows_from_memory(stbi_uc const *buffer, int len, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *channels_in_file, int desired_channels, stbi_rows_ready_func *rows_ready, void *user);
+
+	// Same as stbi_load_from_memory, at 1/2, 1/4 or 1/8 of the size for scale_shift 1, 2 or 3: JPEG runs a reduced
+	// IDCT on the low frequencies of every block instead of decoding everything and throwing most of it away.
+	// The image comes out ceil(width / (1 << scale_shift)) wide, same for the height. Other formats ignore
+	// scale_shift and load at full size, check *x and *y.
+	STBIDEF stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int scale_shift);
+
 	// get a VERY brief reason for failure
 	// NOT THREADSAFE
 	STBIDEF const char *stbi_failure_reason(void);
@@ -467,6 +497,23 @@ extern "C" {
 	// flip the image vertically, so the first pixel in the output array is the bottom left
 	STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+	// JPEG uses AVX2 kernels (IDCT, chroma upsampling fused with the RGBA conversion) when the CPU
+	// has AVX2, on by default. Turning them off falls back to the SSE2 kernels, e.g. to compare the two.
+	// Returns whether AVX2 will be used. NOT THREADSAFE
+	STBIDEF int stbi_set_jpeg_avx2(int flag_true_if_enabled);
+
+	// Baseline JPEG scans with restart markers are split at the markers and the intervals entropy decoded
+	// and IDCT'd in parallel through parallel_for, which must call task(task_data, i) once for every i in
+	// [0, count) and return when all calls have returned. Only for images decoded from memory; NULL (the
+	// default) or anything else decodes serially. NOT THREADSAFE
+	typedef void stbi_parallel_for_func(void *user, void(*task)(void *task_data, int index), void *task_data, int count);
+	STBIDEF void stbi_set_jpeg_parallel(stbi_parallel_for_func *parallel_for, void *user);
+
+	// PNG (and the zlib_decode functions) inflate with a 64-bit bit buffer and a table that decodes up to two
+	// literals per lookup, and 8-bit RGB/RGBA rows are unfiltered with SSE2 (AVX2 for the Up filter).
+	// On by default, output is byte-identical with them off. NOT THREADSAFE
+	STBIDEF void stbi_set_png_fast_decode(int flag_true_if_enabled);
+
 	// ZLIB client - used by PNG, available for other purposes
 
 	STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -676,7 +723,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
 	int info3 = stbi__cpuid3();
@@ -687,7 +734,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
 	// If we're even attempting to compile this on GCC/Clang, that means
@@ -700,6 +747,35 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2: compiled in next to SSE2 and picked at run time, so the build doesn't need -mavx2 or /arch:AVX2
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && (!defined(STBI_NO_JPEG) || !defined(STBI_NO_PNG)) \
+	&& (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5) || (defined(_MSC_VER) && _MSC_VER >= 1800))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return 0;
+	__cpuid(info, 1);
+	// osxsave and avx, then whether the os saves the ymm registers
+	if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0) return 0;
+	if ((_xgetbv(0) & 6) != 6) return 0;
+	__cpuidex(info, 7, 0);
+	return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -735,6 +811,17 @@ typedef struct
 
 	stbi_uc *img_buffer, *img_buffer_end;
 	stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+	// stbi_load_into destination, decoders that can write rows in place use it when it fits
+	stbi_uc *out_target;
+	size_t out_target_size;
+	int out_pitch;
+	// stbi_load_into_rows: rows of out_target handed out so far
+	stbi_rows_ready_func *rows_ready;
+	void *rows_ready_user;
+	int rows_reported;
+	// stbi_load_scaled: decode at 1/(1 << scale_shift) where the format can
+	int scale_shift;
 } stbi__context;
 
 
@@ -745,6 +832,9 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
 	s->io.read = NULL;
 	s->read_from_callbacks = 0;
+	s->out_target = NULL;
+	s->rows_ready = NULL;
+	s->scale_shift = 0;
 	s->img_buffer = s->img_buffer_original = (stbi_uc *)buffer;
 	s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *)buffer + len;
 }
@@ -754,6 +844,9 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
 {
 	s->io = *c;
 	s->io_user_data = user;
+	s->out_target = NULL;
+	s->rows_ready = NULL;
+	s->scale_shift = 0;
 	s->buflen = sizeof(s->buffer_start);
 	s->read_from_callbacks = 1;
 	s->img_buffer_original = s->buffer_start;
@@ -1002,6 +1095,34 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
 	stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static int stbi__jpeg_avx2 = 1;
+
+STBIDEF int stbi_set_jpeg_avx2(int flag_true_if_enabled)
+{
+	stbi__jpeg_avx2 = flag_true_if_enabled;
+#ifdef STBI_AVX2
+	return stbi__jpeg_avx2 && stbi__avx2_available();
+#else
+	return 0;
+#endif
+}
+
+static stbi_parallel_for_func *stbi__jpeg_parallel_for = NULL;
+static void *stbi__jpeg_parallel_user = NULL;
+
+STBIDEF void stbi_set_jpeg_parallel(stbi_parallel_for_func *parallel_for, void *user)
+{
+	stbi__jpeg_parallel_for = parallel_for;
+	stbi__jpeg_parallel_user = user;
+}
+
+static int stbi__png_fast_decode = 1;
+
+STBIDEF void stbi_set_png_fast_decode(int flag_true_if_enabled)
+{
+	stbi__png_fast_decode = flag_true_if_enabled;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
 	memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1296,6 +1417,103 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
 	return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+// rows [first_row, first_row + row_count) of out_target are final
+static void stbi__rows_ready(stbi__context *s, int first_row, int row_count)
+{
+	s->rows_ready(s->rows_ready_user, first_row, row_count);
+	s->rows_reported = first_row + row_count;
+}
+
+static int stbi__load_into(stbi__context *s, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp)
+{
+	stbi_uc *result;
+	size_t row_bytes;
+	int j;
+
+	if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "stbi_load_into needs desired_channels");
+	s->out_target = (stbi_uc *)dst;
+	s->out_target_size = dst_size;
+	s->out_pitch = row_pitch;
+	s->rows_reported = 0;
+	result = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
+	if (result == NULL) return 0;
+	if (result == dst) {
+		if (s->rows_ready && s->rows_reported < *y)
+			stbi__rows_ready(s, s->rows_reported, *y - s->rows_reported);
+		return 1;
+	}
+
+	// the decoder could not write in place, copy the rows over
+	row_bytes = (size_t)*x * req_comp;
+	if ((size_t)row_pitch < row_bytes || (size_t)row_pitch * (*y - 1) + row_bytes > dst_size) {
+		STBI_FREE(result);
+		return stbi__err("dst too small", "Destination buffer too small for image");
+	}
+	for (j = 0; j < *y; ++j)
+		memcpy((stbi_uc *)dst + (size_t)row_pitch * j, result + row_bytes * j, row_bytes);
+	STBI_FREE(result);
+	if (s->rows_ready)
+		stbi__rows_ready(s, 0, *y);
+	return 1;
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_into(&s, dst, dst_size, row_pitch, x, y, comp, req_comp);
+}
+
+STBIDEF int stbi_load_into_rows_from_memory(stbi_uc const *buffer, int len, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp, stbi_rows_ready_func *rows_ready, void *user)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	s.rows_ready = rows_ready;
+	s.rows_ready_user = user;
+	return stbi__load_into(&s, dst, dst_size, row_pitch, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale_shift)
+{
+	stbi__context s;
+	if (scale_shift < 0 || scale_shift > 3) return stbi__errpuc("bad scale", "scale_shift must be 0 to 3");
+	stbi__start_mem(&s, buffer, len);
+	s.scale_shift = scale_shift;
+	return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_into(&s, dst, dst_size, row_pitch, x, y, comp, req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into(char const *filename, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	int result;
+	if (!f) return stbi__err("can't fopen", "Unable to open file");
+	result = stbi_load_into_from_file(f, dst, dst_size, row_pitch, x, y, comp, req_comp);
+	fclose(f);
+	return result;
+}
+
+STBIDEF int stbi_load_into_from_file(FILE *f, void *dst, size_t dst_size, int row_pitch, int *x, int *y, int *comp, int req_comp)
+{
+	int result;
+	stbi__context s;
+	stbi__start_file(&s, f);
+	result = stbi__load_into(&s, dst, dst_size, row_pitch, x, y, comp, req_comp);
+	if (result) {
+		// need to 'unget' all the characters in the IO buffer
+		fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+	}
+	return result;
+}
+#endif
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1766,6 +1984,8 @@ typedef struct
 	int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } stbi__huffman;
 
+typedef struct stbi__jpeg_output stbi__jpeg_output;
+
 typedef struct
 {
 	stbi__context *s;
@@ -1778,6 +1998,8 @@ typedef struct
 	int img_h_max, img_v_max;
 	int img_mcu_x, img_mcu_y;
 	int img_mcu_w, img_mcu_h;
+	// pixels per block side in the component buffers: 8, or 8 >> s->scale_shift with a reduced IDCT
+	int block_size;
 
 	// definition of jpeg image component
 	struct
@@ -1800,6 +2022,8 @@ typedef struct
 	int            code_bits;   // number of valid bits
 	unsigned char  marker;      // marker seen while filling entropy buffer
 	int            nomore;      // flag if we saw a marker so must stop
+	int            zero_fill;   // zero bits appended past the marker, since the last reset
+	int            interval_task; // decoding a restart interval off the calling thread: errors are not recorded
 
 	int            progressive;
 	int            spec_start;
@@ -1818,6 +2042,15 @@ typedef struct
 	void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
 	void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
 	stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+	// 2x horizontal (and 2x or 1x vertical) chroma upsampling fused with YCbCr to RGBA, NULL if there is none.
+	// w is the chroma width, count the output width. cb_far and cr_far are NULL for 1x vertical.
+	void(*upsample_YCbCr_to_RGBA_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *cb_near, const stbi_uc *cb_far,
+		const stbi_uc *cr_near, const stbi_uc *cr_far, int w, int count);
+
+	// stbi_load_into_rows: color conversion state, set up at the first scan. stream_rows when the current
+	// scan has every component, so rows can be converted as its MCU rows complete
+	stbi__jpeg_output *output;
+	int stream_rows;
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -1892,7 +2125,11 @@ static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
 static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 {
 	do {
-		unsigned int b = j->nomore ? 0 : stbi__get8(j->s);
+		unsigned int b = 0;
+		if (j->nomore)
+			j->zero_fill += 8;
+		else
+			b = stbi__get8(j->s);
 		if (b == 0xff) {
 			int c = stbi__get8(j->s);
 			while (c == 0xff) c = stbi__get8(j->s); // consume fill bytes
@@ -2019,6 +2256,9 @@ static const stbi_uc stbi__jpeg_dezigzag[64 + 15] =
    63, 63, 63, 63, 63, 63, 63
 };
 
+// the failure reason is one global, only the thread that called the decoder may set it
+#define stbi__jpeg_err(j,x,y)  ((j)->interval_task ? 0 : stbi__err(x,y))
+
 // decode one 64-entry block--
 static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi__uint16 *dequant)
 {
@@ -2027,7 +2267,7 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
 
 	if (j->code_bits < 16) stbi__grow_buffer_unsafe(j);
 	t = stbi__jpeg_huff_decode(j, hdc);
-	if (t < 0) return stbi__err("bad huffman code", "Corrupt JPEG");
+	if (t < 0) return stbi__jpeg_err(j, "bad huffman code", "Corrupt JPEG");
 
 	// 0 all the ac values now so we can do it 32-bits at a time
 	memset(data, 0, 64 * sizeof(data[0]));
@@ -2056,7 +2296,7 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
 		}
 		else {
 			int rs = stbi__jpeg_huff_decode(j, hac);
-			if (rs < 0) return stbi__err("bad huffman code", "Corrupt JPEG");
+			if (rs < 0) return stbi__jpeg_err(j, "bad huffman code", "Corrupt JPEG");
 			s = rs & 15;
 			r = rs >> 4;
 			if (s == 0) {
@@ -2340,6 +2580,50 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
 	}
 }
 
+// Reduced IDCTs for stbi_load_scaled: the n x n output is the n-point IDCT of the n x n lowest frequencies,
+// which keeps the block average. Constants are C(u)/2 * cos((2x+1)u pi / 2n) in 4.12 fixed point; rows keep
+// one fractional bit, columns fold in the +128 level shift and rounding.
+#define STBI__IDCT_SCALED_BIAS   ((128 << 13) + (1 << 12))
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, tmp[16], *t;
+	short *d = data;
+	// even part from frequencies 0 and 2, odd part from 1 and 3
+	for (i = 0; i < 4; ++i, d += 8) {
+		int e0 = (d[0] + d[2]) * 1448, e1 = (d[0] - d[2]) * 1448;
+		int o0 = d[1] * 1892 + d[3] * 784, o1 = d[1] * 784 - d[3] * 1892;
+		tmp[i * 4 + 0] = (e0 + o0 + 1024) >> 11;
+		tmp[i * 4 + 1] = (e1 + o1 + 1024) >> 11;
+		tmp[i * 4 + 2] = (e1 - o1 + 1024) >> 11;
+		tmp[i * 4 + 3] = (e0 - o0 + 1024) >> 11;
+	}
+	for (i = 0, t = tmp; i < 4; ++i, ++t) {
+		int e0 = (t[0] + t[8]) * 1448 + STBI__IDCT_SCALED_BIAS, e1 = (t[0] - t[8]) * 1448 + STBI__IDCT_SCALED_BIAS;
+		int o0 = t[4] * 1892 + t[12] * 784, o1 = t[4] * 784 - t[12] * 1892;
+		out[i] = stbi__clamp((e0 + o0) >> 13);
+		out[out_stride + i] = stbi__clamp((e1 + o1) >> 13);
+		out[out_stride * 2 + i] = stbi__clamp((e1 - o1) >> 13);
+		out[out_stride * 3 + i] = stbi__clamp((e0 - o0) >> 13);
+	}
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+	int t0 = ((data[0] + data[1]) * 1448 + 1024) >> 11, t1 = ((data[0] - data[1]) * 1448 + 1024) >> 11;
+	int t2 = ((data[8] + data[9]) * 1448 + 1024) >> 11, t3 = ((data[8] - data[9]) * 1448 + 1024) >> 11;
+	out[0] = stbi__clamp(((t0 + t2) * 1448 + STBI__IDCT_SCALED_BIAS) >> 13);
+	out[1] = stbi__clamp(((t1 + t3) * 1448 + STBI__IDCT_SCALED_BIAS) >> 13);
+	out[out_stride] = stbi__clamp(((t0 - t2) * 1448 + STBI__IDCT_SCALED_BIAS) >> 13);
+	out[out_stride + 1] = stbi__clamp(((t1 - t3) * 1448 + STBI__IDCT_SCALED_BIAS) >> 13);
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+	STBI_NOTUSED(out_stride);
+	out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2521,6 +2805,156 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT: the sse2 version with every 32-bit intermediate in one ymm register instead of
+// two xmm halves, so each rotation is one madd per output. Bit-identical to the generic C version.
+static STBI__AVX2_TARGET void stbi__idct_avx2(stbi_uc *out, int out_stride, short data[64])
+{
+	__m128i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m128i tmp;
+
+	// dot product constant: even elems=x, odd elems=y
+#define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+// out0 = c0[even]*x + c0[odd]*y, out1 the same with c1, for all 8 columns (x, y 16-bit, out 32-bit)
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         out0 = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)); \
+         out1 = _mm_packs_epi32(_mm256_castsi256_si128(dif), _mm256_extracti128_si256(dif, 1)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+	__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	// rounding biases in column/row passes, see stbi__idct_block for explanation.
+	__m256i bias_0 = _mm256_set1_epi32(512);
+	__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+	// load
+	row0 = _mm_load_si128((const __m128i *) (data + 0 * 8));
+	row1 = _mm_load_si128((const __m128i *) (data + 1 * 8));
+	row2 = _mm_load_si128((const __m128i *) (data + 2 * 8));
+	row3 = _mm_load_si128((const __m128i *) (data + 3 * 8));
+	row4 = _mm_load_si128((const __m128i *) (data + 4 * 8));
+	row5 = _mm_load_si128((const __m128i *) (data + 5 * 8));
+	row6 = _mm_load_si128((const __m128i *) (data + 6 * 8));
+	row7 = _mm_load_si128((const __m128i *) (data + 7 * 8));
+
+	// column pass
+	dct_pass(bias_0, 10);
+
+	{
+		// 16bit 8x8 transpose
+		dct_interleave16(row0, row4);
+		dct_interleave16(row1, row5);
+		dct_interleave16(row2, row6);
+		dct_interleave16(row3, row7);
+		dct_interleave16(row0, row2);
+		dct_interleave16(row1, row3);
+		dct_interleave16(row4, row6);
+		dct_interleave16(row5, row7);
+		dct_interleave16(row0, row1);
+		dct_interleave16(row2, row3);
+		dct_interleave16(row4, row5);
+		dct_interleave16(row6, row7);
+	}
+
+	// row pass
+	dct_pass(bias_1, 17);
+
+	{
+		// pack, 8bit 8x8 transpose and store as in stbi__idct_simd
+		__m128i p0 = _mm_packus_epi16(row0, row1);
+		__m128i p1 = _mm_packus_epi16(row2, row3);
+		__m128i p2 = _mm_packus_epi16(row4, row5);
+		__m128i p3 = _mm_packus_epi16(row6, row7);
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+		dct_interleave8(p0, p1);
+		dct_interleave8(p2, p3);
+		dct_interleave8(p0, p2);
+		dct_interleave8(p1, p3);
+		_mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+		_mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+	}
+	_mm256_zeroupper();
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2755,6 +3189,7 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	j->code_bits = 0;
 	j->code_buffer = 0;
 	j->nomore = 0;
+	j->zero_fill = 0;
 	j->img_comp[0].dc_pred = j->img_comp[1].dc_pred = j->img_comp[2].dc_pred = j->img_comp[3].dc_pred = 0;
 	j->marker = STBI__MARKER_none;
 	j->todo = j->restart_interval ? j->restart_interval : 0x7fffffff;
@@ -2763,10 +3198,163 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	// since we don't even allow 1<<30 pixels
 }
 
+// stbi_load_into_rows, with the color conversion below
+static int stbi__jpeg_begin_output(stbi__jpeg *z, stbi__jpeg_output *o);
+static void stbi__jpeg_rows_decoded(stbi__jpeg *z, int mcu_rows, int mcu_row_count);
+
+// baseline MCUs [first, last) of the current scan, no restart handling
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int last)
+{
+	int m, k, x, y;
+	STBI_SIMD_ALIGN(short, data[64]);
+	if (z->scan_n == 1) {
+		int n = z->order[0];
+		int w = (z->img_comp[n].x + 7) >> 3;
+		int ha = z->img_comp[n].ha;
+		for (m = first; m < last; ++m) {
+			int i = m % w, j = m / w;
+			if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+			z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * z->block_size + i * z->block_size, z->img_comp[n].w2, data);
+		}
+		return 1;
+	}
+	for (m = first; m < last; ++m) {
+		int i = m % z->img_mcu_x, j = m / z->img_mcu_x;
+		for (k = 0; k < z->scan_n; ++k) {
+			int n = z->order[k];
+			for (y = 0; y < z->img_comp[n].v; ++y) {
+				for (x = 0; x < z->img_comp[n].h; ++x) {
+					int x2 = (i*z->img_comp[n].h + x) * z->block_size;
+					int y2 = (j*z->img_comp[n].v + y) * z->block_size;
+					int ha = z->img_comp[n].ha;
+					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+#define STBI__JPEG_MAX_TASKS 64
+
+// a baseline scan cut at its restart markers; interval i holds MCUs [i*restart_interval, (i+1)*restart_interval)
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi_uc **starts; // interval_count + 1 entries, the last one is the end of the scan, marker included
+	int interval_count;
+	int mcu_count;
+	int task_count;
+	// one flag per task, only written by its task and read once they have all returned
+	unsigned char failed[STBI__JPEG_MAX_TASKS];
+} stbi__jpeg_intervals;
+
+static void stbi__jpeg_decode_intervals_task(void *task_data, int index)
+{
+	stbi__jpeg_intervals *scan = (stbi__jpeg_intervals *)task_data;
+	int first = (int)((size_t)index * scan->interval_count / scan->task_count);
+	int last = (int)((size_t)(index + 1) * scan->interval_count / scan->task_count);
+	int i;
+	// every task entropy decodes with a private copy of the decoder and the stream, the planes are shared
+	stbi__context s = *scan->z->s;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j) {
+		scan->failed[index] = 1;
+		return;
+	}
+	memcpy(j, scan->z, sizeof(stbi__jpeg));
+	j->s = &s;
+	j->interval_task = 1;
+	for (i = first; i < last; ++i) {
+		int mcu_first = i * j->restart_interval;
+		int mcu_last = i + 1 < scan->interval_count ? mcu_first + j->restart_interval : scan->mcu_count;
+		s.img_buffer = scan->starts[i];
+		s.img_buffer_end = scan->starts[i + 1];
+		stbi__jpeg_reset(j);
+		if (!stbi__jpeg_decode_mcus(j, mcu_first, mcu_last)) {
+			scan->failed[index] = 1;
+			break;
+		}
+		// the interval has to end exactly where the serial decoder would find its marker: the marker read
+		// is the one that ends the interval, no zero bits past it were decoded and only the last byte's
+		// padding is left over
+		if (j->code_bits < 24) stbi__grow_buffer_unsafe(j);
+		if (j->marker != scan->starts[i + 1][-1] || j->code_bits < j->zero_fill || j->code_bits - j->zero_fill >= 8) {
+			scan->failed[index] = 1;
+			break;
+		}
+	}
+	STBI_FREE(j);
+}
+
+// Decodes a baseline scan's restart intervals through stbi__jpeg_parallel_for. Returns -1 without
+// consuming anything when the scan can't be split that way or any interval fails to decode, so the
+// serial decoder takes it and reports the error.
+static int stbi__jpeg_decode_parallel(stbi__jpeg *z)
+{
+	stbi__jpeg_intervals scan;
+	stbi_uc *p, *end;
+	int n;
+	if (!stbi__jpeg_parallel_for || z->progressive || !z->restart_interval || z->s->read_from_callbacks)
+		return -1;
+	if (z->scan_n == 1) {
+		n = z->order[0];
+		scan.mcu_count = ((z->img_comp[n].x + 7) >> 3) * ((z->img_comp[n].y + 7) >> 3);
+	}
+	else
+		scan.mcu_count = z->img_mcu_x * z->img_mcu_y;
+	scan.interval_count = (scan.mcu_count + z->restart_interval - 1) / z->restart_interval;
+	if (scan.interval_count < 2)
+		return -1;
+	scan.starts = (stbi_uc **)stbi__malloc_mad2(scan.interval_count + 1, (int)sizeof(stbi_uc *), 0);
+	if (!scan.starts)
+		return -1;
+
+	// find the markers: 0xff00 is a stuffed 0xff, 0xffd0-0xffd7 start the next interval, any other ends the scan
+	p = z->s->img_buffer;
+	end = z->s->img_buffer_end;
+	scan.starts[0] = p;
+	n = 0;
+	while (p < end) {
+		if (*p++ != 0xff) continue;
+		while (p < end && *p == 0xff) ++p; // fill bytes
+		if (p == end || *p == 0x00) {
+			++p;
+			continue;
+		}
+		if (!STBI__RESTART(*p) || ++n == scan.interval_count || *p != 0xd0 + ((n - 1) & 7))
+			break;
+		scan.starts[n] = ++p;
+	}
+	if (p >= end || STBI__RESTART(*p) || n + 1 != scan.interval_count) {
+		// truncated, out of sequence, or the markers don't match the restart interval
+		STBI_FREE(scan.starts);
+		return -1;
+	}
+	scan.starts[scan.interval_count] = p + 1;
+
+	scan.z = z;
+	scan.task_count = scan.interval_count < STBI__JPEG_MAX_TASKS ? scan.interval_count : STBI__JPEG_MAX_TASKS;
+	memset(scan.failed, 0, sizeof(scan.failed));
+	stbi__jpeg_parallel_for(stbi__jpeg_parallel_user, stbi__jpeg_decode_intervals_task, &scan, scan.task_count);
+	STBI_FREE(scan.starts);
+	for (n = 0; n < scan.task_count; ++n)
+		if (scan.failed[n])
+			return -1; // the serial decoder rewrites every block the tasks touched
+
+	// leave the stream where the serial decoder would: past the marker that ended the scan
+	z->marker = *p;
+	z->s->img_buffer = p + 1;
+	return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
 	stbi__jpeg_reset(z);
 	if (!z->progressive) {
+		int parallel = stbi__jpeg_decode_parallel(z);
+		if (parallel >= 0) return parallel;
 		if (z->scan_n == 1) {
 			int i, j;
 			STBI_SIMD_ALIGN(short, data[64]);
@@ -2781,7 +3369,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 				for (i = 0; i < w; ++i) {
 					int ha = z->img_comp[n].ha;
 					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
+					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * z->block_size + i * z->block_size, z->img_comp[n].w2, data);
 					// every data block is an MCU, so countdown the restart interval
 					if (--z->todo <= 0) {
 						if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2791,6 +3379,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 						stbi__jpeg_reset(z);
 					}
 				}
+				if (z->stream_rows) stbi__jpeg_rows_decoded(z, j + 1, h);
 			}
 			return 1;
 		}
@@ -2806,8 +3395,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 						// by the basic H and V specified for the component
 						for (y = 0; y < z->img_comp[n].v; ++y) {
 							for (x = 0; x < z->img_comp[n].h; ++x) {
-								int x2 = (i*z->img_comp[n].h + x) * 8;
-								int y2 = (j*z->img_comp[n].v + y) * 8;
+								int x2 = (i*z->img_comp[n].h + x) * z->block_size;
+								int y2 = (j*z->img_comp[n].v + y) * z->block_size;
 								int ha = z->img_comp[n].ha;
 								if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
 								z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*y2 + x2, z->img_comp[n].w2, data);
@@ -2822,6 +3411,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 						stbi__jpeg_reset(z);
 					}
 				}
+				if (z->stream_rows) stbi__jpeg_rows_decoded(z, j + 1, z->img_mcu_y);
 			}
 			return 1;
 		}
@@ -2910,7 +3500,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
 				for (i = 0; i < w; ++i) {
 					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
 					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * 8 + i * 8, z->img_comp[n].w2, data);
+					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2*j * z->block_size + i * z->block_size, z->img_comp[n].w2, data);
 				}
 			}
 		}
@@ -3143,8 +3733,8 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 		//
 		// img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
 		// so these muls can't overflow with 32-bit ints (which we require)
-		z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-		z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+		z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->block_size;
+		z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * z->block_size;
 		z->img_comp[i].coeff = 0;
 		z->img_comp[i].raw_coeff = 0;
 		z->img_comp[i].linebuf = NULL;
@@ -3154,16 +3744,22 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 		// align blocks for idct using mmx/sse
 		z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
 		if (z->progressive) {
-			// w2, h2 are multiples of 8 (see above)
-			z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-			z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-			z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+			// blocks of 64 coefficients whatever the block size
+			z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+			z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+			z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
 			if (z->img_comp[i].raw_coeff == NULL)
 				return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
 			z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
 		}
 	}
 
+	// everything above counts full size blocks, from here on the image is the reduced one
+	if (z->block_size < 8) {
+		s->img_x = (s->img_x + (1 << s->scale_shift) - 1) >> s->scale_shift;
+		s->img_y = (s->img_y + (1 << s->scale_shift) - 1) >> s->scale_shift;
+	}
+
 	return 1;
 }
 
@@ -3214,7 +3810,12 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 	while (!stbi__EOI(m)) {
 		if (stbi__SOS(m)) {
 			if (!stbi__process_scan_header(j)) return 0;
+			if (j->output && !j->progressive) {
+				if (!stbi__jpeg_begin_output(j, j->output)) return 0;
+				j->stream_rows = j->scan_n == j->s->img_n;
+			}
 			if (!stbi__parse_entropy_coded_data(j)) return 0;
+			j->stream_rows = 0;
 			if (j->marker == STBI__MARKER_none) {
 				// handle 0s at the end of image data from IP Kamera 9060
 				while (!stbi__at_eof(j->s)) {
@@ -3231,6 +3832,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 			int Ld = stbi__get16be(j->s);
 			stbi__uint32 NL = stbi__get16be(j->s);
 			if (Ld != 4) return stbi__err("bad DNL len", "Corrupt JPEG");
+			if (j->block_size < 8) NL = (NL + (1 << j->s->scale_shift) - 1) >> j->s->scale_shift;
 			if (NL != j->s->img_y) return stbi__err("bad DNL height", "Corrupt JPEG");
 		}
 		else {
@@ -3474,7 +4076,7 @@ static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc
 		out[0] = (stbi_uc)r;
 		out[1] = (stbi_uc)g;
 		out[2] = (stbi_uc)b;
-		out[3] = 255;
+		if (step == 4) out[3] = 255; // rows may end at the edge of the caller's memory
 		out += step;
 	}
 }
@@ -3608,18 +4210,143 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 		out[0] = (stbi_uc)r;
 		out[1] = (stbi_uc)g;
 		out[2] = (stbi_uc)b;
-		out[3] = 255;
+		if (step == 4) out[3] = 255;
 		out += step;
 	}
 }
 #endif
 
+#ifdef STBI_AVX2
+// chroma samples [from, to) of a row, upsampled the way stbi__resample_row_hv_2 (h2: stbi__resample_row_h_2, far == near)
+// does it, then converted; the edges of the avx2 kernel below. to - from is at most 16.
+static void stbi__upsample_YCbCr_to_RGBA_run(stbi_uc *out, stbi_uc const *y, stbi_uc const *cb_near, stbi_uc const *cb_far,
+	stbi_uc const *cr_near, stbi_uc const *cr_far, int h2, int w, int count, int from, int to)
+{
+	stbi_uc cb[32], cr[32];
+	int c, n = 0, pixels;
+	for (c = from; c < to; ++c) {
+		int l = c > 0 ? c - 1 : c;
+		int r = c < w - 1 ? c + 1 : c;
+		int cbt = 3 * cb_near[c] + cb_far[c];
+		int crt = 3 * cr_near[c] + cr_far[c];
+		cb[n] = stbi__div16(3 * cbt + 3 * cb_near[l] + cb_far[l] + 8);
+		cr[n++] = stbi__div16(3 * crt + 3 * cr_near[l] + cr_far[l] + 8);
+		cb[n] = stbi__div16(3 * cbt + 3 * cb_near[r] + cb_far[r] + 8);
+		cr[n++] = stbi__div16(3 * crt + 3 * cr_near[r] + cr_far[r] + 8);
+		if (h2 && c == w - 1 && c > 0) {
+			// stbi__resample_row_h_2 weights the last even sample towards its left neighbour
+			cb[n - 2] = stbi__div4(3 * cb_near[c - 1] + cb_near[c] + 2);
+			cr[n - 2] = stbi__div4(3 * cr_near[c - 1] + cr_near[c] + 2);
+		}
+	}
+	pixels = (2 * to < count ? 2 * to : count) - 2 * from;
+	stbi__YCbCr_to_RGB_row(out + 8 * from, y + 2 * from, cb, cr, pixels, 4);
+}
+
+// 16 pixels of y, cb and cr, one per 16-bit lane, to RGBA: the math of stbi__YCbCr_to_RGB_simd
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGBA_avx2(stbi_uc *out, __m256i y, __m256i cb, __m256i cr)
+{
+	__m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f*4096.0f + 0.5f));
+	__m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f*4096.0f + 0.5f));
+	__m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f*4096.0f + 0.5f));
+	__m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f*4096.0f + 0.5f));
+	__m256i bias = _mm256_set1_epi16(128);
+	__m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+	// y in the high byte with 128 below it, cr and cb centered and shifted left by 8
+	__m256i yw = _mm256_or_si256(_mm256_slli_epi16(y, 8), bias);
+	__m256i crw = _mm256_slli_epi16(_mm256_sub_epi16(cr, bias), 8);
+	__m256i cbw = _mm256_slli_epi16(_mm256_sub_epi16(cb, bias), 8);
+
+	// color transform
+	__m256i yws = _mm256_srli_epi16(yw, 4);
+	__m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+	__m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+	__m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+	__m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+	__m256i rw = _mm256_srai_epi16(_mm256_add_epi16(cr0, yws), 4);
+	__m256i gw = _mm256_srai_epi16(_mm256_add_epi16(_mm256_add_epi16(cb0, yws), cr1), 4);
+	__m256i bw = _mm256_srai_epi16(_mm256_add_epi16(yws, cb1), 4);
+
+	// back to byte and interleave, per 128-bit lane: pixels 0-3 and 8-11 in o0, 4-7 and 12-15 in o1
+	__m256i brb = _mm256_packus_epi16(rw, bw);
+	__m256i gxb = _mm256_packus_epi16(gw, xw);
+	__m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+	__m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+	__m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+	__m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+	_mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+	_mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+}
+
+// 3*near + far of the 16 chroma samples at p, as 16-bit lanes
+#define stbi__avx2_chroma_rows(near, far, i) \
+	_mm256_add_epi16(_mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) ((near) + (i)))), _mm256_set1_epi16(3)), \
+		_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) ((far) + (i)))))
+
+// the horizontal half of the upsampling: (3*cur + prev + 8) >> 4 even, (3*cur + next + 8) >> 4 odd,
+// interleaved into 32 output samples, pixels 0-15 in *lo and 16-31 in *hi
+#define stbi__avx2_chroma_cols(prev, cur, next, lo, hi) \
+	{ \
+		__m256i curb = _mm256_add_epi16(_mm256_slli_epi16(cur, 2), _mm256_set1_epi16(8)); \
+		__m256i even = _mm256_srli_epi16(_mm256_add_epi16(curb, _mm256_sub_epi16(prev, cur)), 4); \
+		__m256i odd = _mm256_srli_epi16(_mm256_add_epi16(curb, _mm256_sub_epi16(next, cur)), 4); \
+		__m256i int0 = _mm256_unpacklo_epi16(even, odd); \
+		__m256i int1 = _mm256_unpackhi_epi16(even, odd); \
+		lo = _mm256_permute2x128_si256(int0, int1, 0x20); \
+		hi = _mm256_permute2x128_si256(int0, int1, 0x31); \
+	}
+
+// stbi__resample_row_hv_2 (or _h_2 with far == near) of cb and cr and stbi__YCbCr_to_RGB_simd in one pass with RGBA
+// output, so the upsampled chroma rows are never written out. Same results as the separate kernels.
+static STBI__AVX2_TARGET void stbi__upsample_YCbCr_to_RGBA_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *cb_near, stbi_uc const *cb_far,
+	stbi_uc const *cr_near, stbi_uc const *cr_far, int w, int count)
+{
+	int i, h2 = cb_far == NULL;
+	if (h2) {
+		// 3*near + near is 4*near, the same filter without the vertical half
+		cb_far = cb_near;
+		cr_far = cr_near;
+	}
+	// the first sample has no left neighbour
+	stbi__upsample_YCbCr_to_RGBA_run(out, y, cb_near, cb_far, cr_near, cr_far, h2, w, count, 0, 1);
+
+	// 16 chroma samples, 32 pixels, as long as their right neighbour is in the row
+	for (i = 1; i + 16 < w; i += 16) {
+		__m256i cb_lo, cb_hi, cr_lo, cr_hi;
+		__m256i cb_cur = stbi__avx2_chroma_rows(cb_near, cb_far, i);
+		__m256i cb_prev = stbi__avx2_chroma_rows(cb_near, cb_far, i - 1);
+		__m256i cb_next = stbi__avx2_chroma_rows(cb_near, cb_far, i + 1);
+		__m256i cr_cur = stbi__avx2_chroma_rows(cr_near, cr_far, i);
+		__m256i cr_prev = stbi__avx2_chroma_rows(cr_near, cr_far, i - 1);
+		__m256i cr_next = stbi__avx2_chroma_rows(cr_near, cr_far, i + 1);
+		stbi__avx2_chroma_cols(cb_prev, cb_cur, cb_next, cb_lo, cb_hi)
+		stbi__avx2_chroma_cols(cr_prev, cr_cur, cr_next, cr_lo, cr_hi)
+
+		stbi__YCbCr_to_RGBA_avx2(out + i * 8, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y + i * 2))), cb_lo, cr_lo);
+		stbi__YCbCr_to_RGBA_avx2(out + i * 8 + 64, _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y + i * 2 + 16))), cb_hi, cr_hi);
+	}
+	_mm256_zeroupper();
+
+	if (i < w)
+		stbi__upsample_YCbCr_to_RGBA_run(out, y, cb_near, cb_far, cr_near, cr_far, h2, w, count, i, w);
+}
+
+#undef stbi__avx2_chroma_rows
+#undef stbi__avx2_chroma_cols
+#endif // STBI_AVX2
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
 	j->idct_block_kernel = stbi__idct_block;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+	j->upsample_YCbCr_to_RGBA_kernel = NULL;
+	j->output = NULL;
+	j->stream_rows = 0;
+	j->block_size = 8;
+	j->interval_task = 0;
 
 #ifdef STBI_SSE2
 	if (stbi__sse2_available()) {
@@ -3629,6 +4356,13 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
 	}
 #endif
 
+#ifdef STBI_AVX2
+	if (stbi__jpeg_avx2 && stbi__avx2_available()) {
+		j->idct_block_kernel = stbi__idct_avx2;
+		j->upsample_YCbCr_to_RGBA_kernel = stbi__upsample_YCbCr_to_RGBA_avx2;
+	}
+#endif
+
 #ifdef STBI_NEON
 	j->idct_block_kernel = stbi__idct_simd;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3650,6 +4384,7 @@ typedef struct
 	int w_lores; // horizontal pixels pre-expansion
 	int ystep;   // how far through vertical expansion we are
 	int ypos;    // which pre-expansion row we're on
+	int h_lores; // rows pre-expansion
 } stbi__resample;
 
 // fast 0..255 * 0..255 => 0..255 rounded multiplication
@@ -3659,172 +4394,252 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 	return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+struct stbi__jpeg_output
 {
-	int n, decode_n, is_rgb;
-	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-	// validate req_comp
-	if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+	int req_comp;
+	int n, decode_n, is_rgb, fused;
+	stbi__resample res_comp[4];
+	stbi_uc *output;
+	size_t out_stride;
+	int in_place; // output is the stbi_load_into destination
+	stbi__uint32 next_row; // rows before it are converted
+};
 
-	// load a jpeg image from whichever source, but leave in YCbCr format
-	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+// Allocates the line buffers and the output. Once the frame header is in; again later does nothing.
+static int stbi__jpeg_begin_output(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+	int k, n;
+	if (o->output) return 1;
 
 	// determine actual number of components to generate
-	n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+	n = o->n = o->req_comp ? o->req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-	is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+	o->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
 
-	if (z->s->img_n == 3 && n < 3 && !is_rgb)
-		decode_n = 1;
+	if (z->s->img_n == 3 && n < 3 && !o->is_rgb)
+		o->decode_n = 1;
 	else
-		decode_n = z->s->img_n;
-
-	// resample and color-convert
-	{
-		int k;
-		unsigned int i, j;
-		stbi_uc *output;
-		stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-		stbi__resample res_comp[4];
+		o->decode_n = z->s->img_n;
+
+	for (k = 0; k < o->decode_n; ++k) {
+		stbi__resample *r = &o->res_comp[k];
+
+		// allocate line buffer big enough for upsampling off the edges
+		// with upsample factor of 4
+		z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
+		if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+		r->hs = z->img_h_max / z->img_comp[k].h;
+		r->vs = z->img_v_max / z->img_comp[k].v;
+		r->ystep = r->vs >> 1;
+		r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+		r->h_lores = (z->img_comp[k].y * z->block_size + 7) >> 3;
+		r->ypos = 0;
+		r->line0 = r->line1 = z->img_comp[k].data;
+
+		if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+		else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+		else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+		else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+		else                               r->resample = stbi__resample_row_generic;
+	}
+
+	// 4:2:0 and 4:2:2 to RGBA: the chroma rows go straight into the fused kernel instead of being upsampled first
+	o->fused = z->upsample_YCbCr_to_RGBA_kernel && n == 4 && z->s->img_n == 3 && !o->is_rgb
+		&& o->res_comp[0].hs == 1 && o->res_comp[0].vs == 1
+		&& o->res_comp[1].hs == 2 && o->res_comp[1].vs <= 2 && o->res_comp[2].hs == 2 && o->res_comp[2].vs == o->res_comp[1].vs;
+
+	o->out_stride = (size_t)n * z->s->img_x;
+	if (z->s->out_target && !stbi__vertically_flip_on_load && n == o->req_comp
+		&& (size_t)z->s->out_pitch >= o->out_stride
+		&& (size_t)z->s->out_pitch * (z->s->img_y - 1) + o->out_stride <= z->s->out_target_size) {
+		// stbi_load_into: rows go straight to the caller's memory, nothing is written past a row's width
+		o->output = z->s->out_target;
+		o->out_stride = z->s->out_pitch;
+		o->in_place = 1;
+	}
+	else {
+		o->output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+		if (!o->output) return stbi__err("outofmem", "Out of memory");
+		o->in_place = 0;
+	}
+	o->next_row = 0;
+	return 1;
+}
 
+// Resamples and color-converts rows [next_row, row_end), whose component rows must all be decoded
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__jpeg_output *o, int row_end)
+{
+	int k;
+	unsigned int i, j;
+	int n = o->n, decode_n = o->decode_n, is_rgb = o->is_rgb, fused = o->fused;
+	stbi_uc *output = o->output;
+	size_t out_stride = o->out_stride;
+	stbi__resample *res_comp = o->res_comp;
+	stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+	stbi_uc *cnear[4] = { NULL, NULL, NULL, NULL }, *cfar[4] = { NULL, NULL, NULL, NULL };
+
+	for (j = o->next_row; j < (unsigned int)row_end; ++j) {
+		stbi_uc *out = output + out_stride * j;
 		for (k = 0; k < decode_n; ++k) {
 			stbi__resample *r = &res_comp[k];
-
-			// allocate line buffer big enough for upsampling off the edges
-			// with upsample factor of 4
-			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-			r->hs = z->img_h_max / z->img_comp[k].h;
-			r->vs = z->img_v_max / z->img_comp[k].v;
-			r->ystep = r->vs >> 1;
-			r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-			r->ypos = 0;
-			r->line0 = r->line1 = z->img_comp[k].data;
-
-			if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-			else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-			else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-			else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-			else                               r->resample = stbi__resample_row_generic;
-		}
-
-		// can't error after this so, this is safe
-		output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j) {
-			stbi_uc *out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k) {
-				stbi__resample *r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
+			int y_bot = r->ystep >= (r->vs >> 1);
+			if (fused && k > 0) {
+				cnear[k] = y_bot ? r->line1 : r->line0;
+				cfar[k] = r->vs == 2 ? (y_bot ? r->line0 : r->line1) : NULL;
+			}
+			else
 				coutput[k] = r->resample(z->img_comp[k].linebuf,
 					y_bot ? r->line1 : r->line0,
 					y_bot ? r->line0 : r->line1,
 					r->w_lores, r->hs);
-				if (++r->ystep >= r->vs) {
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
+			if (++r->ystep >= r->vs) {
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < r->h_lores)
+					r->line1 += z->img_comp[k].w2;
 			}
-			if (n >= 3) {
-				stbi_uc *y = coutput[0];
-				if (z->s->img_n == 3) {
-					if (is_rgb) {
-						for (i = 0; i < z->s->img_x; ++i) {
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else {
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+		}
+		if (n >= 3) {
+			stbi_uc *y = coutput[0];
+			if (z->s->img_n == 3) {
+				if (is_rgb) {
+					for (i = 0; i < z->s->img_x; ++i) {
+						out[0] = y[i];
+						out[1] = coutput[1][i];
+						out[2] = coutput[2][i];
+						if (n == 4) out[3] = 255;
+						out += n;
 					}
 				}
-				else if (z->s->img_n == 4) {
-					if (z->app14_color_transform == 0) { // CMYK
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2) { // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else { // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
+				else if (fused) {
+					z->upsample_YCbCr_to_RGBA_kernel(out, y, cnear[1], cfar[1], cnear[2], cfar[2], res_comp[1].w_lores, z->s->img_x);
 				}
-				else
+				else {
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else if (z->s->img_n == 4) {
+				if (z->app14_color_transform == 0) { // CMYK
 					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(coutput[0][i], m);
+						out[1] = stbi__blinn_8x8(coutput[1][i], m);
+						out[2] = stbi__blinn_8x8(coutput[2][i], m);
+						if (n == 4) out[3] = 255;
 						out += n;
 					}
-			}
-			else {
-				if (is_rgb) {
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else {
-						for (i = 0; i < z->s->img_x; ++i, out += 2) {
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
 				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				else if (z->app14_color_transform == 2) { // YCCK
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
 					for (i = 0; i < z->s->img_x; ++i) {
 						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
+						out[0] = stbi__blinn_8x8(255 - out[0], m);
+						out[1] = stbi__blinn_8x8(255 - out[1], m);
+						out[2] = stbi__blinn_8x8(255 - out[2], m);
 						out += n;
 					}
 				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+				else { // YCbCr + alpha?  Ignore the fourth channel for now
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = out[1] = out[2] = y[i];
+					if (n == 4) out[3] = 255;
+					out += n;
+				}
+		}
+		else {
+			if (is_rgb) {
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i)
+						*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+				else {
+					for (i = 0; i < z->s->img_x; ++i, out += 2) {
+						out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
 						out[1] = 255;
-						out += n;
 					}
 				}
-				else {
-					stbi_uc *y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+					stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+					stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+					out[0] = stbi__compute_y(r, g, b);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+					out[1] = 255;
+					out += n;
 				}
 			}
+			else {
+				stbi_uc *y = coutput[0];
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+				else
+					for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+			}
 		}
+	}
+	if (o->in_place && z->s->rows_ready && row_end > (int)o->next_row)
+		stbi__rows_ready(z->s, (int)o->next_row, row_end - (int)o->next_row);
+	o->next_row = row_end;
+}
+
+static void stbi__jpeg_rows_decoded(stbi__jpeg *z, int mcu_rows, int mcu_row_count)
+{
+	// upsampling reads the chroma row after the one it's on, stay clear of the MCU row still to decode
+	int row_end = mcu_rows == mcu_row_count ? (int)z->s->img_y : mcu_rows * z->img_v_max * z->block_size - 2 * z->img_v_max;
+	if (row_end > (int)z->s->img_y) row_end = z->s->img_y;
+	if (z->output->in_place && row_end > (int)z->output->next_row)
+		stbi__jpeg_convert_rows(z, z->output, row_end);
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+	stbi__jpeg_output o;
+	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+	// validate req_comp
+	if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+	// stbi_load_scaled: smaller blocks out of a reduced IDCT, the rest of the decode doesn't change
+	if (z->s->scale_shift) {
+		static void(*const scaled_kernels[4])(stbi_uc *out, int out_stride, short data[64]) =
+		{ NULL, stbi__idct_block_4x4, stbi__idct_block_2x2, stbi__idct_block_1x1 };
+		z->block_size = 8 >> z->s->scale_shift;
+		z->idct_block_kernel = scaled_kernels[z->s->scale_shift];
+	}
+
+	o.req_comp = req_comp;
+	o.output = NULL;
+	// stbi_load_into_rows: set up at the first scan so rows can be converted while it decodes
+	z->output = z->s->rows_ready && z->s->out_target ? &o : NULL;
+	z->stream_rows = 0;
+
+	// load a jpeg image from whichever source, but leave in YCbCr format
+	if (!stbi__decode_jpeg_image(z) || !stbi__jpeg_begin_output(z, &o)) {
+		if (o.output && !o.in_place) STBI_FREE(o.output);
 		stbi__cleanup_jpeg(z);
-		*out_x = z->s->img_x;
-		*out_y = z->s->img_y;
-		if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-		return output;
+		return NULL;
 	}
+
+	// resample and color-convert what the scans didn't; can't error after this so, this is safe
+	stbi__jpeg_convert_rows(z, &o, z->s->img_y);
+	stbi__cleanup_jpeg(z);
+	*out_x = z->s->img_x;
+	*out_y = z->s->img_y;
+	if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+	return o.output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -3883,6 +4698,12 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 
 #ifndef STBI_NO_ZLIB
 
+// the fast inflate loop reads 8 input bytes at a time straight into a 64-bit little-endian bit buffer
+#if !defined(STBI_NO_FAST_INFLATE) && (defined(__x86_64__) || defined(_M_X64) || defined(_M_ARM64) \
+	|| (defined(__aarch64__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+#define STBI__FAST_INFLATE
+#endif
+
 // fast-way is faster to check than jpeg huffman, but slow way is slower
 #define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
@@ -3981,6 +4802,10 @@ typedef struct
 	int   z_expandable;
 
 	stbi__zhuffman z_length, z_distance;
+
+	// called after every block with all the output so far, 0 stops with an error
+	int(*progress)(void *user, stbi_uc *out, stbi__uint32 len);
+	void *progress_user;
 } stbi__zbuf;
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4073,9 +4898,161 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
 
+#ifdef STBI__FAST_INFLATE
+// literal/length table on STBI__ZLIT_BITS bits: bits 0-7 the bits to consume, 8-9 the number of literals
+// (up to two, in bits 16-23 and 24-31) or 0 for a length/end symbol in bits 16-31. 0 when the code is longer.
+#define STBI__ZLIT_BITS 11
+#define STBI__ZLIT_MASK ((1 << STBI__ZLIT_BITS) - 1)
+
+// symbol of the code in the low bits, -1 if it is invalid or longer than maxbits
+static int stbi__zdecode_bits(stbi__zhuffman *z, int bits, int maxbits, int *size)
+{
+	int b = z->fast[bits & STBI__ZFAST_MASK], k, s;
+	if (b) {
+		*size = b >> 9;
+		return *size <= maxbits ? (b & 511) : -1;
+	}
+	k = stbi__bit_reverse(bits & 0xffff, 16);
+	for (s = STBI__ZFAST_BITS + 1; s <= maxbits; ++s) {
+		if (k < z->maxcode[s]) {
+			*size = s;
+			return z->value[(k >> (16 - s)) - z->firstcode[s] + z->firstsymbol[s]];
+		}
+	}
+	return -1;
+}
+
+static void stbi__zbuild_literal_table(stbi__zhuffman *z, stbi__uint32 *table)
+{
+	int i, j, s, c, count, v;
+	stbi__uint32 e, e2;
+	// one symbol per entry, every code of up to STBI__ZLIT_BITS bits repeated over the bits after it
+	memset(table, 0, sizeof(stbi__uint32) << STBI__ZLIT_BITS);
+	for (s = 1; s <= STBI__ZLIT_BITS; ++s) {
+		count = (z->maxcode[s] >> (16 - s)) - z->firstcode[s];
+		for (c = 0; c < count; ++c) {
+			v = z->value[z->firstsymbol[s] + c];
+			e = (stbi__uint32)(s | (v < 256 ? 1 << 8 : 0) | (v << 16));
+			for (j = stbi__bit_reverse(z->firstcode[s] + c, s); j < (1 << STBI__ZLIT_BITS); j += 1 << s)
+				table[j] = e;
+		}
+	}
+	// then a second literal where its code fits in the bits left; going down, i >> s is still a single symbol
+	for (i = (1 << STBI__ZLIT_BITS) - 1; i >= 0; --i) {
+		e = table[i];
+		s = e & 255;
+		if (!(e & 0x100) || s == STBI__ZLIT_BITS) continue;
+		e2 = table[i >> s];
+		if ((e2 & 0x100) && (int)(e2 & 255) <= STBI__ZLIT_BITS - s)
+			table[i] = ((e & ~0x300u) + (e2 & 255)) | (2 << 8) | ((e2 >> 16) << 24);
+	}
+}
+
+// Decodes while 8 input bytes can be read at once and a match can be copied 8 bytes at a time, with one
+// refill per symbol: the refill leaves at least 56 bits, a length and distance with extra bits need 48.
+// Returns 1 at the end of the block, 0 on corrupt data, -1 near the ends for stbi__parse_huffman_block to finish.
+static int stbi__parse_huffman_block_fast(stbi__zbuf *a)
+{
+	stbi__uint32 table[1 << STBI__ZLIT_BITS];
+	unsigned long long bits = a->code_buffer, next;
+	int num_bits = a->num_bits;
+	stbi_uc *in = a->zbuffer;
+	char *zout = a->zout, *src, *end;
+	int result = -1, z, s, len, dist;
+	stbi__uint32 e;
+	if (a->zbuffer_end - in < 8 || a->zout_end - zout < 258 + 8) return -1;
+	stbi__zbuild_literal_table(&a->z_length, table);
+	while (a->zbuffer_end - in >= 8 && a->zout_end - zout >= 258 + 8) {
+		memcpy(&next, in, 8);
+		bits |= next << num_bits;
+		in += (63 - num_bits) >> 3;
+		num_bits |= 56;
+
+		e = table[bits & STBI__ZLIT_MASK];
+		if (e & 0x300) {
+			zout[0] = (char)(e >> 16);
+			zout[1] = (char)(e >> 24);
+			zout += (e >> 8) & 3;
+			bits >>= e & 255;
+			num_bits -= e & 255;
+			continue;
+		}
+		if (e) {
+			z = (int)(e >> 16);
+			s = e & 255;
+		}
+		else {
+			z = stbi__zdecode_bits(&a->z_length, (int)(bits & 0xffff), 15, &s);
+			if (z < 0) { result = stbi__err("bad huffman code", "Corrupt PNG"); break; }
+		}
+		bits >>= s;
+		num_bits -= s;
+		if (z < 256) {
+			*zout++ = (char)z;
+			continue;
+		}
+		if (z == 256) {
+			result = 1;
+			break;
+		}
+		z -= 257;
+		len = stbi__zlength_base[z];
+		s = stbi__zlength_extra[z];
+		len += (int)(bits & ((1u << s) - 1));
+		bits >>= s;
+		num_bits -= s;
+		z = stbi__zdecode_bits(&a->z_distance, (int)(bits & 0xffff), 15, &s);
+		if (z < 0) { result = stbi__err("bad huffman code", "Corrupt PNG"); break; }
+		bits >>= s;
+		num_bits -= s;
+		dist = stbi__zdist_base[z];
+		s = stbi__zdist_extra[z];
+		dist += (int)(bits & ((1u << s) - 1));
+		bits >>= s;
+		num_bits -= s;
+		if (zout - a->zout_start < dist) { result = stbi__err("bad dist", "Corrupt PNG"); break; }
+
+		src = zout - dist;
+		end = zout + len;
+		if (dist >= 8) {
+			// may write up to 7 bytes past the match, the margin above keeps that inside the buffer
+			do {
+				memcpy(zout, src, 8);
+				zout += 8;
+				src += 8;
+			} while (zout < end);
+			zout = end;
+		}
+		else if (dist == 1) {
+			memset(zout, *src, len);
+			zout = end;
+		}
+		else {
+			while (zout < end) *zout++ = *src++;
+		}
+	}
+
+	// give back the whole bytes still in the bit buffer
+	in -= num_bits >> 3;
+	num_bits &= 7;
+	a->code_buffer = (stbi__uint32)bits & ((1u << num_bits) - 1);
+	a->num_bits = num_bits;
+	a->zbuffer = in;
+	a->zout = zout;
+	return result;
+}
+#endif
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
-	char *zout = a->zout;
+	char *zout;
+#ifdef STBI__FAST_INFLATE
+	if (stbi__png_fast_decode) {
+		int fast = stbi__parse_huffman_block_fast(a);
+		if (fast >= 0) return fast;
+	}
+#endif
+	zout = a->zout;
 	for (;;) {
 		int z = stbi__zhuffman_decode(a, &a->z_length);
 		if (z < 256) {
@@ -4265,12 +5242,14 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 			}
 			if (!stbi__parse_huffman_block(a)) return 0;
 		}
+		if (a->progress && !a->progress(a->progress_user, (stbi_uc *)a->zout_start, (stbi__uint32)(a->zout - a->zout_start))) return 0;
 	} while (!final);
 	return 1;
 }
 
 static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse_header)
 {
+	a->progress = NULL;
 	a->zout_start = obuf;
 	a->zout = obuf;
 	a->zout_end = obuf + olen;
@@ -4433,35 +5412,149 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+#ifdef STBI_AVX2
+STBI__AVX2_TARGET static void stbi__png_unfilter_up_avx2(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int n)
+{
+	int k = 0;
+	for (; k + 32 <= n; k += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(raw + k));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(prior + k));
+		_mm256_storeu_si256((__m256i *)(cur + k), _mm256_add_epi8(x, b));
+	}
+	for (; k < n; ++k)
+		cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+#endif
+
+static void stbi__png_unfilter_up_sse2(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int n)
+{
+	int k = 0;
+	for (; k + 16 <= n; k += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(raw + k));
+		__m128i b = _mm_loadu_si128((const __m128i *)(prior + k));
+		_mm_storeu_si128((__m128i *)(cur + k), _mm_add_epi8(x, b));
+	}
+	for (; k < n; ++k)
+		cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+}
+
+// n is 3 or 4, fixed size copies so they stay single moves
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+	int v;
+	if (n == 4) {
+		memcpy(&v, p, 4);
+		return _mm_cvtsi32_si128(v);
+	}
+	return _mm_cvtsi32_si128(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, __m128i alpha, int n)
+{
+	int x = _mm_cvtsi128_si32(_mm_or_si128(v, alpha));
+	if (n == 4) {
+		memcpy(p, &x, 4);
+		return;
+	}
+	p[0] = (stbi_uc)x;
+	p[1] = (stbi_uc)(x >> 8);
+	p[2] = (stbi_uc)(x >> 16);
+}
+
+// The pixels after the first of an 8-bit RGB or RGBA row, RGB optionally expanded to RGBA. Sub, Avg and
+// Paeth depend on the pixel to the left, so those go one pixel per step with all channels in one register.
+static void stbi__png_unfilter_row_sse2(int filter, stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, stbi__uint32 count, int img_n, int out_n)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi8(1);
+	__m128i alpha = _mm_cvtsi32_si128(out_n > img_n ? (int)0xff000000 : 0);
+	__m128i a = stbi__png_load_pixel(cur - out_n, img_n), b, c, x;
+	stbi__uint32 i;
+	switch (filter) {
+	case STBI__F_none:
+		for (i = 0; i < count; ++i, raw += img_n, cur += out_n)
+			stbi__png_store_pixel(cur, stbi__png_load_pixel(raw, img_n), alpha, out_n);
+		break;
+	case STBI__F_sub:
+	case STBI__F_paeth_first: // paeth(a, 0, 0) is a
+		for (i = 0; i < count; ++i, raw += img_n, cur += out_n) {
+			a = _mm_add_epi8(stbi__png_load_pixel(raw, img_n), a);
+			stbi__png_store_pixel(cur, a, alpha, out_n);
+		}
+		break;
+	case STBI__F_up:
+		if (img_n == out_n) {
+#ifdef STBI_AVX2
+			if (stbi__avx2_available()) {
+				stbi__png_unfilter_up_avx2(cur, prior, raw, (int)count * img_n);
+				break;
+			}
+#endif
+			stbi__png_unfilter_up_sse2(cur, prior, raw, (int)count * img_n);
+			break;
+		}
+		for (i = 0; i < count; ++i, raw += img_n, cur += out_n, prior += out_n)
+			stbi__png_store_pixel(cur, _mm_add_epi8(stbi__png_load_pixel(raw, img_n), stbi__png_load_pixel(prior, img_n)), alpha, out_n);
+		break;
+	case STBI__F_avg:
+	case STBI__F_avg_first:
+		// (a + b) >> 1 is the rounding-up average minus the bit it rounded
+		for (i = 0; i < count; ++i, raw += img_n, cur += out_n, prior += out_n) {
+			b = filter == STBI__F_avg ? stbi__png_load_pixel(prior, img_n) : zero;
+			x = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+			a = _mm_add_epi8(stbi__png_load_pixel(raw, img_n), x);
+			stbi__png_store_pixel(cur, a, alpha, out_n);
+		}
+		break;
+	case STBI__F_paeth:
+		// in 16-bit lanes: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, ties go to a, then b
+		c = _mm_unpacklo_epi8(stbi__png_load_pixel(prior - out_n, img_n), zero);
+		a = _mm_unpacklo_epi8(a, zero);
+		for (i = 0; i < count; ++i, raw += img_n, cur += out_n, prior += out_n) {
+			__m128i pa, pb, pc, smallest, nearest;
+			b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior, img_n), zero);
+			pa = _mm_sub_epi16(b, c);
+			pb = _mm_sub_epi16(a, c);
+			pc = _mm_add_epi16(pa, pb);
+			pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+			pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+			pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			nearest = c;
+			x = _mm_cmpeq_epi16(smallest, pb);
+			nearest = _mm_or_si128(_mm_and_si128(x, b), _mm_andnot_si128(x, nearest));
+			x = _mm_cmpeq_epi16(smallest, pa);
+			nearest = _mm_or_si128(_mm_and_si128(x, a), _mm_andnot_si128(x, nearest));
+			x = _mm_add_epi8(stbi__png_load_pixel(raw, img_n), _mm_packus_epi16(nearest, zero));
+			stbi__png_store_pixel(cur, x, alpha, out_n);
+			a = _mm_unpacklo_epi8(x, zero);
+			c = b;
+		}
+		break;
+	}
+}
+#endif
+
 // create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// Unfilters rows [first, last) into out, row j at out + stride * j. raw starts at row first's filter byte,
+// the rows before first must already be in out.
+static int stbi__png_unfilter_rows(stbi__png *a, stbi_uc *raw, stbi_uc *out, stbi__uint32 stride, int out_n, stbi__uint32 x, stbi__uint32 first, stbi__uint32 last, int depth, stbi__uint32 img_width_bytes)
 {
 	int bytes = (depth == 16 ? 2 : 1);
-	stbi__context *s = a->s;
-	stbi__uint32 i, j, stride = x * out_n*bytes;
-	stbi__uint32 img_len, img_width_bytes;
+	stbi__uint32 i, j;
 	int k;
-	int img_n = s->img_n; // copy it into a local for later
+	int img_n = a->s->img_n;
 
 	int output_bytes = out_n * bytes;
 	int filter_bytes = img_n * bytes;
 	int width = x;
+#ifdef STBI_SSE2
+	int simd = stbi__png_fast_decode && stbi__sse2_available();
+#endif
 
-	STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
-	a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
-	if (!a->out) return stbi__err("outofmem", "Out of memory");
-
-	if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
-	img_width_bytes = (((img_n * x * depth) + 7) >> 3);
-	img_len = (img_width_bytes + 1) * y;
-
-	// we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
-	// but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
-	// so just check for raw_len < img_len always.
-	if (raw_len < img_len) return stbi__err("not enough pixels", "Corrupt PNG");
-
-	for (j = 0; j < y; ++j) {
-		stbi_uc *cur = a->out + stride * j;
+	for (j = first; j < last; ++j) {
+		stbi_uc *cur = out + stride * j;
 		stbi_uc *prior;
 		int filter = *raw++;
 
@@ -4514,6 +5607,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 			prior += 1;
 		}
 
+#ifdef STBI_SSE2
+		if (simd && depth == 8 && (img_n == 3 || img_n == 4)) {
+			stbi__png_unfilter_row_sse2(filter, cur, prior, raw, x - 1, img_n, out_n);
+			raw += (x - 1) * img_n;
+			continue;
+		}
+#endif
+
 		// this is a little gross, so that we don't switch per-pixel or per-component
 		if (depth < 8 || img_n == out_n) {
 			int nk = (width - 1)*filter_bytes;
@@ -4553,13 +5654,41 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 			// the loop above sets the high byte of the pixels' alpha, but for
 			// 16 bit png files we also need the low byte set. we'll do that here.
 			if (depth == 16) {
-				cur = a->out + stride * j; // start at the beginning of the row again
+				cur = out + stride * j; // start at the beginning of the row again
 				for (i = 0; i < x; ++i, cur += output_bytes) {
 					cur[filter_bytes + 1] = 255;
 				}
 			}
 		}
 	}
+	return 1;
+}
+
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+{
+	int bytes = (depth == 16 ? 2 : 1);
+	stbi__context *s = a->s;
+	stbi__uint32 i, j, stride = x * out_n*bytes;
+	stbi__uint32 img_len, img_width_bytes;
+	int k;
+	int img_n = s->img_n; // copy it into a local for later
+
+	int output_bytes = out_n * bytes;
+
+	STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
+	a->out = (stbi_uc *)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+	if (!a->out) return stbi__err("outofmem", "Out of memory");
+
+	if (!stbi__mad3sizes_valid(img_n, x, depth, 7)) return stbi__err("too large", "Corrupt PNG");
+	img_width_bytes = (((img_n * x * depth) + 7) >> 3);
+	img_len = (img_width_bytes + 1) * y;
+
+	// we used to check for exact match between raw_len and img_len on non-interlaced PNGs,
+	// but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
+	// so just check for raw_len < img_len always.
+	if (raw_len < img_len) return stbi__err("not enough pixels", "Corrupt PNG");
+
+	if (!stbi__png_unfilter_rows(a, raw, a->out, stride, out_n, x, 0, y, depth, img_width_bytes)) return 0;
 
 	// we make a separate pass to expand bits to pixels; for performance,
 	// this could run two scanlines behind the above code, so it won't
@@ -4653,6 +5782,55 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
 	return 1;
 }
 
+// stbi_load_into_rows: unfilters rows straight into out_target as the inflate completes them
+typedef struct
+{
+	stbi__png *a;
+	stbi__uint32 img_width_bytes;
+	stbi__uint32 rows_done;
+} stbi__png_rows;
+
+static int stbi__png_rows_inflated(void *user, stbi_uc *raw, stbi__uint32 raw_len)
+{
+	stbi__png_rows *r = (stbi__png_rows *)user;
+	stbi__context *s = r->a->s;
+	stbi__uint32 rows = raw_len / (r->img_width_bytes + 1);
+	if (rows > s->img_y) rows = s->img_y;
+	if (rows <= r->rows_done) return 1;
+	if (!stbi__png_unfilter_rows(r->a, raw + (size_t)r->rows_done * (r->img_width_bytes + 1), s->out_target, s->out_pitch, s->img_out_n,
+		s->img_x, r->rows_done, rows, 8, r->img_width_bytes)) return 0;
+	stbi__rows_ready(s, (int)r->rows_done, (int)(rows - r->rows_done));
+	r->rows_done = rows;
+	return 1;
+}
+
+// Inflates and unfilters an 8-bit non-interlaced image into out_target, row band by row band
+static int stbi__create_png_image_rows(stbi__png *a, stbi__uint32 idata_len, int initial_size, int parse_header)
+{
+	stbi__context *s = a->s;
+	stbi__png_rows rows;
+	stbi__zbuf z;
+	int ok;
+	if (!stbi__mad3sizes_valid(s->img_n, s->img_x, 8, 7)) return stbi__err("too large", "Corrupt PNG");
+	rows.a = a;
+	rows.img_width_bytes = s->img_x * s->img_n;
+	rows.rows_done = 0;
+	z.zbuffer = a->idata;
+	z.zbuffer_end = a->idata + idata_len;
+	z.zout_start = z.zout = (char *)stbi__malloc(initial_size);
+	if (!z.zout) return stbi__err("outofmem", "Out of memory");
+	z.zout_end = z.zout + initial_size;
+	z.z_expandable = 1;
+	z.progress = stbi__png_rows_inflated;
+	z.progress_user = &rows;
+	ok = stbi__parse_zlib(&z, parse_header);
+	STBI_FREE(z.zout_start);
+	if (!ok) return 0;
+	if (rows.rows_done < s->img_y) return stbi__err("not enough pixels", "Corrupt PNG");
+	a->out = s->out_target;
+	return 1;
+}
+
 static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
 	int bytes = (depth == 16 ? 2 : 1);
@@ -4969,13 +6147,22 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 			// initial guess for decoded data size to avoid unnecessary reallocs
 			bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
 			raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-			z->expanded = (stbi_uc *)stbi_zlib_decode_malloc_guesssize_headerflag((char *)z->idata, ioff, raw_len, (int *)&raw_len, !is_iphone);
-			if (z->expanded == NULL) return 0; // zlib should set error
-			STBI_FREE(z->idata); z->idata = NULL;
 			if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
 				s->img_out_n = s->img_n + 1;
 			else
 				s->img_out_n = s->img_n;
+			if (s->rows_ready && s->out_target && z->depth == 8 && !interlace && !pal_img_n && !has_trans && !is_iphone
+				&& s->img_out_n == req_comp && !stbi__vertically_flip_on_load
+				&& (size_t)s->out_pitch >= (size_t)s->img_x * req_comp
+				&& (size_t)s->out_pitch * (s->img_y - 1) + (size_t)s->img_x * req_comp <= s->out_target_size) {
+				// stbi_load_into_rows: nothing to do after unfiltering, so rows go out as the inflate produces them
+				if (!stbi__create_png_image_rows(z, ioff, raw_len, 1)) return 0;
+				STBI_FREE(z->idata); z->idata = NULL;
+				return 1;
+			}
+			z->expanded = (stbi_uc *)stbi_zlib_decode_malloc_guesssize_headerflag((char *)z->idata, ioff, raw_len, (int *)&raw_len, !is_iphone);
+			if (z->expanded == NULL) return 0; // zlib should set error
+			STBI_FREE(z->idata); z->idata = NULL;
 			if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
 			if (has_trans) {
 				if (z->depth == 16) {